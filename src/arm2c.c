@@ -0,0 +1,53 @@
+/**
+ * @file arm2c.c
+ * @brief The main functionality for the ARM11 to C translator.
+ */
+
+#include "arm2c_utils/generate.h"
+
+/**
+ * @brief Translates an ARM11 binary object code file to C.
+ *
+ * The user must provide two arguments, which are a valid file name for an
+ * ARM11 binary object code file, and a file location to which the C will be
+ * written. The C must be compiled with the runtime, for example:
+ *
+ *     gcc -O2 -I src program.c src/arm2c_runtime.a -pthread -o program
+ *
+ * The resulting program prints exactly what the emulator prints.
+ */
+int main(int argc, char **argv) {
+  // Check arguments
+  if (argc != 3) {
+    fprintf(stderr, "Incorrect number of arguments provided.\n");
+    return EXIT_FAILURE;
+  }
+
+  char *load_filename = argv[1];
+  char *save_filename = argv[2];
+
+  // Load the program into a machine, which is used to decode it
+  system_state_t *machine = create_system_state();
+  machine->decode_cache = calloc(NUM_WORDS, sizeof(predecoded_t));
+  if (!machine->decode_cache) {
+    perror("Cannot allocate memory to store decode cache.\n");
+    return EXIT_FAILURE;
+  }
+  load_file(load_filename, machine);
+
+  cfg_t *cfg = build_cfg(machine);
+
+  FILE *out = fopen(save_filename, "w");
+  if (!out) {
+    perror("Error in opening output file.");
+    return EXIT_FAILURE;
+  }
+  generate_program(out, machine, cfg, load_filename);
+  fclose(out);
+
+  // Free allocated memory and exit
+  free_cfg(cfg);
+  free(machine->decode_cache);
+  free_system_state(machine);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,189 @@
+/**
+ * @file cfg.c
+ * @brief Functions for building the control-flow graph of a program.
+ *
+ * Every instruction reachable from address 0 through translatable
+ * instructions is found. Blocks start at address 0, at branch targets and
+ * after conditional branches. Instructions which cannot be translated (and
+ * stop or unknown words) are left to the pipeline at run time.
+ */
+
+#include "cfg.h"
+
+static void find_reachable(system_state_t *machine, cfg_t *cfg);
+static void add_block(system_state_t *machine, cfg_t *cfg, uint32_t start);
+static void push(uint32_t *stack, size_t *size, uint32_t address);
+
+/**
+ * @brief Builds the control-flow graph of the program in memory.
+ *
+ * @param machine The system state holding the program, which is used to
+ * decode instructions.
+ * @returns The control-flow graph.
+ */
+cfg_t *build_cfg(system_state_t *machine) {
+  cfg_t *cfg = calloc(1, sizeof(cfg_t));
+  if (!cfg) {
+    perror("Unable to allocate memory for control-flow graph");
+    exit(EXIT_FAILURE);
+  }
+
+  find_reachable(machine, cfg);
+
+  cfg->blocks = malloc(sizeof(cfg_block_t) * NUM_WORDS);
+  if (!cfg->blocks) {
+    perror("Unable to allocate memory for basic blocks");
+    exit(EXIT_FAILURE);
+  }
+  for (uint32_t i = 0; i < NUM_WORDS; i++) {
+    if (cfg->leader[i]) {
+      add_block(machine, cfg, i << 2);
+    }
+  }
+  return cfg;
+}
+
+/**
+ * @brief Frees a control-flow graph.
+ *
+ * @param cfg The control-flow graph.
+ */
+void free_cfg(cfg_t *cfg) {
+  free(cfg->blocks);
+  free(cfg);
+}
+
+/**
+ * @brief Returns whether an instruction can be translated to C.
+ *
+ * Instructions with an unknown opcode, or which write to PC (indirect
+ * branches, whose targets are not known), are left to the pipeline.
+ * @param instruction The decoded instruction.
+ * @returns Whether the instruction can be translated.
+ */
+bool is_translatable(instruction_t *instruction) {
+  switch (instruction->type) {
+    case DPI:
+      switch (instruction->operation) {
+        case AND:
+        case EOR:
+        case SUB:
+        case RSB:
+        case ADD:
+        case TST:
+        case TEQ:
+        case CMP:
+        case ORR:
+        case MOV:
+          return !writes_pc(instruction);
+        default:
+          return false;
+      }
+    case MUL:
+    case SDT:
+      return !writes_pc(instruction);
+    case BRA:
+      return true;
+    default:
+      return false;
+  }
+}
+
+/**
+ * @brief Finds every translatable instruction reachable from address 0, and
+ * marks the leaders of basic blocks.
+ *
+ * @param machine The system state holding the program.
+ * @param cfg The control-flow graph to fill in.
+ */
+static void find_reachable(system_state_t *machine, cfg_t *cfg) {
+  uint32_t *stack = malloc(sizeof(uint32_t) * NUM_WORDS);
+  size_t size = 0;
+  if (!stack) {
+    perror("Unable to allocate memory for control-flow graph");
+    exit(EXIT_FAILURE);
+  }
+
+  cfg->leader[0] = true;
+  push(stack, &size, 0);
+  while (size) {
+    uint32_t address = stack[--size];
+
+    while (is_cacheable_address(address) && !cfg->reachable[address >> 2]) {
+      word_t word = get_word(machine, address);
+      instruction_type_t type = instruction_type(word);
+      if (type == ZER || type == NUL) {
+        break;
+      }
+      instruction_t *instruction = &predecode(machine, address)->instruction;
+      if (!is_translatable(instruction)) {
+        break;
+      }
+      cfg->reachable[address >> 2] = true;
+
+      if (type == BRA) {
+        uint32_t target = address + 8 + instruction->immediate_value;
+        if (is_cacheable_address(target)) {
+          cfg->leader[target >> 2] = true;
+          push(stack, &size, target);
+        }
+        if (instruction->cond == AL && !instruction->flag_3) {
+          break;
+        }
+        // Reached when the branch is not taken, or when a call returns
+        if (is_cacheable_address(address + 4)) {
+          cfg->leader[(address + 4) >> 2] = true;
+        }
+      }
+      address += 4;
+    }
+  }
+  free(stack);
+}
+
+/**
+ * @brief Adds the basic block starting at a leader.
+ *
+ * @param machine The system state holding the program.
+ * @param cfg The control-flow graph.
+ * @param start The address of the leader.
+ */
+static void add_block(system_state_t *machine, cfg_t *cfg, uint32_t start) {
+  cfg_block_t *block = &cfg->blocks[cfg->num_blocks++];
+  uint32_t address = start;
+
+  block->start = start;
+  while (true) {
+    if (address != start && is_cacheable_address(address)
+      && cfg->leader[address >> 2]) {
+      block->end = FALLTHROUGH_END;
+      break;
+    }
+    if (!is_cacheable_address(address) || !cfg->reachable[address >> 2]) {
+      block->end = PIPELINE_END;
+      break;
+    }
+
+    instruction_t *instruction = &predecode(machine, address)->instruction;
+    address += 4;
+    if (instruction->type == BRA) {
+      block->end = BRANCH_END;
+      block->target = address + 4 + instruction->immediate_value;
+      break;
+    }
+  }
+  block->next_address = address;
+}
+
+/**
+ * @brief Pushes an address onto a stack.
+ *
+ * @param stack The stack, which can hold NUM_WORDS addresses.
+ * @param size The size of the stack.
+ * @param address The address.
+ */
+static void push(uint32_t *stack, size_t *size, uint32_t address) {
+  if (*size < NUM_WORDS) {
+    stack[(*size)++] = address;
+  }
+}
@@ -0,0 +1,55 @@
+/**
+ * @file cfg.h
+ * @brief A header to define the cfg_t type, and header file for cfg.c.
+ */
+
+#ifndef CFG_H
+#define CFG_H
+#include "../emulate_utils/decode.h"
+#include "../emulate_utils/execute.h"
+
+/**
+ * @brief An enum that identifies how a basic block ends.
+ */
+typedef enum {
+  /** Continue at next_address, which starts another block. */
+  FALLTHROUGH_END,
+  /** A branch, which is the last instruction of the block. */
+  BRANCH_END,
+  /** The instruction at next_address must be run by the pipeline. */
+  PIPELINE_END,
+} block_end_t;
+
+/**
+ * @brief A struct that holds a basic block of the control-flow graph.
+ */
+typedef struct {
+  /** The address of the first instruction. */
+  uint32_t start;
+  /** The address after the last instruction of the block. */
+  uint32_t next_address;
+  /** How the block ends. */
+  block_end_t end;
+  /** The branch target (BRANCH_END only). */
+  uint32_t target;
+} cfg_block_t;
+
+/**
+ * @brief A struct that holds the control-flow graph of a program.
+ */
+typedef struct {
+  /** Whether each word is an instruction which can be translated. */
+  bool reachable[NUM_WORDS];
+  /** Whether each word starts a basic block. */
+  bool leader[NUM_WORDS];
+  /** Holds the basic blocks, in order of address. */
+  cfg_block_t *blocks;
+  /** The number of basic blocks. */
+  size_t num_blocks;
+} cfg_t;
+
+cfg_t *build_cfg(system_state_t *machine);
+void free_cfg(cfg_t *cfg);
+bool is_translatable(instruction_t *instruction);
+
+#endif
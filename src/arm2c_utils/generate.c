@@ -0,0 +1,514 @@
+/**
+ * @file generate.c
+ * @brief Functions for writing a translated program as C.
+ *
+ * Each basic block becomes a function which runs its instructions and returns
+ * the address of the next block. run_translated switches on that address to
+ * call the next block, so any target reached at run time (not just those found
+ * when translating) is handled, and addresses without a block hand back to the
+ * pipeline.
+ *
+ * A read of PC is replaced by the address of the instruction plus 8, as the
+ * pipeline would give. The generated code follows the emulator's functions in
+ * execute.c, so the final state is identical.
+ */
+
+#include "generate.h"
+
+/** The number of bytes of the program written per line. */
+#define BYTES_PER_LINE 12
+
+static void generate_image(FILE *out, system_state_t *machine);
+static void generate_code_ranges(FILE *out, cfg_t *cfg);
+static void generate_block(FILE *out, system_state_t *machine,
+                           cfg_block_t *block);
+static void generate_dispatch(FILE *out, cfg_t *cfg);
+static void generate_instruction(FILE *out, instruction_t *instruction,
+                                 uint32_t address);
+static void generate_dpi(FILE *out, instruction_t *instruction,
+                         uint32_t address, char *indent);
+static void generate_mul(FILE *out, instruction_t *instruction,
+                         uint32_t address, char *indent);
+static void generate_sdt(FILE *out, instruction_t *instruction,
+                         uint32_t address, char *indent);
+static void generate_shift(FILE *out, instruction_t *instruction,
+                           uint32_t address, bool carry, char *indent);
+static char *load_function(transfer_t transfer);
+static char *store_function(transfer_t transfer);
+static char *condition_expression(condition_t cond);
+static char *read_register(int reg, uint32_t address);
+
+/**
+ * @brief Writes a translated program as C.
+ *
+ * @param out The file to write to.
+ * @param machine The system state holding the program.
+ * @param cfg The control-flow graph of the program.
+ * @param source The name of the object code file, for the header comment.
+ */
+void generate_program(FILE *out, system_state_t *machine, cfg_t *cfg,
+                      char *source) {
+  fprintf(out, "/**\n"
+               " * @file\n"
+               " * @brief %s, translated to C by arm2c.\n"
+               " */\n\n"
+               "#include \"arm2c_utils/runtime.h\"\n\n", source);
+
+  generate_image(out, machine);
+  generate_code_ranges(out, cfg);
+
+  for (size_t i = 0; i < cfg->num_blocks; i++) {
+    fprintf(out, "static uint32_t block_%08x(system_state_t *machine);\n",
+            cfg->blocks[i].start);
+  }
+  fprintf(out, "\n");
+  generate_dispatch(out, cfg);
+  for (size_t i = 0; i < cfg->num_blocks; i++) {
+    generate_block(out, machine, &cfg->blocks[i]);
+  }
+}
+
+/**
+ * @brief Writes the program as a byte array, without trailing zeros.
+ *
+ * @param out The file to write to.
+ * @param machine The system state holding the program.
+ */
+static void generate_image(FILE *out, system_state_t *machine) {
+  size_t size = NUM_ADDRESSES;
+  while (size > 1 && !get_byte(machine, size - 1)) {
+    size--;
+  }
+
+  fprintf(out, "const byte_t arm2c_image[] = {");
+  for (size_t i = 0; i < size; i++) {
+    fprintf(out, "%s0x%02x,", i % BYTES_PER_LINE ? " " : "\n  ",
+            get_byte(machine, i));
+  }
+  fprintf(out, "\n};\nconst size_t arm2c_image_size = sizeof(arm2c_image);\n\n");
+}
+
+/**
+ * @brief Writes the ranges of translated instructions.
+ *
+ * @param out The file to write to.
+ * @param cfg The control-flow graph of the program.
+ */
+static void generate_code_ranges(FILE *out, cfg_t *cfg) {
+  fprintf(out, "const code_range_t arm2c_code[] = {\n");
+  for (size_t i = 0; i < cfg->num_blocks; i++) {
+    cfg_block_t *block = &cfg->blocks[i];
+    fprintf(out, "  {0x%08x, 0x%08x},\n", block->start, block->next_address);
+  }
+  fprintf(out, "};\nconst size_t arm2c_code_size = %lu;\n\n",
+          (unsigned long) cfg->num_blocks);
+}
+
+/**
+ * @brief Writes run_translated, which runs blocks until the pipeline is
+ * needed.
+ *
+ * @param out The file to write to.
+ * @param cfg The control-flow graph of the program.
+ */
+static void generate_dispatch(FILE *out, cfg_t *cfg) {
+  fprintf(out, "bool run_translated(system_state_t *machine, "
+               "uint32_t address) {\n"
+               "  bool running = false;\n\n"
+               "  while (true) {\n"
+               "    switch (address) {\n");
+  for (size_t i = 0; i < cfg->num_blocks; i++) {
+    fprintf(out, "      case 0x%08xu:\n"
+                 "        address = block_%08x(machine);\n"
+                 "        break;\n",
+            cfg->blocks[i].start, cfg->blocks[i].start);
+  }
+  fprintf(out, "      case LEAVE_TRANSLATED:\n"
+               "        return true;\n"
+               "      default:\n"
+               "        if (running) {\n"
+               "          leave_translated(machine, address);\n"
+               "        }\n"
+               "        return running;\n"
+               "    }\n"
+               "    running = true;\n"
+               "  }\n"
+               "}\n");
+}
+
+/**
+ * @brief Writes the function for a basic block.
+ *
+ * @param out The file to write to.
+ * @param machine The system state holding the program.
+ * @param block The basic block.
+ */
+static void generate_block(FILE *out, system_state_t *machine,
+                           cfg_block_t *block) {
+  fprintf(out, "\nstatic uint32_t block_%08x(system_state_t *machine) {\n"
+               "  word_t *r = machine->registers;\n\n"
+               "  (void) r;\n", block->start);
+
+  for (uint32_t address = block->start; address < block->next_address;
+       address += 4) {
+    instruction_t *instruction = &predecode(machine, address)->instruction;
+    fprintf(out, "  // 0x%08x: 0x%08x\n", address,
+            get_word(machine, address));
+    if (instruction->type != BRA) {
+      generate_instruction(out, instruction, address);
+      continue;
+    }
+
+    char *indent = "  ";
+    if (instruction->cond != AL) {
+      fprintf(out, "  if (%s) {\n", condition_expression(instruction->cond));
+      indent = "    ";
+    }
+    if (instruction->flag_3) {
+      // Branch with link
+      fprintf(out, "%sr[%d] = 0x%08xu;\n", indent, LR, address + 4);
+    }
+    fprintf(out, "%sreturn 0x%08xu;\n", indent, block->target);
+    if (instruction->cond != AL) {
+      fprintf(out, "  }\n");
+    }
+  }
+
+  if (block->end == PIPELINE_END) {
+    fprintf(out, "  return leave_translated(machine, 0x%08xu);\n",
+            block->next_address);
+  } else if (!(block->end == BRANCH_END
+    && predecode(machine, block->next_address - 4)->instruction.cond == AL)) {
+    fprintf(out, "  return 0x%08xu;\n", block->next_address);
+  }
+  fprintf(out, "}\n");
+}
+
+/**
+ * @brief Writes the C for a data processing, multiply or single data transfer
+ * instruction.
+ *
+ * @param out The file to write to.
+ * @param instruction The decoded instruction.
+ * @param address The address of the instruction.
+ */
+static void generate_instruction(FILE *out, instruction_t *instruction,
+                                 uint32_t address) {
+  char *indent = "  ";
+
+  if (instruction->cond != AL) {
+    fprintf(out, "  if (%s) {\n", condition_expression(instruction->cond));
+    indent = "    ";
+  }
+
+  fprintf(out, "%s{\n", indent);
+  switch (instruction->type) {
+    case DPI:
+      generate_dpi(out, instruction, address, indent);
+      break;
+    case MUL:
+      generate_mul(out, instruction, address, indent);
+      break;
+    case SDT:
+    default:
+      generate_sdt(out, instruction, address, indent);
+      break;
+  }
+  fprintf(out, "%s}\n", indent);
+
+  if (instruction->cond != AL) {
+    fprintf(out, "  }\n");
+  }
+}
+
+/**
+ * @brief Writes the C for a data processing instruction, as execute_dpi.
+ *
+ * @param out The file to write to.
+ * @param instruction The decoded instruction.
+ * @param address The address of the instruction.
+ * @param indent The indent of the enclosing block.
+ */
+static void generate_dpi(FILE *out, instruction_t *instruction,
+                         uint32_t address, char *indent) {
+  opcode_t operation = instruction->operation;
+  bool arithmetic = operation == SUB || operation == RSB || operation == ADD
+                    || operation == CMP;
+  bool shifter_carry = instruction->flag_1 && !arithmetic;
+
+  // Second operand
+  if (instruction->flag_0) {
+    value_carry_t shifter_out = rotate_immediate(instruction->shift_amount,
+                                                 instruction->immediate_value);
+    fprintf(out, "%s  word_t op2 = 0x%08xu;\n", indent, shifter_out.value);
+    if (shifter_carry) {
+      fprintf(out, "%s  bool carry = %s;\n", indent,
+              shifter_out.carry ? "true" : "false");
+    }
+  } else {
+    generate_shift(out, instruction, address, shifter_carry, indent);
+  }
+  if (operation != MOV) {
+    fprintf(out, "%s  word_t op1 = %s;\n", indent,
+            read_register(instruction->rn, address));
+  }
+
+  // Result
+  char *result;
+  switch (operation) {
+    case AND:
+    case TST:
+      result = "op1 & op2";
+      break;
+    case EOR:
+    case TEQ:
+      result = "op1 ^ op2";
+      break;
+    case SUB:
+    case CMP:
+      result = "op1 - op2";
+      break;
+    case RSB:
+      result = "op2 - op1";
+      break;
+    case ADD:
+      result = "op1 + op2";
+      break;
+    case ORR:
+      result = "op1 | op2";
+      break;
+    case MOV:
+    default:
+      result = "op2";
+      break;
+  }
+  fprintf(out, "%s  word_t result = %s;\n", indent, result);
+
+  if (writes_result(operation)) {
+    fprintf(out, "%s  r[%d] = result;\n", indent, instruction->rd);
+  }
+  if (instruction->flag_1 && arithmetic) {
+    fprintf(out, "%s  translated_arithmetic_flags(r, %s, result, %s);\n",
+            indent, operation == RSB ? "op2, op1" : "op1, op2",
+            operation == ADD ? "false" : "true");
+  } else if (instruction->flag_1) {
+    fprintf(out, "%s  translated_flags(r, result, carry);\n", indent);
+  }
+}
+
+/**
+ * @brief Writes the C for a multiply instruction, as execute_mul.
+ *
+ * @param out The file to write to.
+ * @param instruction The decoded instruction.
+ * @param address The address of the instruction.
+ * @param indent The indent of the enclosing block.
+ */
+static void generate_mul(FILE *out, instruction_t *instruction,
+                         uint32_t address, char *indent) {
+  fprintf(out, "%s  word_t result = %s", indent,
+          read_register(instruction->rm, address));
+  fprintf(out, " * %s", read_register(instruction->rs, address));
+  if (instruction->flag_0) {
+    fprintf(out, " + %s", read_register(instruction->rn, address));
+  }
+  fprintf(out, ";\n%s  r[%d] = result;\n", indent, instruction->rd);
+
+  if (instruction->flag_1) {
+    fprintf(out, "%s  translated_flags(r, result, false);\n", indent);
+  }
+}
+
+/**
+ * @brief Writes the C for a single data transfer instruction, as run_transfer.
+ *
+ * A store which writes over translated code hands back to the pipeline.
+ * @param out The file to write to.
+ * @param instruction The decoded instruction.
+ * @param address The address of the instruction.
+ * @param indent The indent of the enclosing block.
+ */
+static void generate_sdt(FILE *out, instruction_t *instruction,
+                         uint32_t address, char *indent) {
+  char sign = instruction->flag_2 ? '+' : '-';
+
+  // Offset
+  if (instruction->flag_0) {
+    generate_shift(out, instruction, address, false, indent);
+  } else {
+    fprintf(out, "%s  word_t op2 = 0x%08xu;\n", indent,
+            instruction->immediate_value);
+  }
+
+  // Pre or post indexing
+  fprintf(out, "%s  uint32_t address = %s", indent,
+          read_register(instruction->rn, address));
+  if (instruction->flag_1) {
+    fprintf(out, " %c op2;\n", sign);
+  } else {
+    fprintf(out, ";\n%s  r[%d] = address %c op2;\n", indent, instruction->rn,
+            sign);
+  }
+
+  if (instruction->flag_3) {
+    fprintf(out, "%s  r[%d] = %s(machine, address);\n", indent,
+            instruction->rd, load_function(instruction->transfer));
+  } else if (!is_cacheable_address(address + 4)) {
+    fprintf(out, "%s  %s(machine, address, %s);\n", indent,
+            store_function(instruction->transfer),
+            read_register(instruction->rd, address));
+  } else {
+    // The next instruction was fetched before this store was executed
+    fprintf(out, "%s  word_t latched = get_word(machine, 0x%08xu);\n",
+            indent, address + 4);
+    fprintf(out, "%s  %s(machine, address, %s);\n", indent,
+            store_function(instruction->transfer),
+            read_register(instruction->rd, address));
+    fprintf(out, "%s  if (machine->code_modified) {\n"
+                 "%s    return_to_pipeline(machine, true, latched, "
+                 "0x%08xu);\n"
+                 "%s    return LEAVE_TRANSLATED;\n"
+                 "%s  }\n", indent, indent, address + 8, indent, indent);
+  }
+}
+
+/**
+ * @brief Returns the C which loads a value of the given size, as a word.
+ *
+ * @param transfer The size of the transfer.
+ * @returns A function, or a cast of one, taking the machine and an address.
+ */
+static char *load_function(transfer_t transfer) {
+  switch (transfer) {
+    case BYTE_TRANSFER:
+      return "get_byte";
+    case HALF_TRANSFER:
+      return "get_halfword";
+    case SIGNED_BYTE_TRANSFER:
+      return "(word_t) (int8_t) get_byte";
+    case SIGNED_HALF_TRANSFER:
+      return "(word_t) (int16_t) get_halfword";
+    case WORD_TRANSFER:
+    default:
+      return "get_word";
+  }
+}
+
+/**
+ * @brief Returns the C function which stores a value of the given size.
+ *
+ * @param transfer The size of the transfer.
+ * @returns A function taking the machine, an address and a value.
+ */
+static char *store_function(transfer_t transfer) {
+  switch (transfer) {
+    case BYTE_TRANSFER:
+      return "set_byte";
+    case HALF_TRANSFER:
+      return "set_halfword";
+    case WORD_TRANSFER:
+    default:
+      return "set_word";
+  }
+}
+
+/**
+ * @brief Writes the C for a shifted register operand, as op2 (and carry).
+ *
+ * Constant shifts from 1 to 31 are written inline. Other shifts use the
+ * emulator's shifter, unless only the value of a shift by 0 is needed.
+ * @param out The file to write to.
+ * @param instruction The decoded instruction.
+ * @param address The address of the instruction.
+ * @param carry Whether the carry out of the shifter is needed.
+ * @param indent The indent of the enclosing block.
+ */
+static void generate_shift(FILE *out, instruction_t *instruction,
+                           uint32_t address, bool carry, char *indent) {
+  char value[32];
+  word_t amount = instruction->shift_amount;
+  snprintf(value, sizeof(value), "%s",
+           read_register(instruction->rm, address));
+
+  if (instruction->rs != -1 || (amount == 0 && carry)) {
+    fprintf(out, "%s  bool carry;\n", indent);
+    fprintf(out, "%s  word_t op2 = translated_shift(%d, %s, %s, &carry);\n",
+            indent, instruction->shift_type,
+            instruction->rs != -1 ? read_register(instruction->rs, address)
+                                  : "0",
+            value);
+    return;
+  }
+
+  if (amount == 0) {
+    fprintf(out, "%s  word_t op2 = %s;\n", indent, value);
+    return;
+  }
+
+  switch (instruction->shift_type) {
+    case LSL:
+      fprintf(out, "%s  word_t op2 = %s << %u;\n", indent, value, amount);
+      break;
+    case LSR:
+      fprintf(out, "%s  word_t op2 = %s >> %u;\n", indent, value, amount);
+      break;
+    case ASR:
+      fprintf(out, "%s  word_t op2 = (word_t) ((int32_t) %s >> %u);\n",
+              indent, value, amount);
+      break;
+    case ROR:
+    default:
+      fprintf(out, "%s  word_t op2 = %s >> %u | %s << %u;\n", indent, value,
+              amount, value, WORD_SIZE - amount);
+      break;
+  }
+  if (carry) {
+    // The carry is the last bit shifted out
+    fprintf(out, "%s  bool carry = %s >> %u & 1;\n", indent, value,
+            instruction->shift_type == LSL ? WORD_SIZE - amount : amount - 1);
+  }
+}
+
+/**
+ * @brief Returns a C expression for whether a condition is met, as condition
+ * does.
+ *
+ * The row of CONDITION_TABLE for the condition is packed into a 16 bit mask,
+ * and the bit for the flags nibble is tested.
+ * @param cond The condition.
+ * @returns The expression, which is only valid until the next call.
+ */
+static char *condition_expression(condition_t cond) {
+  static char buffer[48];
+  word_t mask = 0;
+  for (int flags = 0; flags < 16; flags++) {
+    mask |= (word_t) CONDITION_TABLE[cond][flags] << flags;
+  }
+
+  if (cond == AL) {
+    return "true";
+  }
+  snprintf(buffer, sizeof(buffer), "(0x%04xu >> (r[CPSR] >> 28)) & 1", mask);
+  return buffer;
+}
+
+/**
+ * @brief Returns a C expression for reading a register.
+ *
+ * @param reg The register.
+ * @param address The address of the instruction reading the register.
+ * @returns The expression, which is only valid until the next call.
+ */
+static char *read_register(int reg, uint32_t address) {
+  static char buffers[2][16];
+  static int next = 0;
+  char *buffer = buffers[next];
+  next = !next;
+
+  if (reg == PC) {
+    snprintf(buffer, sizeof(buffers[0]), "0x%08xu", address + 8);
+  } else {
+    snprintf(buffer, sizeof(buffers[0]), "r[%d]", reg);
+  }
+  return buffer;
+}
@@ -0,0 +1,13 @@
+/**
+ * @file generate.h
+ * @brief Header file for generate.c.
+ */
+
+#ifndef GENERATE_H
+#define GENERATE_H
+#include "cfg.h"
+
+void generate_program(FILE *out, system_state_t *machine, cfg_t *cfg,
+                      char *source);
+
+#endif
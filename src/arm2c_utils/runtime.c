@@ -0,0 +1,87 @@
+/**
+ * @file runtime.c
+ * @brief The runtime for programs translated to C by arm2c.
+ *
+ * The translated blocks take over from the pipeline whenever it is empty, in
+ * the same way as the emulator's other engines. Anything the translator left
+ * out (stop instructions, writes to PC, or code that has been overwritten) is
+ * run by the pipeline, so the final state is exactly the emulator's.
+ */
+
+#include "runtime.h"
+
+/**
+ * @brief Runs the translated program, and prints its final state as the
+ * emulator does for --output=compliant.
+ */
+int main(void) {
+  start_writer();
+  system_state_t *machine = create_system_state();
+  machine->decode_cache = calloc(NUM_WORDS, sizeof(predecoded_t));
+  if (!machine->decode_cache) {
+    perror("Cannot allocate memory to store decode cache.\n");
+    return EXIT_FAILURE;
+  }
+  write_bytes(machine, 0, arm2c_image, arm2c_image_size);
+
+  // Predecode the translated instructions, so that a store to one is seen
+  for (size_t i = 0; i < arm2c_code_size; i++) {
+    for (uint32_t address = arm2c_code[i].start; address < arm2c_code[i].end;
+         address += 4) {
+      predecode(machine, address);
+    }
+  }
+  machine->registers[PC] = 0;
+  machine->fetched_instruction = 0;
+  machine->has_fetched_instruction = false;
+  machine->decoded_instruction.type = NUL;
+
+  while (machine->decoded_instruction.type != ZER) {
+    uint32_t address;
+    // Translated code reads and writes the flags in CPSR directly
+    update_flags(machine);
+    if (machine->code_modified || !can_leave_pipeline(machine, &address)
+      || !run_translated(machine, address)) {
+      cycle(machine);
+    }
+  }
+
+  print_system_state_compliant(machine);
+
+  free(machine->decode_cache);
+  free_system_state(machine);
+  return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Hands back to the pipeline at an address which was not translated.
+ *
+ * @param machine The current system state.
+ * @param address The address of the next instruction.
+ * @returns LEAVE_TRANSLATED.
+ */
+uint32_t leave_translated(system_state_t *machine, uint32_t address) {
+  if (is_cacheable_address(address)) {
+    return_to_pipeline(machine, true, get_word(machine, address), address + 4);
+  } else {
+    return_to_pipeline(machine, false, 0, address);
+  }
+  return LEAVE_TRANSLATED;
+}
+
+/**
+ * @brief Shifts a value with the emulator's shifter.
+ *
+ * Used for shifts by a register, and for shifts by 0 whose carry is used.
+ * @param type The type of shift to use.
+ * @param amount The amount to shift by.
+ * @param value The value to shift.
+ * @param carry Set to the carry out of the shifter.
+ * @returns The shifted value.
+ */
+word_t translated_shift(shift_t type, word_t amount, word_t value,
+                        bool *carry) {
+  value_carry_t shifter_out = shifter(type, amount, value);
+  *carry = shifter_out.carry;
+  return shifter_out.value;
+}
@@ -0,0 +1,77 @@
+/**
+ * @file runtime.h
+ * @brief A header to define the code_range_t type, and header file for
+ * runtime.c and for C files generated by arm2c.
+ */
+
+#ifndef RUNTIME_H
+#define RUNTIME_H
+#include <string.h>
+#include "../emulate_utils/pipeline.h"
+#include "../emulate_utils/print_compliant.h"
+
+/** Returned by a translated block which has handed back to the pipeline. */
+#define LEAVE_TRANSLATED 0xFFFFFFFF
+
+/**
+ * @brief A struct that holds a range of translated instructions.
+ */
+typedef struct {
+  /** The address of the first instruction. */
+  uint32_t start;
+  /** The address after the last instruction. */
+  uint32_t end;
+} code_range_t;
+
+/** The program, as loaded by load_file (generated). */
+extern const byte_t arm2c_image[];
+/** The number of bytes in the program (generated). */
+extern const size_t arm2c_image_size;
+/** The ranges of translated instructions (generated). */
+extern const code_range_t arm2c_code[];
+/** The number of ranges of translated instructions (generated). */
+extern const size_t arm2c_code_size;
+
+bool run_translated(system_state_t *machine, uint32_t address);
+uint32_t leave_translated(system_state_t *machine, uint32_t address);
+word_t translated_shift(shift_t type, word_t amount, word_t value,
+                        bool *carry);
+
+/**
+ * @brief Sets the CPSR flags for a result, as set_flags does. The overflow
+ * flag is left as it is.
+ *
+ * @param registers The registers.
+ * @param result The result of the instruction.
+ * @param carry Whether the carry flag is set.
+ */
+static inline void translated_flags(word_t *registers, word_t result,
+                                    bool carry) {
+  word_t flags = (result & 0x80000000) | ((word_t) (result == 0) << 30)
+                 | ((word_t) carry << 29);
+  registers[CPSR] = (registers[CPSR] & (MASK_FIRST_4 | 0x10000000)) | flags;
+}
+
+/**
+ * @brief Sets the CPSR flags for an arithmetic operation, as
+ * set_arithmetic_flags does, with the carry and overflow of arithmetic_carry
+ * and arithmetic_overflow.
+ *
+ * @param registers The registers.
+ * @param op1 The first operand.
+ * @param op2 The second operand.
+ * @param result The result of the operation.
+ * @param subtract Whether the result is op1 - op2, rather than op1 + op2.
+ */
+static inline void translated_arithmetic_flags(word_t *registers, word_t op1,
+                                               word_t op2, word_t result,
+                                               bool subtract) {
+  bool carry = subtract ? op1 >= op2 : result < op1;
+  word_t same_sign = subtract ? op1 ^ op2 : ~(op1 ^ op2);
+  word_t flags = (result & 0x80000000) | ((word_t) (result == 0) << 30)
+                 | ((word_t) carry << 29)
+                 | ((same_sign & (op1 ^ result)) >> 31 << 28);
+  registers[CPSR] = (registers[CPSR] & MASK_FIRST_4) | flags;
+}
+
+#endif
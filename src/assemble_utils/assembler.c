@@ -10,6 +10,7 @@ static word_t assemble_spl(string_array_t *tokens);
 static word_t assemble_mul(string_array_t *tokens);
 static word_t assemble_sdt(string_array_t *tokens, word_array_t *extra_words,
                     int current_line, int max_lines);
+static word_t assemble_bdt(string_array_t *tokens);
 static word_t assemble_bra(string_array_t *tokens, symbol_table_t *symbol_table,
                     address_t current_line);
 
@@ -160,6 +161,9 @@ static word_t assemble_mul(string_array_t *tokens) {
 /**
  * @brief Assembles a single data transfer instruction.
  *
+ * Words, bytes (ldrb and strb) and halfwords (ldrh, strh, ldrsb and ldrsh)
+ * are transferred. Halfword and signed transfers take an immediate offset of
+ * up to 0xFF, or an unshifted register offset.
  * @param tokens The string to parse.
  * @param extra_words An array to hold additional words required by ldr.
  * @param current_line The line number of this instruction.
@@ -178,8 +182,12 @@ static word_t assemble_sdt(string_array_t *tokens, word_array_t *extra_words,
   if (string_to_mnemonic(sections[0]) == LDR_M) {
     instruction.flag_3 = 1;
   }
+  instruction.transfer = string_to_transfer(&sections[0][3]);
 
-  if ('=' == sections[2][0]) {
+  if ('=' == sections[2][0] && instruction.transfer != WORD_TRANSFER) {
+    fprintf(stderr, "Only ldr can load an <=expression>.\n");
+    exit(EXIT_FAILURE);
+  } else if ('=' == sections[2][0]) {
     // In form <=expression>
 
     // Get the value of the expression
@@ -305,23 +313,77 @@ static word_t assemble_sdt(string_array_t *tokens, word_array_t *extra_words,
 }
 
 /**
- * @brief Assembles a branch instruction.
+ * @brief Assembles a block data transfer instruction.
+ *
+ * Accepts ldm and stm with an addressing mode (see parse_bdt_mode), a base
+ * register which is written back if followed by '!', and a register list. As
+ * aliases, push {list} is stmdb sp!, {list} and pop {list} is ldmia sp!, {list}.
+ * @param tokens The string to parse.
+ * @returns A machine code instruction.
+ */
+static word_t assemble_bdt(string_array_t *tokens) {
+  instruction_t instruction = NULL_INSTRUCTION;
+  char **sections = tokens->array;
+  int list_start = 2;
+
+  instruction.type = BDT;
+  instruction.cond = AL;
+  if (string_to_mnemonic(sections[0]) == LDM_M) {
+    instruction.flag_3 = 1;
+  }
+
+  if (!strcmp(sections[0], "push") || !strcmp(sections[0], "pop")) {
+    // Full descending stack, with sp written back
+    instruction.rn = SP;
+    instruction.flag_0 = 1;
+    parse_bdt_mode("fd", &instruction);
+    list_start = 1;
+  } else {
+    parse_bdt_mode(&sections[0][3], &instruction);
+
+    // In the form Rn{!}
+    char *base = sections[1];
+    size_t length = strlen(base);
+    if (length && '!' == base[length - 1]) {
+      instruction.flag_0 = 1;
+      base[length - 1] = '\0';
+    }
+    instruction.rn = string_to_reg_address(base);
+  }
+
+  string_array_t list_tokens = {
+    .array = &sections[list_start],
+    .size = tokens->size - list_start,
+  };
+  instruction.immediate_value = parse_register_list(&list_tokens);
+  return encode(&instruction);
+}
+
+/**
+ * @brief Assembles a branch instruction, with or without link.
  *
  * @param tokens The string to parse.
  * @param symbol_table The table of labels and addresses.
  * @param instruction_no The line number of this instruction.
  * @returns A machine code instruction.
  */
+static word_t assemble_bdt(string_array_t *tokens);
 static word_t assemble_bra(string_array_t *tokens, symbol_table_t *symbol_table,
                     address_t instruction_no) {
   instruction_t instruction = NULL_INSTRUCTION;
+  // The condition follows b, or bl
+  int cond_start = 1;
 
   instruction.type = BRA;
+  if (string_to_mnemonic(tokens->array[0]) == BL_M) {
+    instruction.flag_3 = 1;
+    cond_start = 2;
+  }
 
-  if (!tokens->array[0][1]) {
+  if (!tokens->array[0][cond_start]) {
     instruction.cond = AL;
   } else {
-    instruction.cond = string_to_condition(&(tokens->array[0][1]));
+    instruction.cond = string_to_condition(&(tokens->array[0][cond_start]));
   }
 
   address_t label_address = get_address(symbol_table, tokens->array[1]);
@@ -372,13 +434,27 @@ void assemble_all_instructions(string_arrays_t *instructions,
                                              extra_words,
                                              words->size, max_lines);
           break;
+        case LDM_M:
+        case STM_M:
+          machine_instruction = assemble_bdt(instructions->arrays[i]);
+          break;
         case BEQ_M:
         case BNE_M:
         case BGE_M:
         case BLT_M:
         case BGT_M:
         case BLE_M:
+        case BCS_M:
+        case BCC_M:
+        case BMI_M:
+        case BPL_M:
+        case BVS_M:
+        case BVC_M:
+        case BHI_M:
+        case BLS_M:
+        case BNV_M:
         case B_M:
+        case BL_M:
           machine_instruction = assemble_bra(instructions->arrays[i],
                                              symbol_table, words->size);
           break;
@@ -8,6 +8,8 @@
 static word_t encode_dpi(instruction_t *instruction);
 static word_t encode_mul(instruction_t *instruction);
 static word_t encode_sdt(instruction_t *instruction);
+static word_t encode_halfword_sdt(instruction_t *instruction);
+static word_t encode_bdt(instruction_t *instruction);
 static word_t encode_branch(instruction_t *instruction);
 
 word_t encode(instruction_t *instruction) {
@@ -24,6 +26,9 @@ word_t encode(instruction_t *instruction) {
     case BRA:
       return encode_branch(instruction);
       break;
+    case BDT:
+      return encode_bdt(instruction);
+      break;
     case ZER:
       return 0;
       break;
@@ -116,7 +121,13 @@ static word_t encode_mul(instruction_t *instruction) {
  * @returns 32 bit instruction.
  */
 static word_t encode_sdt(instruction_t *instruction) {
+  if (instruction->transfer != WORD_TRANSFER
+    && instruction->transfer != BYTE_TRANSFER) {
+    return encode_halfword_sdt(instruction);
+  }
+
   word_t binary = 0x04000000;
+  binary |= ((word_t) (instruction->transfer == BYTE_TRANSFER)) << 22;
   binary |= ((word_t) instruction->flag_0) << 25;
   binary |= ((word_t) instruction->flag_1) << 24;
   binary |= ((word_t) instruction->flag_2) << 23;
@@ -145,6 +156,76 @@ static word_t encode_sdt(instruction_t *instruction) {
   return binary | add_cond(instruction);
 }
 
+/**
+ * @brief Encodes halfword and signed byte data transfer instructions.
+ *
+ * Given a single data transfer instruction of a halfword or signed byte this
+ * will return the 32 bit instruction corresponding with given instruction_t.
+ * The offset must be an unshifted register, or an immediate up to 0xFF.
+ *
+ * @param instruction Given instruction.
+ * @returns 32 bit instruction.
+ */
+static word_t encode_halfword_sdt(instruction_t *instruction) {
+  word_t binary = 0x00000090;
+  switch (instruction->transfer) {
+    case HALF_TRANSFER:
+      binary |= 0x1 << 5;
+      break;
+    case SIGNED_BYTE_TRANSFER:
+      binary |= 0x2 << 5;
+      break;
+    default:
+      binary |= 0x3 << 5;
+      break;
+  }
+  binary |= ((word_t) instruction->flag_1) << 24;
+  binary |= ((word_t) instruction->flag_2) << 23;
+  binary |= ((word_t) instruction->flag_3) << 20;
+  if (-1 != instruction->rn) {
+    binary |= ((word_t) instruction->rn) << 16;
+  }
+  binary |= ((word_t) instruction->rd) << 12;
+
+  if (instruction->flag_0) {
+    if (instruction->rs != -1 || instruction->shift_amount) {
+      fprintf(stderr, "Halfword transfers cannot shift their offset.\n");
+      exit(EXIT_FAILURE);
+    }
+    binary |= instruction->rm;
+  } else {
+    if (instruction->immediate_value > 0xFF) {
+      fprintf(stderr, "Halfword transfer offset out of range.\n");
+      exit(EXIT_FAILURE);
+    }
+    // Immediate offset, split between bits 8 to 11 and 0 to 3
+    binary |= 1L << 22;
+    binary |= (instruction->immediate_value & 0xF0) << 4;
+    binary |= instruction->immediate_value & 0xF;
+  }
+  return binary | add_cond(instruction);
+}
+
+/**
+ * @brief Encodes block data transfer instructions.
+ *
+ * Given a block data transfer instruction this will return the 32 bit
+ * instruction corresponding with given instruction_t.
+ *
+ * @param instruction Given instruction.
+ * @returns 32 bit instruction.
+ */
+static word_t encode_bdt(instruction_t *instruction) {
+  word_t binary = 0x08000000;
+  binary |= ((word_t) instruction->flag_1) << 24;
+  binary |= ((word_t) instruction->flag_2) << 23;
+  binary |= ((word_t) instruction->flag_0) << 21;
+  binary |= ((word_t) instruction->flag_3) << 20;
+  binary |= ((word_t) instruction->rn) << 16;
+  binary |= instruction->immediate_value & 0xFFFF;
+  return binary | add_cond(instruction);
+}
+
 /**
  * @brief Encodes branch instructions.
  *
@@ -156,6 +237,7 @@ static word_t encode_sdt(instruction_t *instruction) {
  */
 static word_t encode_branch(instruction_t *instruction) {
   word_t binary = 0x0A000000;
+  binary |= ((word_t) instruction->flag_3) << 24;
   binary |= MASK_FIRST_8 & instruction->immediate_value;
   return binary | add_cond(instruction);
 }
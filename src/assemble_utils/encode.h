@@ -6,6 +6,7 @@
 #ifndef ENCODE_H
 #define ENCODE_H
 #include <stdio.h>
+#include <stdlib.h>
 #include "../instruction.h"
 
 word_t encode(instruction_t *instruction);
@@ -48,12 +48,21 @@ mnemonic_t string_to_mnemonic(char *str) {
   if (!strcmp(str, "mla")) {
     return MLA_M;
   }
-  if (!strcmp(str, "ldr")) {
+  if (!strcmp(str, "ldr") || !strcmp(str, "ldrb") || !strcmp(str, "ldrh")
+    || !strcmp(str, "ldrsb") || !strcmp(str, "ldrsh")) {
+    // The size of the transfer is parsed by string_to_transfer
     return LDR_M;
   }
-  if (!strcmp(str, "str")) {
+  if (!strcmp(str, "str") || !strcmp(str, "strb") || !strcmp(str, "strh")) {
     return STR_M;
   }
+  if (!strncmp(str, "ldm", 3) || !strcmp(str, "pop")) {
+    // The addressing mode is parsed by parse_bdt_mode
+    return LDM_M;
+  }
+  if (!strncmp(str, "stm", 3) || !strcmp(str, "push")) {
+    return STM_M;
+  }
   if (!strcmp(str, "beq")) {
     return BEQ_M;
   }
@@ -72,9 +81,41 @@ mnemonic_t string_to_mnemonic(char *str) {
   if (!strcmp(str, "ble")) {
     return BLE_M;
   }
-  if (!strcmp(str, "b")) {
+  if (!strcmp(str, "bcs") || !strcmp(str, "bhs")) {
+    return BCS_M;
+  }
+  if (!strcmp(str, "bcc") || !strcmp(str, "blo")) {
+    return BCC_M;
+  }
+  if (!strcmp(str, "bmi")) {
+    return BMI_M;
+  }
+  if (!strcmp(str, "bpl")) {
+    return BPL_M;
+  }
+  if (!strcmp(str, "bvs")) {
+    return BVS_M;
+  }
+  if (!strcmp(str, "bvc")) {
+    return BVC_M;
+  }
+  if (!strcmp(str, "bhi")) {
+    return BHI_M;
+  }
+  if (!strcmp(str, "bls")) {
+    return BLS_M;
+  }
+  if (!strcmp(str, "bnv")) {
+    return BNV_M;
+  }
+  if (!strcmp(str, "b") || !strcmp(str, "bal")) {
     return B_M;
   }
+  if (!strcmp(str, "bl")
+    || (!strncmp(str, "bl", 2) && strlen(str) == 4)) {
+    // bl followed by a condition (blt, ble and bls are matched above)
+    return BL_M;
+  }
   if (!strcmp(str, "lsl")) {
     return SHIFT_M;
   }
@@ -108,6 +149,30 @@ condition_t string_to_condition(char *str) {
   if (!strcmp(str, "ne")) {
     return NE;
   }
+  if (!strcmp(str, "cs") || !strcmp(str, "hs")) {
+    return CS;
+  }
+  if (!strcmp(str, "cc") || !strcmp(str, "lo")) {
+    return CC;
+  }
+  if (!strcmp(str, "mi")) {
+    return MI;
+  }
+  if (!strcmp(str, "pl")) {
+    return PL;
+  }
+  if (!strcmp(str, "vs")) {
+    return VS;
+  }
+  if (!strcmp(str, "vc")) {
+    return VC;
+  }
+  if (!strcmp(str, "hi")) {
+    return HI;
+  }
+  if (!strcmp(str, "ls")) {
+    return LS;
+  }
   if (!strcmp(str, "ge")) {
     return GE;
   }
@@ -123,10 +188,39 @@ condition_t string_to_condition(char *str) {
   if (!strcmp(str, "al") || 0 == strlen(str)) {
     return AL;
   }
+  if (!strcmp(str, "nv")) {
+    return NV;
+  }
   fprintf(stderr, "No such condition found.\n");
   exit(EXIT_FAILURE);
 }
 
+/**
+ * @brief Returns the size of a single data transfer for a given size string.
+ *
+ * @param str The size string, which follows ldr or str in the mnemonic.
+ * @returns A transfer_t representing the given string.
+ */
+transfer_t string_to_transfer(char *str) {
+  if (!strcmp(str, "")) {
+    return WORD_TRANSFER;
+  }
+  if (!strcmp(str, "b")) {
+    return BYTE_TRANSFER;
+  }
+  if (!strcmp(str, "h")) {
+    return HALF_TRANSFER;
+  }
+  if (!strcmp(str, "sb")) {
+    return SIGNED_BYTE_TRANSFER;
+  }
+  if (!strcmp(str, "sh")) {
+    return SIGNED_HALF_TRANSFER;
+  }
+  fprintf(stderr, "No such transfer size found.\n");
+  exit(EXIT_FAILURE);
+}
+
 /**
  * @brief Returns the opcode for a given mnemonic.
  *
@@ -179,9 +273,30 @@ opcode_t mnemonic_to_opcode(mnemonic_t mnemonic) {
  * @returns The register number given by the string.
  */
 reg_address_t string_to_reg_address(char *str) {
+  if (!strcmp(str, "sp")) {
+    return SP;
+  }
+  if (!strcmp(str, "lr")) {
+    return LR;
+  }
+  if (!strcmp(str, "pc")) {
+    return PC;
+  }
   return strtol(&str[1], (char **) NULL, 10);
 }
 
+/**
+ * @brief Returns whether a string names a register.
+ *
+ * @param str The string.
+ * @returns Whether the string is a numbered register (r0 to r15) or one of the
+ * names sp, lr and pc.
+ */
+bool is_register(char *str) {
+  return str[0] == 'r' || !strcmp(str, "sp") || !strcmp(str, "lr")
+         || !strcmp(str, "pc");
+}
+
 /**
  * @brief Returns the shift for a given shift string.
  *
@@ -218,7 +333,7 @@ void parse_shift(string_array_t *tokens, instruction_t *instruction) {
     // In the form <#expression>
     char *number = &tokens->array[1][1];
     instruction->shift_amount = parse_immediate_value(number);
-  } else if ('r' == tokens->array[1][0]) {
+  } else if (is_register(tokens->array[1])) {
     // Is a register
     instruction->rs = string_to_reg_address(tokens->array[1]);
   } else {
@@ -253,7 +368,7 @@ void parse_operand(string_array_t *tokens, instruction_t *instruction) {
 
     instruction->shift_amount = shift;
 
-  } else if ('r' == sections[0][0]) {
+  } else if (is_register(sections[0])) {
     // In the form Rm{,<shift>}
     instruction->rm = string_to_reg_address(sections[0]);
 
@@ -278,6 +393,85 @@ void parse_operand(string_array_t *tokens, instruction_t *instruction) {
   }
 }
 
+/**
+ * @brief Parses the addressing mode of a block data transfer.
+ *
+ * The mode is one of ia (the default), ib, da or db, or a stack alias (fd, ed,
+ * fa or ea), whose meaning depends on whether the instruction loads or stores.
+ * The P and U bits of the instruction are set for the mode.
+ * @param str The mode, which follows ldm or stm in the mnemonic.
+ * @param instruction The instruction, whose L bit is set.
+ */
+void parse_bdt_mode(char *str, instruction_t *instruction) {
+  bool load = instruction->flag_3;
+
+  if (!strcmp(str, "") || !strcmp(str, "ia")
+    || !strcmp(str, load ? "fd" : "ea")) {
+    instruction->flag_1 = 0;
+    instruction->flag_2 = 1;
+  } else if (!strcmp(str, "ib") || !strcmp(str, load ? "ed" : "fa")) {
+    instruction->flag_1 = 1;
+    instruction->flag_2 = 1;
+  } else if (!strcmp(str, "da") || !strcmp(str, load ? "fa" : "ed")) {
+    instruction->flag_1 = 0;
+    instruction->flag_2 = 0;
+  } else if (!strcmp(str, "db") || !strcmp(str, load ? "ea" : "fd")) {
+    instruction->flag_1 = 1;
+    instruction->flag_2 = 0;
+  } else {
+    fprintf(stderr, "No such addressing mode found.\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/**
+ * @brief Parses a register list, such as {r0-r3, lr}.
+ *
+ * @param tokens The tokens of the list, from the one starting with '{' to the
+ * one ending with '}'.
+ * @returns The list, with bit n set if register n is in the list.
+ */
+word_t parse_register_list(string_array_t *tokens) {
+  word_t list = 0;
+
+  for (int i = 0; i < tokens->size; i++) {
+    char *name = tokens->array[i];
+    // Remove the braces around the list
+    if ('{' == name[0]) {
+      name++;
+    }
+    char *end = strchr(name, '}');
+    if (end) {
+      *end = '\0';
+    }
+    if (!name[0]) {
+      continue;
+    }
+
+    reg_address_t first;
+    reg_address_t last;
+    char *range = strchr(name, '-');
+    if (range) {
+      // In the form Rm-Rn
+      *range = '\0';
+      first = string_to_reg_address(name);
+      last = string_to_reg_address(range + 1);
+    } else {
+      first = string_to_reg_address(name);
+      last = first;
+    }
+
+    if (first < 0 || first > last || last > PC) {
+      fprintf(stderr, "Invalid register list.\n");
+      exit(EXIT_FAILURE);
+    }
+    for (reg_address_t reg = first; reg <= last; reg++) {
+      list |= 1 << reg;
+    }
+  }
+  return list;
+}
+
 /**
  * @brief Parses an immediate value.
  *
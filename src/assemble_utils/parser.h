@@ -12,12 +12,16 @@
 
 mnemonic_t string_to_mnemonic(char *str);
 condition_t string_to_condition(char *str);
+transfer_t string_to_transfer(char *str);
 opcode_t mnemonic_to_opcode(mnemonic_t mnemonic);
 reg_address_t string_to_reg_address(char *str);
+bool is_register(char *str);
 shift_t string_to_shift(char *str);
 
 void parse_shift(string_array_t *tokens, instruction_t *instruction);
 void parse_operand(string_array_t *tokens, instruction_t *instruction);
+void parse_bdt_mode(char *str, instruction_t *instruction);
+word_t parse_register_list(string_array_t *tokens);
 
 word_t parse_immediate_value(char *str);
 
@@ -3,32 +3,18 @@
  * @brief The main functionality for the ARM11 emulator.
  */
 
-#include "emulate_utils/decode.h"
-#include "emulate_utils/execute.h"
+#include "emulate_utils/block.h"
+#include "emulate_utils/options.h"
+#include "emulate_utils/pipeline.h"
 #include "emulate_utils/print_compliant.h"
+#include "emulate_utils/threaded.h"
+#include "emulate_utils/trace.h"
+#include "emulate_utils/watchdog.h"
 
-/** A 0-initialised system state. */
-static const system_state_t DEFAULT_SYSTEM_STATE = {
-  .registers = {0},
-  .memory = {0},
-  .fetched_instruction = 0,
-  .has_fetched_instruction = false,
-};
-
-/** A null (non-existant) instruction. */
-static const instruction_t NULL_INSTRUCTION = {
-  .type = NUL,
-  .immediate_value = 0,
-  .rn = -1,
-  .rd = -1,
-  .rs = -1,
-  .rm = -1,
-  .flag_0 = false,
-  .flag_1 = false,
-  .flag_2 = false,
-  .flag_3 = false,
-  .shift_amount = 0,
-};
+static void run_program(system_state_t *machine, engine_t engine);
+static void run_program_traced(system_state_t *machine, engine_t engine,
+                               trace_t *trace);
+static inline void run_cycle(system_state_t *machine, engine_t engine);
 
 /**
  * @brief Emulates an ARM11 machine operating on a given binary file.
@@ -36,70 +22,149 @@ static const instruction_t NULL_INSTRUCTION = {
  * The user must provide a single argument, which is a valid file name for an
  * ARM11 binary object code file. This function emulates the ARM architecture,
  * returning details of the registers and non-zero memory at the end of
- * execution.
+ * execution. The core used to run instructions can be chosen with the
+ * --engine option, and the format of output with --output (see
+ * parse_options). If the watchdog stops the program, the state is still
+ * printed, and the exit status is EXIT_WATCHDOG.
  */
 int main(int argc, char **argv) {
   // Check for correct program arguments
-  if (argc != 2) {
-    fprintf(stderr, "Incorrect number of arguments provided.\n");
+  options_t options;
+  if (!parse_options(argc, argv, &options)) {
     return EXIT_FAILURE;
   }
+  if (!options.sync_output) {
+    start_writer();
+  }
 
-  char *filename = argv[1];
-  system_state_t *machine = malloc(sizeof(system_state_t));
-
-  // Check if we cannot allocate memory
-  if (!machine) {
-    perror("Cannot allocate memory to store system_state.\n");
+  // Set up a 0-initialised system state and load the program
+  system_state_t *machine = create_system_state();
+  set_memory_size(machine, options.mem_size);
+  machine->output = options.output;
+  machine->quiet = options.output == SILENT_OUTPUT
+                   || options.output == BINARY_OUTPUT;
+  machine->decode_cache = calloc(NUM_WORDS, sizeof(predecoded_t));
+  if (!machine->decode_cache) {
+    perror("Cannot allocate memory to store decode cache.\n");
     return EXIT_FAILURE;
   }
+  if (options.engine == BLOCK_ENGINE || options.engine == JIT_ENGINE) {
+    machine->block_cache = create_block_cache(options.engine == JIT_ENGINE,
+                                              options.verify_jit);
+    if (!machine->block_cache) {
+      perror("Cannot allocate memory to store block cache.\n");
+      return EXIT_FAILURE;
+    }
+    machine->free_block_cache = free_block_cache;
+    machine->block_cache->fast_forward = options.fast_forward;
+    machine->block_cache->fuse = options.fuse;
+  }
+  load_file(options.filename, machine);
+  trace_t *trace = options.trace ? create_trace(machine, options.snapshot_every)
+                                 : NULL;
+  watchdog_t watchdog;
+  if (options.max_instructions || options.timeout_ms) {
+    start_watchdog(machine, &watchdog,
+                   options.max_instructions ? options.max_instructions
+                                            : NO_INSTRUCTION_LIMIT,
+                   options.timeout_ms);
+  }
 
-  // Set up a 0-initialised system state and load the program
-  *machine = DEFAULT_SYSTEM_STATE;
-  machine->decoded_instruction = malloc(sizeof(instruction_t));
-  *(machine->decoded_instruction) = NULL_INSTRUCTION;
-  load_file(filename, machine->memory);
+  // The main execution loop of the emulator, only checking for a trace once
+  if (trace) {
+    run_program_traced(machine, options.engine, trace);
+  } else {
+    run_program(machine, options.engine);
+  }
 
-  // The main execution loop of the emulator
-  while (machine->decoded_instruction->type != ZER) {
-    // Print details for current cycle if not in COMPLIANT_MODE
-    if (!COMPLIANT_MODE) {
+  // Print out final details, writing any output before reporting to stderr
+  flush_writer();
+  bool stopped = machine->watchdog && machine->watchdog->reached != NO_LIMIT;
+  if (stopped) {
+    fprintf(stderr, "Stopped by the watchdog (%s) after %llu instructions\n",
+            limit_name(machine->watchdog->reached),
+            (unsigned long long) machine->instructions);
+  }
+  switch (options.output) {
+    case COMPLIANT_OUTPUT:
+      print_system_state_compliant(machine);
+      break;
+    case VERBOSE_OUTPUT:
+      writer_printf(stopped ? "\nProgram stopped\n"
+                            : "\nProgram executed successfully\n");
       print_system_state(machine);
-    }
+      break;
+    case BINARY_OUTPUT:
+      print_system_state_binary(machine);
+      break;
+    case SILENT_OUTPUT:
+      break;
+  }
+  flush_writer();
+  if (options.report_skipped) {
+    fprintf(stderr, "Skipped %llu instructions in countdown loops\n",
+            (unsigned long long) machine->skipped_instructions);
+  }
+  if (options.stats) {
+    print_block_stats(machine);
+  }
 
-    // Execute
-    if (machine->decoded_instruction->type != NUL) {
-      execute(machine);
-    }
+  free_trace(trace);
+  free_block_cache(machine->block_cache);
+  free(machine->decode_cache);
+  free_system_state(machine);
 
-    // Decode
-    *(machine->decoded_instruction) = NULL_INSTRUCTION;
-    if (machine->has_fetched_instruction) {
-      decode_instruction(machine);
-    }
+  return stopped ? EXIT_WATCHDOG : EXIT_SUCCESS;
+}
 
-    // Fetch
-    if (machine->decoded_instruction->type != ZER) {
-      machine->fetched_instruction = get_word(machine, machine->registers[PC]);
-      machine->has_fetched_instruction = true;
-    } else {
-      machine->has_fetched_instruction = false;
-    }
+/**
+ * @brief Runs the program until it stops or the watchdog expires.
+ *
+ * @param machine The current system state, with the program loaded.
+ * @param engine The core used to run instructions.
+ */
+static void run_program(system_state_t *machine, engine_t engine) {
+  while (machine->decoded_instruction.type != ZER
+    && !watchdog_expired(machine)) {
+    run_cycle(machine, engine);
+  }
+}
 
-    // Next instruction
-    machine->registers[PC] += 4;
+/**
+ * @brief Runs the program until it stops or the watchdog expires, printing
+ * the changes made by each cycle.
+ *
+ * @param machine The current system state, with the program loaded.
+ * @param engine The core used to run instructions.
+ * @param trace The trace of the machine.
+ */
+static void run_program_traced(system_state_t *machine, engine_t engine,
+                               trace_t *trace) {
+  while (machine->decoded_instruction.type != ZER
+    && !watchdog_expired(machine)) {
+    trace_cycle(machine, trace);
+    run_cycle(machine, engine);
   }
+}
 
-  // Print out final details
-  if (COMPLIANT_MODE) {
-    print_system_state_compliant(machine);
+/**
+ * @brief Runs one cycle of the main loop.
+ *
+ * Whenever the pipeline can be left, a cycle runs the engine until it next
+ * needs the pipeline. Otherwise it is a single fetch, decode, execute cycle.
+ * @param machine The current system state.
+ * @param engine The core used to run instructions.
+ */
+static inline void run_cycle(system_state_t *machine, engine_t engine) {
+  uint32_t address;
+  if (engine != STEP_ENGINE && can_leave_pipeline(machine, &address)) {
+    if (engine == THREADED_ENGINE) {
+      run_threaded(machine, address);
+    } else {
+      run_blocks(machine, address);
+    }
   } else {
-    printf("\nProgram executed successfully\n");
-    print_system_state(machine);
+    machine->instructions += machine->decoded_instruction.type != NUL;
+    cycle(machine);
   }
-
-  free(machine->decoded_instruction);
-  free(machine);
-
-  return EXIT_SUCCESS;
 }
@@ -0,0 +1,739 @@
+/**
+ * @file block.c
+ * @brief A basic block translator for the execute cycle.
+ *
+ * A block is a run of instructions ending at a branch, or at an instruction
+ * which writes to PC. Each block is translated once into micro-ops, and is
+ * cached by its start address. When a block is left through a branch, the
+ * block it jumps to is linked so that the next run goes straight to it. A
+ * block ending in a write to PC (an indirect branch) remembers its recent
+ * targets and their blocks instead. Calls (branches with link) are pushed
+ * onto a return address stack, which returns follow back to the caller.
+ * Blocks which are run often can be compiled to native code (see jit.c), and
+ * countdown loops are fast-forwarded to their last iteration (see loop.c).
+ * Adjacent micro-ops of hot blocks are fused into superinstructions (see
+ * fusion.c).
+ *
+ * PC is set to the address of each instruction plus 8 before it is run, so
+ * instructions see the same PC as in the fetch, decode, execute loop.
+ */
+
+#include "block.h"
+#include "fusion.h"
+#include "jit.h"
+#include "loop.h"
+#include "watchdog.h"
+
+static block_t *block_at(system_state_t *machine, uint32_t address);
+static block_t *translate_block(system_state_t *machine, uint32_t start);
+static void translate_op(micro_op_t *op, instruction_t *instruction);
+static block_result_t run_block(system_state_t *machine, block_t *block);
+static native_block_t compile_native(block_cache_t *cache, block_t *block);
+static block_result_t interpret_block(system_state_t *machine,
+                                      block_t *block);
+static block_result_t run_checked(system_state_t *machine, block_t *block);
+static block_t *link_block(system_state_t *machine, block_t **link,
+                           uint32_t address);
+static block_t *indirect_block(system_state_t *machine, block_t *block,
+                               uint32_t address);
+static void call_block(system_state_t *machine, block_t *block);
+static block_t *return_block(system_state_t *machine, block_t *block,
+                             uint32_t address);
+static bool is_return(instruction_t *instruction);
+static void leave_blocks(system_state_t *machine, uint32_t address);
+
+/**
+ * @brief Runs instructions through the block translator.
+ *
+ * Runs until the program stops, an instruction is reached that must be run
+ * by the fetch, decode, execute loop, or the watchdog expires. In each case
+ * the pipeline is left exactly as the loop would have left it.
+ * @param machine The current system state.
+ * @param address The address of the next instruction, from can_leave_pipeline.
+ */
+void run_blocks(system_state_t *machine, uint32_t address) {
+  if (machine->code_modified) {
+    // Code was written since the blocks were translated
+    flush_blocks(machine);
+  }
+
+  block_t *block = block_at(machine, address);
+  while (block) {
+    if (watchdog_expired(machine)) {
+      leave_blocks(machine, block->start);
+      return;
+    }
+    machine->instructions += block->instructions;
+    switch (run_block(machine, block)) {
+      case NEXT_BLOCK:
+        block = link_block(machine, &block->next, block->next_address);
+        break;
+      case TAKEN_BLOCK:
+        if (block->exit_instruction.flag_3) {
+          call_block(machine, block);
+        }
+        block = link_block(machine, &block->taken, block->taken_address);
+        break;
+      case INDIRECT_BLOCK:
+        if (block->returns) {
+          block = return_block(machine, block, machine->registers[PC]);
+        } else {
+          block = indirect_block(machine, block, machine->registers[PC]);
+        }
+        break;
+      case LEAVE_BLOCK:
+      default:
+        return;
+    }
+  }
+}
+
+/**
+ * @brief Creates an empty block cache.
+ *
+ * @param jit Whether hot blocks are compiled to native code.
+ * @param verify_jit Whether native code is checked against the interpreter.
+ * @returns The block cache, or NULL if it cannot be allocated.
+ */
+block_cache_t *create_block_cache(bool jit, bool verify_jit) {
+  block_cache_t *cache = calloc(1, sizeof(block_cache_t));
+  if (!cache) {
+    return NULL;
+  }
+
+  cache->fast_forward = true;
+  cache->fuse = true;
+  if (jit) {
+    cache->jit = create_jit_buffer();
+    if (!cache->jit) {
+      fprintf(stderr, "Native code is not supported, using --engine=block\n");
+    }
+  }
+  if (cache->jit && verify_jit) {
+    cache->shadow = create_system_state();
+  }
+  return cache;
+}
+
+/**
+ * @brief Frees a block cache.
+ *
+ * @param cache The block cache, or NULL.
+ */
+void free_block_cache(block_cache_t *cache) {
+  if (cache) {
+    free_jit_buffer(cache->jit);
+    if (cache->shadow) {
+      free_system_state(cache->shadow);
+    }
+    free(cache);
+  }
+}
+
+/**
+ * @brief Removes every translated block.
+ *
+ * @param machine The current system state.
+ */
+void flush_blocks(system_state_t *machine) {
+  block_cache_t *cache = machine->block_cache;
+
+  memset(cache->lookup, 0, sizeof(cache->lookup));
+  cache->num_blocks = 0;
+  cache->num_ops = 0;
+  cache->return_stack.size = 0;
+  cache->flushes++;
+  if (cache->jit) {
+    reset_jit_buffer(cache->jit);
+  }
+  machine->code_modified = false;
+}
+
+/**
+ * @brief Prints statistics on the block translator to stderr.
+ *
+ * Prints the number of blocks translated, indirect branches, returns,
+ * instructions skipped in countdown loops, and for each superinstruction, its
+ * count in the profile, the number of places it was fused and the number of
+ * times it was run.
+ * @param machine The current system state.
+ */
+void print_block_stats(system_state_t *machine) {
+  block_cache_t *cache = machine->block_cache;
+
+  if (!cache) {
+    fprintf(stderr, "No blocks translated (--engine=step or threaded)\n");
+    return;
+  }
+  fprintf(stderr, "Blocks translated: %zu (%zu flushes)\n",
+          cache->translations, cache->flushes);
+  fprintf(stderr, "Indirect branches: %llu to remembered targets, "
+          "%llu looked up\n", (unsigned long long) cache->indirect_hits,
+          (unsigned long long) cache->indirect_misses);
+  fprintf(stderr, "Returns: %llu to the caller on the return stack, "
+          "%llu elsewhere\n", (unsigned long long) cache->return_hits,
+          (unsigned long long) cache->return_misses);
+  fprintf(stderr, "Instructions skipped in countdown loops: %llu\n",
+          (unsigned long long) machine->skipped_instructions);
+  fprintf(stderr, "Superinstructions%s:\n",
+          cache->fuse ? "" : " (off)");
+  fprintf(stderr, "  %-16s %12s %8s %12s\n", "", "profile", "sites", "runs");
+  for (int super = 0; super < NUM_SUPERINSTRUCTIONS; super++) {
+    fprintf(stderr, "  %-16s %12llu %8zu %12llu\n",
+            SUPERINSTRUCTION_NAMES[super],
+            (unsigned long long) cache->profile[super],
+            cache->fused_sites[super],
+            (unsigned long long) cache->fused_runs[super]);
+  }
+}
+
+/**
+ * @brief Returns the block starting at an address, translating it if needed.
+ *
+ * @param machine The current system state.
+ * @param address The start address.
+ * @returns The block, or NULL if the address is not inside memory.
+ */
+static block_t *block_at(system_state_t *machine, uint32_t address) {
+  if (!is_cacheable_address(address)) {
+    return_to_pipeline(machine, false, 0, address);
+    return NULL;
+  }
+
+  block_t *block = machine->block_cache->lookup[address >> 2];
+  if (!block) {
+    block = translate_block(machine, address);
+  }
+  return block;
+}
+
+/**
+ * @brief Returns the block linked from another block, linking it if needed.
+ *
+ * @param machine The current system state.
+ * @param link The link to follow.
+ * @param address The start address of the linked block.
+ * @returns The block, or NULL if the address is not inside memory.
+ */
+static block_t *link_block(system_state_t *machine, block_t **link,
+                           uint32_t address) {
+  if (*link) {
+    return *link;
+  }
+
+  size_t flushes = machine->block_cache->flushes;
+  block_t *block = block_at(machine, address);
+  if (machine->block_cache->flushes == flushes) {
+    // The block holding the link still exists
+    *link = block;
+  }
+  return block;
+}
+
+/**
+ * @brief Returns the block at the target of an indirect branch.
+ *
+ * The target is first looked for among the recent targets of the block which
+ * ended in the branch. Otherwise it is looked up, and replaces the oldest
+ * recent target.
+ * @param machine The current system state.
+ * @param block The block which ended in the indirect branch.
+ * @param address The target address.
+ * @returns The block, or NULL if the address is not inside memory.
+ */
+static block_t *indirect_block(system_state_t *machine, block_t *block,
+                               uint32_t address) {
+  block_cache_t *cache = machine->block_cache;
+  indirect_cache_t *targets = &block->indirect;
+
+  for (size_t i = 0; i < INDIRECT_WAYS; i++) {
+    if (targets->blocks[i] && targets->addresses[i] == address) {
+      cache->indirect_hits++;
+      return targets->blocks[i];
+    }
+  }
+
+  cache->indirect_misses++;
+  size_t flushes = cache->flushes;
+  block_t *target = block_at(machine, address);
+  if (target && cache->flushes == flushes) {
+    // The block holding the targets still exists
+    targets->addresses[targets->victim] = address;
+    targets->blocks[targets->victim] = target;
+    targets->victim = (targets->victim + 1) % INDIRECT_WAYS;
+  }
+  return target;
+}
+
+/**
+ * @brief Writes the return address of a taken branch with link, and pushes
+ * its block onto the return address stack.
+ *
+ * LR is written here, rather than by each way of running a block.
+ * @param machine The current system state.
+ * @param block The block which ended in the branch with link.
+ */
+static void call_block(system_state_t *machine, block_t *block) {
+  return_stack_t *stack = &machine->block_cache->return_stack;
+
+  machine->registers[LR] = block->next_address;
+  stack->callers[stack->top] = block;
+  stack->top = (stack->top + 1) % RETURN_STACK_DEPTH;
+  if (stack->size < RETURN_STACK_DEPTH) {
+    stack->size++;
+  }
+}
+
+/**
+ * @brief Returns the block at the target of a return.
+ *
+ * The most recent call is popped from the return address stack. If the
+ * return goes back to it, the block after the call is followed through its
+ * link, without a lookup. Otherwise the return is treated as any other
+ * indirect branch.
+ * @param machine The current system state.
+ * @param block The block which ended in the return.
+ * @param address The target address.
+ * @returns The block, or NULL if the address is not inside memory.
+ */
+static block_t *return_block(system_state_t *machine, block_t *block,
+                             uint32_t address) {
+  block_cache_t *cache = machine->block_cache;
+  return_stack_t *stack = &cache->return_stack;
+
+  if (stack->size) {
+    stack->top = (stack->top + RETURN_STACK_DEPTH - 1) % RETURN_STACK_DEPTH;
+    stack->size--;
+    block_t *caller = stack->callers[stack->top];
+    if (caller->next_address == address) {
+      cache->return_hits++;
+      return link_block(machine, &caller->next, address);
+    }
+  }
+
+  cache->return_misses++;
+  return indirect_block(machine, block, address);
+}
+
+/**
+ * @brief Returns whether an instruction which writes to PC is a return.
+ *
+ * Returns are mov r15, r14 and load multiples from the stack which include
+ * PC. This only chooses how the target is predicted, so other returns are
+ * still run correctly.
+ * @param instruction The decoded instruction, which writes to PC.
+ * @returns Whether the instruction is a return.
+ */
+static bool is_return(instruction_t *instruction) {
+  switch (instruction->type) {
+    case DPI:
+      return instruction->operation == MOV && !instruction->flag_0
+             && instruction->rm == LR;
+    case BDT:
+      return instruction->flag_3 && instruction->rn == SP
+             && (instruction->immediate_value >> PC) & 1;
+    default:
+      return false;
+  }
+}
+
+/**
+ * @brief Translates the block starting at an address.
+ *
+ * Instructions are added until a branch, an instruction which writes to PC,
+ * or a word which the pipeline must decode (a stop or unknown instruction) is
+ * reached.
+ * @param machine The current system state.
+ * @param start The start address.
+ * @returns The translated block.
+ */
+static block_t *translate_block(system_state_t *machine, uint32_t start) {
+  block_cache_t *cache = machine->block_cache;
+
+  if (cache->num_blocks == MAX_BLOCKS
+    || cache->num_ops + MAX_BLOCK_LENGTH > MAX_MICRO_OPS) {
+    flush_blocks(machine);
+  }
+
+  block_t *block = &cache->blocks[cache->num_blocks++];
+  block->start = start;
+  block->ops = &cache->ops[cache->num_ops];
+  block->length = 0;
+  block->taken = NULL;
+  block->next = NULL;
+  memset(&block->indirect, 0, sizeof(indirect_cache_t));
+  block->returns = false;
+  block->count = 0;
+  block->native = NULL;
+
+  uint32_t address = start;
+  while (true) {
+    if (!is_cacheable_address(address)) {
+      block->exit = PIPELINE_EXIT;
+      break;
+    }
+    if (block->length == MAX_BLOCK_LENGTH) {
+      block->exit = NEXT_EXIT;
+      break;
+    }
+
+    word_t word = get_word(machine, address);
+    instruction_type_t type = instruction_type(word);
+    if (type == ZER || type == NUL) {
+      block->exit = PIPELINE_EXIT;
+      break;
+    }
+
+    // Code may have been overwritten since it was fetched, but the cache
+    // only holds decodes of the words in memory
+    predecoded_t *entry = predecode(machine, address);
+    assert(entry->word == word);
+    instruction_t *instruction = &entry->instruction;
+    if (type == BRA) {
+      block->exit = BRANCH_EXIT;
+      block->taken_address = address + 8 + instruction->immediate_value;
+    } else if (writes_pc(instruction)) {
+      block->exit = PC_WRITE_EXIT;
+      block->returns = is_return(instruction);
+    } else {
+      translate_op(&block->ops[block->length++], instruction);
+      address += 4;
+      continue;
+    }
+    block->exit_instruction = *instruction;
+    block->exit_address = address;
+    address += 4;
+    break;
+  }
+  block->next_address = address;
+  block->instructions = block->length
+                        + (block->exit == BRANCH_EXIT
+                           || block->exit == PC_WRITE_EXIT);
+
+  cache->num_ops += block->length;
+  cache->lookup[start >> 2] = block;
+  cache->translations++;
+  summarise_loop(block);
+  return block;
+}
+
+/**
+ * @brief Translates one instruction into a micro-op.
+ *
+ * @param op The micro-op to fill in.
+ * @param instruction The decoded instruction.
+ */
+static void translate_op(micro_op_t *op, instruction_t *instruction) {
+  op->instruction = *instruction;
+  op->resolved_operand = false;
+  op->fused = NO_SUPERINSTRUCTION;
+
+  switch (instruction->type) {
+    case DPI:
+      op->type = DPI_OP;
+      op->writes_result = writes_result(instruction->operation);
+      if (instruction->flag_0) {
+        // Immediate operand, so rotate it now
+        value_carry_t shifter_out = rotate_immediate(
+          instruction->shift_amount, instruction->immediate_value);
+        op->resolved_operand = true;
+        op->operand = shifter_out.value;
+        op->carry = shifter_out.carry;
+      }
+      break;
+    case MUL:
+      op->type = MUL_OP;
+      break;
+    case SDT:
+      op->type = SDT_OP;
+      break;
+    case BDT:
+      op->type = BDT_OP;
+      break;
+    default:
+      op->type = GENERIC_OP;
+      break;
+  }
+}
+
+/**
+ * @brief Runs a block, through native code once it is hot.
+ *
+ * @param machine The current system state.
+ * @param block The block to run.
+ * @returns How the block was left.
+ */
+static block_result_t run_block(system_state_t *machine, block_t *block) {
+  block_cache_t *cache = machine->block_cache;
+
+  if (block->loop.valid && cache->fast_forward) {
+    fast_forward_loop(machine, block);
+  }
+
+  if (block->native) {
+    // Native code reads and writes the flags in CPSR directly
+    update_flags(machine);
+    if (cache->shadow) {
+      return run_checked(machine, block);
+    }
+    return block->native(machine);
+  }
+
+  // With checking, compile every block so that all native code is checked
+  block->count++;
+  if (cache->jit && (block->count == JIT_THRESHOLD || cache->shadow)) {
+    block->native = compile_native(cache, block);
+    if (block->native) {
+      return run_block(machine, block);
+    }
+  }
+  if (cache->fuse && block->count == FUSE_THRESHOLD) {
+    fuse_block(cache, block);
+  }
+  return interpret_block(machine, block);
+}
+
+/**
+ * @brief Compiles a block to native code.
+ *
+ * If the buffer of native code is full, the native code of every block is
+ * discarded, and the block is compiled into the empty buffer. The blocks
+ * which had native code are compiled again the next time they are run.
+ * @param cache The block cache, with a buffer of native code.
+ * @param block The block to compile.
+ * @returns The native code, or NULL if the block cannot be compiled.
+ */
+static native_block_t compile_native(block_cache_t *cache, block_t *block) {
+  native_block_t native = compile_block(cache->jit, block);
+  if (native || !cache->jit->full) {
+    return native;
+  }
+
+  reset_jit_buffer(cache->jit);
+  for (size_t i = 0; i < cache->num_blocks; i++) {
+    if (cache->blocks[i].native) {
+      cache->blocks[i].native = NULL;
+      cache->blocks[i].count = JIT_THRESHOLD - 1;
+    }
+  }
+  return compile_block(cache->jit, block);
+}
+
+/**
+ * @brief Runs a block through the interpreter.
+ *
+ * @param machine The current system state.
+ * @param block The block to run.
+ * @returns How the block was left.
+ */
+static block_result_t interpret_block(system_state_t *machine,
+                                      block_t *block) {
+  word_t *registers = machine->registers;
+  uint32_t address = block->start;
+  micro_op_t *end = block->ops + block->length;
+
+  for (micro_op_t *op = block->ops; op < end; op++, address += 4) {
+    instruction_t *instruction = &op->instruction;
+    if (op->fused != NO_SUPERINSTRUCTION) {
+      block_result_t result = run_superinstruction(machine, block, op,
+                                                   address);
+      if (result == LEAVE_BLOCK || SUPERINSTRUCTION_ENDS_BLOCK[op->fused]) {
+        return result;
+      }
+      size_t skipped = SUPERINSTRUCTION_LENGTHS[op->fused] - 1;
+      op += skipped;
+      address += 4 * skipped;
+      continue;
+    }
+    registers[PC] = address + 8;
+
+    if (instruction->cond != AL && !condition(machine, instruction)) {
+      continue;
+    }
+
+    switch (op->type) {
+      case DPI_OP:
+        run_dpi(machine, op);
+        break;
+      case MUL_OP:
+        execute_mul(machine, instruction);
+        break;
+      case SDT_OP:
+      case BDT_OP:
+        if (run_transfer(machine, instruction, address)) {
+          return LEAVE_BLOCK;
+        }
+        break;
+      case GENERIC_OP:
+      default:
+        execute_instruction(machine, instruction);
+        break;
+    }
+  }
+
+  switch (block->exit) {
+    case NEXT_EXIT:
+      return NEXT_BLOCK;
+    case BRANCH_EXIT:
+      registers[PC] = block->exit_address + 8;
+      if (condition(machine, &block->exit_instruction)) {
+        return TAKEN_BLOCK;
+      }
+      return NEXT_BLOCK;
+    case PC_WRITE_EXIT:
+      registers[PC] = block->exit_address + 8;
+      if (!condition(machine, &block->exit_instruction)) {
+        return NEXT_BLOCK;
+      }
+      execute_instruction(machine, &block->exit_instruction);
+      if (machine->code_modified) {
+        // A store which writes back to PC wrote to code
+        return_to_pipeline(machine, false, 0, registers[PC]);
+        return LEAVE_BLOCK;
+      }
+      return INDIRECT_BLOCK;
+    case PIPELINE_EXIT:
+    default:
+      leave_blocks(machine, block->next_address);
+      return LEAVE_BLOCK;
+  }
+}
+
+/**
+ * @brief Hands control back to the pipeline, before the instruction at an
+ * address is run.
+ *
+ * The pipeline is left as it would be after running the instructions before
+ * the address, with the instruction at the address fetched.
+ * @param machine The current system state.
+ * @param address The address of the next instruction.
+ */
+static void leave_blocks(system_state_t *machine, uint32_t address) {
+  if (is_cacheable_address(address)) {
+    return_to_pipeline(machine, true, get_word(machine, address), address + 4);
+  } else {
+    return_to_pipeline(machine, false, 0, address);
+  }
+}
+
+/**
+ * @brief Runs the native code of a block, and checks it against the
+ * interpreter.
+ *
+ * The block is first interpreted on a copy of the system state, which does not
+ * report GPIO accesses. Any difference in the registers, memory or exit taken
+ * is reported, and the program exits.
+ * @param machine The current system state.
+ * @param block The block to run.
+ * @returns How the block was left.
+ */
+static block_result_t run_checked(system_state_t *machine, block_t *block) {
+  system_state_t *expected = machine->block_cache->shadow;
+  bool transfers = false;
+
+  for (size_t i = 0; i < block->length; i++) {
+    transfers |= block->ops[i].type == SDT_OP
+                 || block->ops[i].type == BDT_OP;
+  }
+  if (transfers) {
+    // The shadow keeps its own pages, which are overwritten
+    memory_t memory = expected->memory;
+    *expected = *machine;
+    expected->memory = memory;
+    copy_memory(expected, machine);
+  } else {
+    // Memory is not written, so only the registers are copied
+    memcpy(expected->registers, machine->registers,
+           sizeof(machine->registers));
+    expected->flags = machine->flags;
+    expected->decoded_instruction = machine->decoded_instruction;
+  }
+  expected->decode_cache = NULL;
+  expected->block_cache = NULL;
+  expected->quiet = true;
+  block_result_t expected_result = interpret_block(expected, block);
+  update_flags(expected);
+
+  block_result_t result = block->native(machine);
+  if (result == LEAVE_BLOCK) {
+    // Code was modified, so the interpreter ran further than the native code
+    return result;
+  }
+
+  bool matches = result == expected_result;
+  if (!matches) {
+    fprintf(stderr, "Native code for block 0x%08x left through %d, "
+            "expected %d\n", block->start, result, expected_result);
+  }
+  for (int i = 0; i < NUM_REGISTERS; i++) {
+    if (machine->registers[i] != expected->registers[i]) {
+      fprintf(stderr, "Native code for block 0x%08x set register %d to "
+              "0x%08x, expected 0x%08x\n", block->start, i,
+              machine->registers[i], expected->registers[i]);
+      matches = false;
+    }
+  }
+  if (transfers && !same_memory(machine, expected)) {
+    fprintf(stderr, "Native code for block 0x%08x wrote different memory\n",
+            block->start);
+    matches = false;
+  }
+  if (!matches) {
+    exit_program(machine);
+  }
+  return result;
+}
+
+/**
+ * @brief Runs a single or block data transfer instruction inside a block.
+ *
+ * If a store writes to code, control is handed back to the pipeline, as the
+ * rest of the block may no longer match memory.
+ * @param machine The current system state.
+ * @param instruction The decoded instruction, whose condition is met.
+ * @param address The address of the instruction.
+ * @returns Whether the block must be left.
+ */
+bool run_transfer(system_state_t *machine, instruction_t *instruction,
+                  uint32_t address) {
+  if (instruction->flag_3 || !is_cacheable_address(address + 4)) {
+    execute_transfer(machine, instruction);
+    return false;
+  }
+
+  // The next instruction was fetched before this store was executed
+  word_t latched = get_word(machine, address + 4);
+  execute_transfer(machine, instruction);
+  if (machine->code_modified) {
+    return_to_pipeline(machine, true, latched, address + 8);
+    return true;
+  }
+  return false;
+}
+
+/**
+ * @brief Runs a data processing micro-op, whose condition is met.
+ *
+ * @param machine The current system state.
+ * @param op The micro-op.
+ */
+void run_dpi(system_state_t *machine, micro_op_t *op) {
+  instruction_t *instruction = &op->instruction;
+  bool carry = op->carry;
+  word_t op2 = op->operand;
+
+  if (!op->resolved_operand) {
+    // Register operand, so run the handler for the variant
+    execute_dpi(machine, instruction);
+    return;
+  }
+
+  word_t op1 = machine->registers[instruction->rn];
+  word_t result = alu(machine, instruction->operation, op1, op2);
+  if (op->writes_result) {
+    machine->registers[instruction->rd] = result;
+  }
+  if (instruction->flag_1) {
+    set_dpi_flags(machine, instruction->operation, op1, op2, result, carry);
+  }
+}
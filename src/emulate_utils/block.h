@@ -0,0 +1,233 @@
+/**
+ * @file block.h
+ * @brief A header to define the block_t type, and header file for block.c.
+ */
+
+#ifndef BLOCK_H
+#define BLOCK_H
+#include <string.h>
+#include "pipeline.h"
+#include "superinstructions.h"
+
+/** The maximum number of instructions translated into one block. */
+#define MAX_BLOCK_LENGTH 64
+/** The maximum number of blocks held before the block cache is flushed. */
+#define MAX_BLOCKS 4096
+/** The maximum number of micro-ops held before the block cache is flushed. */
+#define MAX_MICRO_OPS NUM_WORDS
+/** The number of recent targets remembered for each indirect branch. */
+#define INDIRECT_WAYS 4
+/** The number of calls remembered by the return address stack. */
+#define RETURN_STACK_DEPTH 16
+
+/**
+ * @brief An enum that identifies the type of a micro-op.
+ */
+typedef enum {
+  /** Data processing instruction. */
+  DPI_OP,
+  /** Multiply instruction. */
+  MUL_OP,
+  /** Single data transfer instruction. */
+  SDT_OP,
+  /** Block data transfer instruction. */
+  BDT_OP,
+  /** Any other instruction, run through execute_instruction. */
+  GENERIC_OP,
+} micro_op_type_t;
+
+/**
+ * @brief A struct that holds one translated instruction of a block.
+ */
+typedef struct {
+  /** The type of micro-op. */
+  micro_op_type_t type;
+  /** Whether the second operand is resolved (immediate data processing). */
+  bool resolved_operand;
+  /** Whether the result is written to Rd (data processing only). */
+  bool writes_result;
+  /** The resolved second operand. */
+  word_t operand;
+  /** The resolved shifter carry. */
+  bool carry;
+  /** The decoded instruction. */
+  instruction_t instruction;
+  /** The superinstruction starting at the micro-op, or NO_SUPERINSTRUCTION. */
+  superinstruction_t fused;
+} micro_op_t;
+
+/**
+ * @brief An enum that identifies how a block is left.
+ */
+typedef enum {
+  /** Continue at next_address (the block reached its maximum length). */
+  NEXT_EXIT,
+  /** A branch at exit_address, to taken_address or next_address. */
+  BRANCH_EXIT,
+  /** An instruction at exit_address which writes to PC (indirect branch). */
+  PC_WRITE_EXIT,
+  /** The word at next_address must be decoded by the pipeline. */
+  PIPELINE_EXIT,
+} exit_type_t;
+
+/**
+ * @brief An enum that identifies where to go after a block is run.
+ */
+typedef enum {
+  /** Control has been handed back to the pipeline. */
+  LEAVE_BLOCK = 0,
+  /** Continue at next_address. */
+  NEXT_BLOCK = 1,
+  /** Continue at taken_address. */
+  TAKEN_BLOCK = 2,
+  /** Continue at the address in PC, which an indirect branch wrote. */
+  INDIRECT_BLOCK = 3,
+} block_result_t;
+
+/**
+ * @brief A struct that describes a block which is a countdown loop.
+ *
+ * The loop branches back to its own start while a counter register differs
+ * from an exit value. Each other register is unchanged, set to a constant, or
+ * stepped by a constant, so the state after any number of iterations is known.
+ */
+typedef struct {
+  /** Whether the block is a countdown loop (see loop.c). */
+  bool valid;
+  /** The register which is tested. */
+  int counter;
+  /** The value of the counter which ends the loop. */
+  word_t exit_value;
+  /** The amount added to each register by one iteration. */
+  word_t steps[NUM_REGISTERS];
+} loop_summary_t;
+
+/**
+ * @brief A struct that holds the recent targets of an indirect branch.
+ *
+ * Each target is paired with its block, so that a jump through a register or
+ * a jump table usually goes straight to the block it reaches.
+ */
+typedef struct {
+  /** The target addresses. */
+  uint32_t addresses[INDIRECT_WAYS];
+  /** The block at each target address, or NULL if the entry is unused. */
+  struct block *blocks[INDIRECT_WAYS];
+  /** The entry replaced by the next new target. */
+  size_t victim;
+} indirect_cache_t;
+
+/**
+ * @brief A struct that holds the blocks which made the most recent calls.
+ *
+ * Each taken branch with link pushes the block it ends, and each return pops
+ * it, so a return goes straight to the block after its call. When the stack
+ * is full, the oldest call is overwritten.
+ */
+typedef struct {
+  /** The blocks ending in each call, as a circular buffer. */
+  struct block *callers[RETURN_STACK_DEPTH];
+  /** The index of the next entry to push. */
+  size_t top;
+  /** The number of entries in use. */
+  size_t size;
+} return_stack_t;
+
+/** Native code for a block, which runs it and returns where to go next. */
+typedef block_result_t (*native_block_t)(system_state_t *machine);
+
+/**
+ * @brief A struct that holds a translated basic block.
+ */
+typedef struct block {
+  /** The address of the first instruction. */
+  uint32_t start;
+  /** The micro-ops, one per instruction before the exit. */
+  micro_op_t *ops;
+  /** The number of micro-ops. */
+  size_t length;
+  /** The number of instructions run by the block, including its exit. */
+  size_t instructions;
+  /** How the block is left. */
+  exit_type_t exit;
+  /** The instruction at exit_address (BRANCH_EXIT and PC_WRITE_EXIT). */
+  instruction_t exit_instruction;
+  /** The address of the exit instruction. */
+  uint32_t exit_address;
+  /** The branch target (BRANCH_EXIT only). */
+  uint32_t taken_address;
+  /** The address run after the block when no branch is taken. */
+  uint32_t next_address;
+  /** The block at taken_address, once it has been linked. */
+  struct block *taken;
+  /** The block at next_address, once it has been linked. */
+  struct block *next;
+  /** The recent targets of the exit instruction (PC_WRITE_EXIT only). */
+  indirect_cache_t indirect;
+  /**
+   * Whether the exit instruction is a return, such as mov r15, r14 or
+   * pop {r15} (PC_WRITE_EXIT only).
+   */
+  bool returns;
+  /** The number of times the block has been run by the interpreter. */
+  size_t count;
+  /** The native code for the block, once it has been compiled. */
+  native_block_t native;
+  /** How to fast-forward the block, if it is a countdown loop. */
+  loop_summary_t loop;
+} block_t;
+
+/**
+ * @brief A struct that holds every translated block.
+ */
+typedef struct block_cache {
+  /** Holds the block starting at each word, or NULL. */
+  block_t *lookup[NUM_WORDS];
+  /** Holds the blocks. */
+  block_t blocks[MAX_BLOCKS];
+  /** The number of blocks in use. */
+  size_t num_blocks;
+  /** Holds the micro-ops of every block. */
+  micro_op_t ops[MAX_MICRO_OPS];
+  /** The number of micro-ops in use. */
+  size_t num_ops;
+  /** The number of blocks translated, including those since flushed. */
+  size_t translations;
+  /** The number of times the cache has been flushed. */
+  size_t flushes;
+  /** The number of indirect branches whose target block was remembered. */
+  uint64_t indirect_hits;
+  /** The number of indirect branches whose target block was looked up. */
+  uint64_t indirect_misses;
+  /** The calls which have not yet returned. */
+  return_stack_t return_stack;
+  /** The number of returns to the call on top of the return stack. */
+  uint64_t return_hits;
+  /** The number of returns elsewhere, or with an empty return stack. */
+  uint64_t return_misses;
+  /** Holds the native code for hot blocks, or NULL if unused. */
+  struct jit_buffer *jit;
+  /** A copy of the system state to check native code with, or NULL. */
+  system_state_t *shadow;
+  /** Whether countdown loops are fast-forwarded. */
+  bool fast_forward;
+  /** Whether hot blocks are fused into superinstructions. */
+  bool fuse;
+  /** The number of runs of each superinstruction's pattern (see fusion.c). */
+  uint64_t profile[NUM_SUPERINSTRUCTIONS];
+  /** The number of places each superinstruction has been fused. */
+  size_t fused_sites[NUM_SUPERINSTRUCTIONS];
+  /** The number of runs of each superinstruction. */
+  uint64_t fused_runs[NUM_SUPERINSTRUCTIONS];
+} block_cache_t;
+
+void run_blocks(system_state_t *machine, uint32_t address);
+block_cache_t *create_block_cache(bool jit, bool verify_jit);
+void free_block_cache(block_cache_t *cache);
+void flush_blocks(system_state_t *machine);
+void print_block_stats(system_state_t *machine);
+void run_dpi(system_state_t *machine, micro_op_t *op);
+bool run_transfer(system_state_t *machine, instruction_t *instruction,
+                  uint32_t address);
+
+#endif
@@ -5,6 +5,21 @@
 
 #include "decode.h"
 
+/** A null (non-existant) instruction. */
+const instruction_t NULL_INSTRUCTION = {
+  .type = NUL,
+  .immediate_value = 0,
+  .rn = -1,
+  .rd = -1,
+  .rs = -1,
+  .rm = -1,
+  .flag_0 = false,
+  .flag_1 = false,
+  .flag_2 = false,
+  .flag_3 = false,
+  .shift_amount = 0,
+};
+
 /**
  * @brief Decodes the fetched instruction in current system state.
  *
@@ -14,33 +29,137 @@
  * @param machine The current system state.
  */
 void decode_instruction(system_state_t *machine) {
-  word_t fetched = machine->fetched_instruction;
-  instruction_t *instruction = machine->decoded_instruction;
-  instruction->cond = fetched >> (WORD_SIZE - 4);
+  instruction_t *instruction = &machine->decoded_instruction;
+  instruction->cond = machine->fetched_instruction >> (WORD_SIZE - 4);
+
+  switch (instruction_type(machine->fetched_instruction)) {
+    case ZER:
+      halt(machine);
+      break;
+    case BRA:
+      branch(machine);
+      break;
+    case BDT:
+      block_data_transfer(machine);
+      break;
+    case SDT:
+      if ((machine->fetched_instruction >> 26) & 0x3) {
+        single_data_transfer(machine);
+      } else {
+        halfword_data_transfer(machine);
+      }
+      break;
+    case MUL:
+      multiply(machine);
+      break;
+    case DPI:
+      data_processing(machine);
+      break;
+    default:
+      // Unknown instruction
+      fprintf(stderr, "Unknown instruction, PC: %u", machine->registers[PC]);
+      exit_program(machine);
+      break;
+  }
+}
 
+/**
+ * @brief Returns the type of an instruction, without decoding it.
+ *
+ * @param word The instruction to identify.
+ * @returns The type of the instruction, or NUL if the instruction is unknown.
+ */
+instruction_type_t instruction_type(word_t word) {
   // No longer consider Cond, so remove it
-  fetched &= MASK_FIRST_4;
+  word_t fetched = word & MASK_FIRST_4;
 
-  if (!machine->fetched_instruction) {
+  if (!word) {
     // Halt instruction
-    halt(machine);
-  } else if ((fetched >> (WORD_SIZE - 8)) == 0xA) {
-    // Branch
-    branch(machine);
+    return ZER;
+  } else if ((fetched >> (WORD_SIZE - 7)) == 0x5) {
+    // Branch, with or without link
+    return BRA;
+  } else if ((fetched >> (WORD_SIZE - 7)) == 0x4) {
+    // Block Data Transfer
+    return BDT;
   } else if ((fetched >> (WORD_SIZE - 6)) == 0x1) {
     // Single Data Transfer
-    single_data_transfer(machine);
+    return SDT;
   } else if (!(fetched >> 22) && (((fetched >> 4) & 0xF) == 0x9)) {
     //Multiply
-    multiply(machine);
+    return MUL;
+  } else if (!(fetched >> (WORD_SIZE - 7)) && (fetched & 0x90) == 0x90
+    && (fetched & 0x60)) {
+    // Halfword or signed byte Single Data Transfer
+    return SDT;
   } else if (!(fetched >> (WORD_SIZE - 6))) {
     // Data Processing
-    data_processing(machine);
-  } else {
-    // Unknown instruction
-    fprintf(stderr, "Unknown instruction, PC: %u", machine->registers[PC]);
-    exit_program(machine);
+    return DPI;
   }
+  // Unknown instruction
+  return NUL;
+}
+
+/**
+ * @brief Decodes the fetched instruction, using the decode cache if possible.
+ *
+ * The fetched instruction was read from the word before PC. If the decode
+ * cache holds a current entry for that word, the entry is copied into
+ * decoded_instruction. Otherwise the instruction is decoded as normal, starting
+ * from NULL_INSTRUCTION, and the result is stored in the cache (if the address
+ * is cacheable) for later cycles. The word is then marked as code, so that a
+ * store to it invalidates the entry. The entry is left alone when the fetched
+ * word is no longer the word in memory, as a store overwrote it after it was
+ * fetched, so the cache never holds the old instruction as current.
+ * @param machine The current system state.
+ */
+void decode_instruction_cached(system_state_t *machine) {
+  uint32_t address = machine->registers[PC] - 4;
+  predecoded_t *entry = NULL;
+
+  if (machine->decode_cache && is_cacheable_address(address)) {
+    entry = &machine->decode_cache[address >> 2];
+    if (is_predecoded(machine, address)
+      && entry->word == machine->fetched_instruction) {
+      // Cache hit
+      machine->decoded_instruction = entry->instruction;
+      return;
+    }
+  }
+
+  // Decode from scratch, filling the entry on a cache miss
+  machine->decoded_instruction = NULL_INSTRUCTION;
+  decode_instruction(machine);
+  if (entry && machine->fetched_instruction == get_word(machine, address)) {
+    entry->generation = machine->page_generations[address >> PAGE_BITS];
+    *code_bits(machine, address) |= CODE_BIT(address);
+    entry->word = machine->fetched_instruction;
+    entry->instruction = machine->decoded_instruction;
+    entry->handler = 0;
+  }
+}
+
+/**
+ * @brief Returns the decode cache entry for the word at an address.
+ *
+ * If the entry is not current, the word is fetched and decoded as if it were
+ * the fetched instruction, filling the entry. This leaves PC pointing to the
+ * word after the address, as it would be during the decode cycle.
+ * A pre-condition is that the address must be cacheable.
+ * @param machine The current system state.
+ * @param address The address of the word to predecode.
+ * @returns The current cache entry for the address, which holds the decode
+ * of the word in memory.
+ */
+predecoded_t *predecode(system_state_t *machine, uint32_t address) {
+  predecoded_t *entry = &machine->decode_cache[address >> 2];
+
+  if (!is_predecoded(machine, address)) {
+    machine->fetched_instruction = get_word(machine, address);
+    machine->registers[PC] = address + 4;
+    decode_instruction_cached(machine);
+  }
+  return entry;
 }
 
 /**
@@ -49,7 +168,7 @@ void decode_instruction(system_state_t *machine) {
  * @param machine The current system state.
  */
 void halt(system_state_t *machine) {
-  machine->decoded_instruction->type = ZER;
+  machine->decoded_instruction.type = ZER;
 }
 
 /**
@@ -58,10 +177,13 @@ void halt(system_state_t *machine) {
  * The offset (24 bits) is bit 0 to 23 of the branch instruction.
  * It is then bit shifted to the left by 2 and then sign extended to 32 bits.
  * The offset is stored in the immediate_value of the decoded_instruction.
+ * flag_3 stores the L bit (if set, the return address is written to LR).
  * @param machine The current system state.
  */
 void branch(system_state_t *machine) {
-  machine->decoded_instruction->type = BRA;
+  machine->decoded_instruction.type = BRA;
+  machine->decoded_instruction.flag_3 = (machine->fetched_instruction >> 24)
+                                        & 0x1;
   uint32_t offset = machine->fetched_instruction & MASK_FIRST_8; // Last 24 bits
   offset <<= 2;
 
@@ -70,7 +192,7 @@ void branch(system_state_t *machine) {
     // Number is negative
     offset |= 0xFC000000; // Pad left with 6 one's
   }
-  machine->decoded_instruction->immediate_value = offset;
+  machine->decoded_instruction.immediate_value = offset;
 }
 
 /**
@@ -84,7 +206,7 @@ void branch(system_state_t *machine) {
  * @param machine The current system state.
  */
 void multiply(system_state_t *machine) {
-  instruction_t *instruction = machine->decoded_instruction;
+  instruction_t *instruction = &machine->decoded_instruction;
   word_t fetched = machine->fetched_instruction;
 
   instruction->type = MUL;
@@ -114,13 +236,16 @@ void multiply(system_state_t *machine) {
  *   * Otherwise, the word is stored into memory.
  * * rd is the source/destination register address.
  * * rn is the base register.
+ * * transfer is set from the B bit, to a word or a byte.
  * @param machine The current system state.
  */
 void single_data_transfer(system_state_t *machine) {
-  instruction_t *instruction = machine->decoded_instruction;
+  instruction_t *instruction = &machine->decoded_instruction;
   word_t fetched = machine->fetched_instruction;
 
   instruction->type = SDT;
+  instruction->transfer = (fetched >> 22) & 0x1 ? BYTE_TRANSFER
+                                                : WORD_TRANSFER;
   instruction->flag_0 = (fetched >> 25) & 0x1;
   instruction->flag_1 = (fetched >> 24) & 0x1;
   instruction->flag_2 = (fetched >> 23) & 0x1;
@@ -147,6 +272,87 @@ void single_data_transfer(system_state_t *machine) {
   }
 }
 
+/**
+ * @brief Set halfword and signed byte transfer data in decoded_instruction.
+ *
+ * These are decoded as single data transfers, with the fields used as in
+ * single_data_transfer, except that:
+ * * flag_0 is set if the offset is register Rm, which is not shifted (the
+ *   immediate bit is clear). Otherwise, the offset is an 8 bit immediate,
+ *   split between bits 8 to 11 and 0 to 3.
+ * * transfer is set from the S and H bits, to an unsigned halfword, or a
+ *   signed byte or halfword.
+ * @param machine The current system state.
+ */
+void halfword_data_transfer(system_state_t *machine) {
+  instruction_t *instruction = &machine->decoded_instruction;
+  word_t fetched = machine->fetched_instruction;
+
+  instruction->type = SDT;
+  instruction->flag_0 = !((fetched >> 22) & 0x1);
+  instruction->flag_1 = (fetched >> 24) & 0x1;
+  instruction->flag_2 = (fetched >> 23) & 0x1;
+  instruction->flag_3 = (fetched >> 20) & 0x1;
+  instruction->rn = (fetched >> 16) & 0xF;
+  instruction->rd = (fetched >> 12) & 0xF;
+
+  switch ((fetched >> 5) & 0x3) {
+    case 1:
+      instruction->transfer = HALF_TRANSFER;
+      break;
+    case 2:
+      instruction->transfer = SIGNED_BYTE_TRANSFER;
+      break;
+    default:
+      instruction->transfer = SIGNED_HALF_TRANSFER;
+      break;
+  }
+
+  if (instruction->flag_0) {
+    // Register offset
+    instruction->rm = fetched & 0xF;
+    instruction->shift_type = LSL;
+    instruction->shift_amount = 0;
+  } else {
+    // Immediate offset
+    instruction->immediate_value = ((fetched >> 4) & 0xF0) | (fetched & 0xF);
+  }
+}
+
+/**
+ * @brief Set block_data_transfer instruction data in decoded_instruction.
+ *
+ * The fields in decoded_instruction are used as follows:
+ * * flag_0 stores the W bit (if set, the base register is written back).
+ * * flag_1 stores the P bit:
+ *   * If set, the base is moved before each word is transferred.
+ *   * Otherwise, it is moved after each word is transferred.
+ * * flag_2 stores the U bit:
+ *   * If set, words are transferred upwards from the base.
+ *   * Otherwise, they are transferred downwards.
+ * * flag_3 stores the L bit:
+ *   * If set, the words are loaded from memory.
+ *   * Otherwise, the words are stored into memory.
+ * * immediate_value is the register list, with bit n set if register n is
+ *   transferred.
+ * * rn is the base register.
+ *
+ * The S bit is ignored, as only one processor mode is emulated.
+ * @param machine The current system state.
+ */
+void block_data_transfer(system_state_t *machine) {
+  instruction_t *instruction = &machine->decoded_instruction;
+  word_t fetched = machine->fetched_instruction;
+
+  instruction->type = BDT;
+  instruction->flag_0 = (fetched >> 21) & 0x1;
+  instruction->flag_1 = (fetched >> 24) & 0x1;
+  instruction->flag_2 = (fetched >> 23) & 0x1;
+  instruction->flag_3 = (fetched >> 20) & 0x1;
+  instruction->rn = (fetched >> 16) & 0xF;
+  instruction->immediate_value = fetched & 0xFFFF;
+}
+
 /**
  * @brief Set data_processing instruction data in decoded_instruction.
  *
@@ -159,11 +365,13 @@ void single_data_transfer(system_state_t *machine) {
  *   provided in the fetched_instruction.
  * * rd is the source/destination register address.
  * * rn is the first operand register.
+ * * variant selects the handler which executes the instruction.
  * @param machine The current system state.
  */
 void data_processing(system_state_t *machine) {
-  instruction_t *instruction = machine->decoded_instruction;
+  instruction_t *instruction = &machine->decoded_instruction;
   word_t fetched = machine->fetched_instruction;
+  operand_kind_t operand;
 
   instruction->type = DPI;
   instruction->flag_0 = (fetched >> 25) & 0x1;
@@ -177,6 +385,7 @@ void data_processing(system_state_t *machine) {
     instruction->immediate_value = fetched & 0xFF;
     instruction->shift_type = ROR;
     instruction->shift_amount = ((fetched >> 8) & 0xF) << 1;
+    operand = IMM_OPERAND;
   } else {
     // Register operand
     instruction->rm = fetched & 0xF;
@@ -185,10 +394,14 @@ void data_processing(system_state_t *machine) {
       // Shift by a register
       instruction->shift_type = (fetched >> 5) & 0x3;
       instruction->rs = (fetched >> 8) & 0xF;
+      operand = LSL_REG_OPERAND + instruction->shift_type;
     } else {
       // Shift by a constant amount
       instruction->shift_type = (fetched >> 5) & 0x3;
       instruction->shift_amount = (fetched >> 7) & 0x1F;
+      operand = LSL_OPERAND + instruction->shift_type;
     }
   }
+  instruction->variant = dpi_variant(instruction->operation, operand,
+                                     instruction->flag_1);
 }
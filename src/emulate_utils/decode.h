@@ -6,11 +6,19 @@
 #ifndef DECODE_H
 #define DECODE_H
 #include "../toolbox.h"
+#include "dpi_variants.h"
+
+extern const instruction_t NULL_INSTRUCTION;
 
 void decode_instruction(system_state_t *machine);
+instruction_type_t instruction_type(word_t word);
+void decode_instruction_cached(system_state_t *machine);
+predecoded_t *predecode(system_state_t *machine, uint32_t address);
 void halt(system_state_t *machine);
 void branch(system_state_t *machine);
 void single_data_transfer(system_state_t *machine);
+void halfword_data_transfer(system_state_t *machine);
+void block_data_transfer(system_state_t *machine);
 void multiply(system_state_t *machine);
 void data_processing(system_state_t *machine);
 
@@ -0,0 +1,81 @@
+/**
+ * @file dpi_variants.h
+ * @brief X-macros listing every variant of data processing instruction, and
+ * the numbering of variants.
+ *
+ * A variant is an (opcode, operand, S bit) combination. The decoder stores the
+ * number of each data processing instruction's variant in its variant field,
+ * and execute.c stamps out one handler per variant from these lists, so that
+ * each handler only does the work its variant needs.
+ *
+ * To use a list, define a macro X taking the names in the list, and pass it
+ * to the list. For example, DPI_OPERANDS(X) expands to X(IMM) X(LSL) ...
+ */
+
+#ifndef DPI_VARIANTS_H
+#define DPI_VARIANTS_H
+#include "../instruction.h"
+
+/** Every kind of second operand (see operand_kind_t). */
+#define DPI_OPERANDS(X) \
+  X(IMM) X(LSL) X(LSR) X(ASR) X(ROR) \
+  X(LSL_REG) X(LSR_REG) X(ASR_REG) X(ROR_REG)
+
+/** Every operand of one opcode, without and with the S bit. */
+#define DPI_OPCODE_VARIANTS(X, opcode) \
+  X(opcode, IMM, 0) X(opcode, IMM, 1) \
+  X(opcode, LSL, 0) X(opcode, LSL, 1) \
+  X(opcode, LSR, 0) X(opcode, LSR, 1) \
+  X(opcode, ASR, 0) X(opcode, ASR, 1) \
+  X(opcode, ROR, 0) X(opcode, ROR, 1) \
+  X(opcode, LSL_REG, 0) X(opcode, LSL_REG, 1) \
+  X(opcode, LSR_REG, 0) X(opcode, LSR_REG, 1) \
+  X(opcode, ASR_REG, 0) X(opcode, ASR_REG, 1) \
+  X(opcode, ROR_REG, 0) X(opcode, ROR_REG, 1)
+
+/** Every variant, as X(opcode, operand, s) with s either 0 or 1. */
+#define DPI_VARIANTS(X) \
+  DPI_OPCODE_VARIANTS(X, AND) DPI_OPCODE_VARIANTS(X, EOR) \
+  DPI_OPCODE_VARIANTS(X, SUB) DPI_OPCODE_VARIANTS(X, RSB) \
+  DPI_OPCODE_VARIANTS(X, ADD) DPI_OPCODE_VARIANTS(X, TST) \
+  DPI_OPCODE_VARIANTS(X, TEQ) DPI_OPCODE_VARIANTS(X, CMP) \
+  DPI_OPCODE_VARIANTS(X, ORR) DPI_OPCODE_VARIANTS(X, MOV)
+
+/** Names an operand kind. */
+#define OPERAND_KIND(operand) operand##_OPERAND
+/** Lists an operand kind, as an enum constant. */
+#define ENUM_OPERAND(operand) OPERAND_KIND(operand),
+
+/**
+ * @brief An enum that identifies the kind of second operand of a data
+ * processing instruction.
+ *
+ * Names are IMM (rotated immediate), a shift by a constant (LSL, LSR, ASR and
+ * ROR), or a shift by a register (LSL_REG, LSR_REG, ASR_REG and ROR_REG), each
+ * with the suffix _OPERAND. Shifts are in the order of shift_t.
+ */
+typedef enum {
+  DPI_OPERANDS(ENUM_OPERAND)
+  /** The number of kinds of operand. */
+  NUM_OPERAND_KINDS,
+} operand_kind_t;
+
+#undef ENUM_OPERAND
+
+/** The number of variant numbers, including those of unknown opcodes. */
+#define NUM_DPI_VARIANTS (16 * 2 * NUM_OPERAND_KINDS)
+
+/**
+ * @brief Returns the number of a variant.
+ *
+ * @param operation The opcode, which may be unknown.
+ * @param operand The kind of second operand.
+ * @param s Whether the S bit is set.
+ * @returns The number of the variant.
+ */
+static inline uint16_t dpi_variant(opcode_t operation,
+                                   operand_kind_t operand, bool s) {
+  return ((operation * NUM_OPERAND_KINDS) + operand) * 2 + s;
+}
+
+#endif
@@ -5,40 +5,82 @@
 
 #include "execute.h"
 
-static int condition(system_state_t *machine);
+/** A handler which executes one variant of data processing instruction. */
+typedef void (*dpi_handler_t)(system_state_t *machine,
+                              instruction_t *instruction);
+
+static void execute_any_dpi(system_state_t *machine,
+                            instruction_t *instruction);
+static word_t load(system_state_t *machine, transfer_t transfer,
+                   uint32_t address);
+static void store(system_state_t *machine, transfer_t transfer,
+                  uint32_t address, word_t value);
+static const dpi_handler_t dpi_handlers[NUM_DPI_VARIANTS];
+
+/** Whether the N flag is set in a flags nibble. */
+#define N_OF(flags) (((flags) & N) != 0)
+/** Whether the Z flag is set in a flags nibble. */
+#define Z_OF(flags) (((flags) & Z) != 0)
+/** Whether the C flag is set in a flags nibble. */
+#define C_OF(flags) (((flags) & C) != 0)
+/** Whether the V flag is set in a flags nibble. */
+#define V_OF(flags) (((flags) & V) != 0)
+
+/** The row of CONDITION_TABLE for a condition, given as a macro. */
+#define CONDITION_ROW(passes) { \
+  passes(0x0), passes(0x1), passes(0x2), passes(0x3), \
+  passes(0x4), passes(0x5), passes(0x6), passes(0x7), \
+  passes(0x8), passes(0x9), passes(0xA), passes(0xB), \
+  passes(0xC), passes(0xD), passes(0xE), passes(0xF) }
+
+/** Whether each condition passes, for a flags nibble f. */
+#define EQ_PASSES(f) Z_OF(f)
+#define NE_PASSES(f) !Z_OF(f)
+#define CS_PASSES(f) C_OF(f)
+#define CC_PASSES(f) !C_OF(f)
+#define MI_PASSES(f) N_OF(f)
+#define PL_PASSES(f) !N_OF(f)
+#define VS_PASSES(f) V_OF(f)
+#define VC_PASSES(f) !V_OF(f)
+#define HI_PASSES(f) (C_OF(f) && !Z_OF(f))
+#define LS_PASSES(f) (!C_OF(f) || Z_OF(f))
+#define GE_PASSES(f) (N_OF(f) == V_OF(f))
+#define LT_PASSES(f) (N_OF(f) != V_OF(f))
+#define GT_PASSES(f) (!Z_OF(f) && N_OF(f) == V_OF(f))
+#define LE_PASSES(f) (Z_OF(f) || N_OF(f) != V_OF(f))
+#define AL_PASSES(f) true
+#define NV_PASSES(f) false
+
+/**
+ * @brief Whether each condition passes, indexed by the condition code and
+ * then by the flags nibble (the top 4 bits of CPSR).
+ */
+const bool CONDITION_TABLE[NUM_CONDITIONS][16] = {
+  [EQ] = CONDITION_ROW(EQ_PASSES), [NE] = CONDITION_ROW(NE_PASSES),
+  [CS] = CONDITION_ROW(CS_PASSES), [CC] = CONDITION_ROW(CC_PASSES),
+  [MI] = CONDITION_ROW(MI_PASSES), [PL] = CONDITION_ROW(PL_PASSES),
+  [VS] = CONDITION_ROW(VS_PASSES), [VC] = CONDITION_ROW(VC_PASSES),
+  [HI] = CONDITION_ROW(HI_PASSES), [LS] = CONDITION_ROW(LS_PASSES),
+  [GE] = CONDITION_ROW(GE_PASSES), [LT] = CONDITION_ROW(LT_PASSES),
+  [GT] = CONDITION_ROW(GT_PASSES), [LE] = CONDITION_ROW(LE_PASSES),
+  [AL] = CONDITION_ROW(AL_PASSES), [NV] = CONDITION_ROW(NV_PASSES),
+};
 
 /**
  * @brief Returns whether the condition is met.
  *
- * Returns true if and only if the condition required by the current decoded
- * instruction is met by the current state of the flags register (CPSR).
+ * Returns true if and only if the condition required by the given decoded
+ * instruction is met by the current state of the flags register (CPSR). Every
+ * condition is looked up in CONDITION_TABLE.
  * @param machine The current system state.
+ * @param instruction The decoded instruction.
  * @returns Whether condition is met.
  */
-static int condition(system_state_t *machine) {
+int condition(system_state_t *machine, instruction_t *instruction) {
+  update_flags(machine);
   // Want the first 4 bits
-  char flags = machine->registers[CPSR] >> (WORD_SIZE - 4);
-
-  switch(machine->decoded_instruction->cond) {
-    case EQ:
-      return (flags & Z);
-    case NE:
-      return !(flags & Z);
-    case GE:
-      return (flags & V) == ((flags & N) >> 3);
-    case LT:
-      return (flags & V) != ((flags & N) >> 3);
-    case GT:
-      return !(flags & Z) && ((flags & V) == ((flags & N) >> 3));
-    case LE:
-      return (flags & Z) || ((flags & V) != ((flags & N) >> 3));
-    case AL:
-      return 1;
-    default:
-      fprintf(stderr, "Incorrect cond flag, PC: %u", machine->registers[PC]);
-      exit_program(machine);
-      return 0;
-  }
+  return CONDITION_TABLE[instruction->cond][machine->registers[CPSR]
+                                            >> (WORD_SIZE - 4)];
 }
 
 /**
@@ -50,19 +92,36 @@ static int condition(system_state_t *machine) {
  * @param machine The current system state.
  */
 void execute(system_state_t *machine) {
-  if (condition(machine)) {
-    switch (machine->decoded_instruction->type) {
+  execute_instruction(machine, &machine->decoded_instruction);
+}
+
+/**
+ * @brief Executes a decoded instruction.
+ *
+ * Executes the given instruction if the condition is met, and updates the
+ * system state accordingly. An instruction which writes to PC flushes the
+ * pipeline, as a branch does.
+ * A pre-condition is that the instruction must not be type NUL or ZER.
+ * @param machine The current system state.
+ * @param instruction The decoded instruction.
+ */
+void execute_instruction(system_state_t *machine, instruction_t *instruction) {
+  if (condition(machine, instruction)) {
+    switch (instruction->type) {
       case DPI:
-        execute_dpi(machine);
+        execute_dpi(machine, instruction);
         break;
       case MUL:
-        execute_mul(machine);
+        execute_mul(machine, instruction);
         break;
       case SDT:
-        execute_sdt(machine);
+        execute_sdt(machine, instruction);
         break;
       case BRA:
-        execute_branch(machine);
+        execute_branch(machine, instruction);
+        break;
+      case BDT:
+        execute_bdt(machine, instruction);
         break;
       case ZER:
       case NUL:
@@ -72,79 +131,168 @@ void execute(system_state_t *machine) {
         exit_program(machine);
         break;
     }
+    if (writes_pc(instruction)) {
+      indirect_branch(machine);
+    }
   }
 }
 
 /**
- * @brief Executes a data processing instruction.
+ * @brief Completes a write to PC by an instruction other than a branch.
+ *
+ * Such a write is an indirect branch to the address written, so the fetched
+ * instruction is not run. As in ARM state, the bottom 2 bits of the address
+ * are ignored.
+ * @param machine The current system state, after PC was written.
+ */
+void indirect_branch(system_state_t *machine) {
+  machine->has_fetched_instruction = false;
+  machine->registers[PC] &= ~(word_t) 3;
+}
+
+/**
+ * @brief Computes the shifted second operand of a data processing instruction.
  *
  * @param machine The current system state.
+ * @param instruction The decoded data processing instruction.
+ * @param carry Set to the carry out of the shifter.
+ * @returns The second operand.
  */
-void execute_dpi(system_state_t *machine) {
-  word_t op2;
+word_t operand2(system_state_t *machine, instruction_t *instruction,
+                bool *carry) {
+  value_carry_t shifter_out;
   word_t shift_amount;
-  bool shifter_carry = 0;
-  instruction_t *instruction = machine->decoded_instruction;
 
-  // Get the second operand
   if (!instruction->flag_0) {
-    op2 = machine->registers[instruction->rm];
-
     if (instruction->rs == -1) {
       shift_amount = instruction->shift_amount;
     } else {
       shift_amount = machine->registers[instruction->rs];
     }
+    // Shift the second operand
+    shifter_out = shifter(instruction->shift_type, shift_amount,
+                          machine->registers[instruction->rm]);
   } else {
-    op2 = instruction->immediate_value;
-    shift_amount = instruction->shift_amount;
+    // Rotate the immediate operand
+    shifter_out = rotate_immediate(instruction->shift_amount,
+                                   instruction->immediate_value);
   }
 
-  // Shift the second operand
-  value_carry_t *shifter_out = shifter(instruction->shift_type,
-                                       shift_amount, op2);
-  op2 = shifter_out->value;
-  shifter_carry = shifter_out->carry;
-  free(shifter_out);
+  *carry = shifter_out.carry;
+  return shifter_out.value;
+}
+
+/**
+ * @brief Sets the CPSR flags for the result of a logical or multiply
+ * instruction.
+ *
+ * The flags are only recorded, and are written to CPSR by update_flags when
+ * they are read. The overflow flag is left as it is, so the flags of an
+ * arithmetic instruction which are still recorded are written first.
+ * @param machine The current system state.
+ * @param result The result of the instruction.
+ * @param carry Whether the carry flag is set.
+ */
+void set_flags(system_state_t *machine, word_t result, bool carry) {
+  lazy_flags_t *flags = &machine->flags;
+  if (flags->pending && flags->arithmetic) {
+    update_flags(machine);
+  }
+  flags->pending = true;
+  flags->arithmetic = false;
+  flags->result = result;
+  flags->carry = carry;
+}
 
-  word_t flags = 0;
+/**
+ * @brief Sets the CPSR flags for the result of an arithmetic instruction.
+ *
+ * The carry and overflow flags are only computed by update_flags when the
+ * flags are read.
+ * @param machine The current system state.
+ * @param op1 The first operand.
+ * @param op2 The second operand.
+ * @param result The result of the instruction.
+ * @param subtract Whether the result is op1 - op2, rather than op1 + op2.
+ */
+void set_arithmetic_flags(system_state_t *machine, word_t op1, word_t op2,
+                          word_t result, bool subtract) {
+  lazy_flags_t *flags = &machine->flags;
+  flags->pending = true;
+  flags->arithmetic = true;
+  flags->subtract = subtract;
+  flags->op1 = op1;
+  flags->op2 = op2;
+  flags->result = result;
+}
+
+/**
+ * @brief Sets the CPSR flags for a data processing instruction.
+ *
+ * @param machine The current system state.
+ * @param operation The opcode.
+ * @param op1 The first operand.
+ * @param op2 The (shifted) second operand.
+ * @param result The result of the operation.
+ * @param carry The shifter carry.
+ */
+void set_dpi_flags(system_state_t *machine, opcode_t operation, word_t op1,
+                   word_t op2, word_t result, bool carry) {
+  switch (operation) {
+    case SUB:
+    case CMP:
+      set_arithmetic_flags(machine, op1, op2, result, true);
+      break;
+    case RSB:
+      set_arithmetic_flags(machine, op2, op1, result, true);
+      break;
+    case ADD:
+      set_arithmetic_flags(machine, op1, op2, result, false);
+      break;
+    default:
+      set_flags(machine, result, carry);
+      break;
+  }
+}
+
+/**
+ * @brief Computes the result of a data processing operation.
+ *
+ * @param machine The current system state.
+ * @param operation The opcode.
+ * @param op1 The first operand.
+ * @param op2 The (shifted) second operand.
+ * @returns The result of the operation.
+ */
+word_t alu(system_state_t *machine, opcode_t operation, word_t op1,
+           word_t op2) {
   word_t result;
 
-  // Compute the result and carry flag depending on the opcode
-  switch (instruction->operation) {
+  // Compute the result depending on the opcode
+  switch (operation) {
     case AND:
     case TST:
-      result = machine->registers[instruction->rn] & op2;
-      flags = C * shifter_carry;
+      result = op1 & op2;
       break;
     case EOR:
     case TEQ:
-      result = machine->registers[instruction->rn] ^ op2;
-      flags = C * shifter_carry;
+      result = op1 ^ op2;
       break;
     case SUB:
     case CMP:
-      result = machine->registers[instruction->rn] + negate(op2);
-      flags = C * ((is_negative(machine->registers[instruction->rn])
-              == is_negative(op2)) !=  is_negative(result));
+      result = op1 + negate(op2);
       break;
     case RSB:
-      result = op2 + negate(machine->registers[instruction->rn]);
-      flags = C * ((is_negative(machine->registers[instruction->rn])
-              == is_negative(op2)) !=  is_negative(result));
+      result = op2 + negate(op1);
       break;
     case ADD:
-      result = machine->registers[instruction->rn] + op2;
-      flags = C * ((is_negative(machine->registers[instruction->rn])
-              == is_negative(op2)) !=  is_negative(result));
+      result = op1 + op2;
       break;
     case ORR:
-      result = machine->registers[instruction->rn] | op2;
-      flags = C * shifter_carry;
+      result = op1 | op2;
       break;
     case MOV:
       result = op2;
-      flags = C * shifter_carry;
       break;
     default:
       result = 0;
@@ -153,34 +301,241 @@ void execute_dpi(system_state_t *machine) {
       exit_program(machine);
       break;
   }
+  return result;
+}
+
+/**
+ * @brief Returns whether a data processing opcode writes its result.
+ *
+ * @param operation The opcode.
+ * @returns False for opcodes which only set flags, true otherwise.
+ */
+bool writes_result(opcode_t operation) {
+  return !(operation == TST || operation == TEQ || operation == CMP);
+}
+
+/**
+ * @brief Returns whether an instruction can write to PC as an indirect
+ * branch.
+ *
+ * Branches always write to PC, so are not included.
+ * @param instruction The decoded instruction.
+ * @returns Whether the instruction may write to PC.
+ */
+bool writes_pc(instruction_t *instruction) {
+  switch (instruction->type) {
+    case DPI:
+      return instruction->rd == PC && writes_result(instruction->operation);
+    case MUL:
+      return instruction->rd == PC;
+    case SDT:
+      return (instruction->flag_3 && instruction->rd == PC)
+             || (!instruction->flag_1 && instruction->rn == PC);
+    case BDT:
+      return (instruction->flag_3 && (instruction->immediate_value >> PC) & 1)
+             || (instruction->flag_0 && instruction->rn == PC);
+    default:
+      return false;
+  }
+}
 
-  // Compute the negative and zero flags
-  flags |= (N * is_negative(result));
-  flags |= (Z * (result == 0));
+/**
+ * @brief Executes a data processing instruction.
+ *
+ * Runs the handler for the instruction's variant, which was selected when it
+ * was decoded.
+ * @param machine The current system state.
+ * @param instruction The decoded instruction.
+ */
+void execute_dpi(system_state_t *machine, instruction_t *instruction) {
+  dpi_handler_t handler = dpi_handlers[instruction->variant];
+
+  if (handler) {
+    handler(machine, instruction);
+  } else {
+    execute_any_dpi(machine, instruction);
+  }
+}
+
+/**
+ * @brief Executes a data processing instruction of any variant.
+ *
+ * Used for unknown opcodes, which have no handler (and are reported by alu).
+ * @param machine The current system state.
+ * @param instruction The decoded instruction.
+ */
+static void execute_any_dpi(system_state_t *machine,
+                            instruction_t *instruction) {
+  bool carry;
+  word_t op2 = operand2(machine, instruction, &carry);
+  word_t op1 = machine->registers[instruction->rn];
+  word_t result = alu(machine, instruction->operation, op1, op2);
 
   // Update the system state with result, if required
-  if (!(instruction->operation == TST
-    || instruction->operation == TEQ
-    || instruction->operation == CMP)) {
+  if (writes_result(instruction->operation)) {
     machine->registers[instruction->rd] = result;
   }
 
   // Update the system state by setting flags, if required
   if (instruction->flag_1) {
-    machine->registers[CPSR] &= MASK_FIRST_4;
-    // Only want the first four bits
-    machine->registers[CPSR] |= (flags << (WORD_SIZE - 4));
+    set_dpi_flags(machine, instruction->operation, op1, op2, result, carry);
   }
 }
 
+/**
+ * @brief Returns a rotated immediate operand (IMM_OPERAND).
+ *
+ * @param machine The current system state.
+ * @param instruction The decoded instruction.
+ * @param carry Set to the carry out of the shifter.
+ * @returns The second operand.
+ */
+static inline word_t imm_operand(system_state_t *machine,
+                                 instruction_t *instruction, bool *carry) {
+  value_carry_t shifter_out = rotate_immediate(instruction->shift_amount,
+                                               instruction->immediate_value);
+  *carry = shifter_out.carry;
+  return shifter_out.value;
+}
+
+/**
+ * @brief Returns Rm shifted left by a constant (LSL_OPERAND).
+ *
+ * The constant shifts give the same results as shifter, for amounts up to 31.
+ * @param machine The current system state.
+ * @param instruction The decoded instruction.
+ * @param carry Set to the carry out of the shifter.
+ * @returns The second operand.
+ */
+static inline word_t lsl_operand(system_state_t *machine,
+                                 instruction_t *instruction, bool *carry) {
+  word_t value = machine->registers[instruction->rm];
+  word_t amount = instruction->shift_amount;
+  *carry = amount && ((value >> (WORD_SIZE - amount)) & 0x1);
+  return value << amount;
+}
+
+/**
+ * @brief Returns Rm shifted right by a constant (LSR_OPERAND).
+ *
+ * @param machine The current system state.
+ * @param instruction The decoded instruction.
+ * @param carry Set to the carry out of the shifter.
+ * @returns The second operand.
+ */
+static inline word_t lsr_operand(system_state_t *machine,
+                                 instruction_t *instruction, bool *carry) {
+  word_t value = machine->registers[instruction->rm];
+  word_t amount = instruction->shift_amount;
+  *carry = amount && ((value >> (amount - 1)) & 0x1);
+  return value >> amount;
+}
+
+/**
+ * @brief Returns Rm arithmetically shifted right by a constant (ASR_OPERAND).
+ *
+ * @param machine The current system state.
+ * @param instruction The decoded instruction.
+ * @param carry Set to the carry out of the shifter.
+ * @returns The second operand.
+ */
+static inline word_t asr_operand(system_state_t *machine,
+                                 instruction_t *instruction, bool *carry) {
+  word_t value = machine->registers[instruction->rm];
+  word_t amount = instruction->shift_amount;
+  *carry = amount && ((value >> (amount - 1)) & 0x1);
+  return (word_t) ((int32_t) value >> amount);
+}
+
+/**
+ * @brief Returns Rm rotated right by a constant (ROR_OPERAND).
+ *
+ * @param machine The current system state.
+ * @param instruction The decoded instruction.
+ * @param carry Set to the carry out of the shifter.
+ * @returns The second operand.
+ */
+static inline word_t ror_operand(system_state_t *machine,
+                                 instruction_t *instruction, bool *carry) {
+  word_t value = machine->registers[instruction->rm];
+  word_t amount = instruction->shift_amount;
+  *carry = amount && ((value >> (amount - 1)) & 0x1);
+  return (value >> amount) | (value << ((WORD_SIZE - amount) % WORD_SIZE));
+}
+
+/**
+ * @brief Returns Rm shifted by Rs, with the shift type of the instruction
+ * (LSL_REG_OPERAND to ROR_REG_OPERAND).
+ *
+ * @param machine The current system state.
+ * @param instruction The decoded instruction.
+ * @param carry Set to the carry out of the shifter.
+ * @returns The second operand.
+ */
+static inline word_t register_operand(system_state_t *machine,
+                                      instruction_t *instruction,
+                                      bool *carry) {
+  value_carry_t shifter_out = shifter(instruction->shift_type,
+                                      machine->registers[instruction->rs],
+                                      machine->registers[instruction->rm]);
+  *carry = shifter_out.carry;
+  return shifter_out.value;
+}
+
+/** The operand function for each kind of operand. */
+#define IMM_OPERAND_OF imm_operand
+#define LSL_OPERAND_OF lsl_operand
+#define LSR_OPERAND_OF lsr_operand
+#define ASR_OPERAND_OF asr_operand
+#define ROR_OPERAND_OF ror_operand
+#define LSL_REG_OPERAND_OF register_operand
+#define LSR_REG_OPERAND_OF register_operand
+#define ASR_REG_OPERAND_OF register_operand
+#define ROR_REG_OPERAND_OF register_operand
+
+/** Names the handler of a variant. */
+#define DPI_HANDLER(opcode, operand, s) execute_##opcode##_##operand##_##s
+
+/**
+ * Defines the handler of a variant. The opcode, operand and S bit are
+ * constants, so alu, writes_result and set_dpi_flags reduce to the work of
+ * the variant.
+ */
+#define DEFINE_DPI_HANDLER(opcode, operand, s) \
+  static void DPI_HANDLER(opcode, operand, s)(system_state_t *machine, \
+                                              instruction_t *instruction) { \
+    bool carry; \
+    word_t op2 = operand##_OPERAND_OF(machine, instruction, &carry); \
+    word_t op1 = machine->registers[instruction->rn]; \
+    word_t result = alu(machine, opcode, op1, op2); \
+    if (writes_result(opcode)) { \
+      machine->registers[instruction->rd] = result; \
+    } \
+    if (s) { \
+      set_dpi_flags(machine, opcode, op1, op2, result, carry); \
+    } \
+  }
+
+DPI_VARIANTS(DEFINE_DPI_HANDLER)
+
+/** Lists the handler of a variant, at its number. */
+#define LIST_DPI_HANDLER(opcode, operand, s) \
+  [((opcode * NUM_OPERAND_KINDS) + OPERAND_KIND(operand)) * 2 + s] = \
+    DPI_HANDLER(opcode, operand, s),
+
+/** The handler of each variant, or NULL for unknown opcodes. */
+static const dpi_handler_t dpi_handlers[NUM_DPI_VARIANTS] = {
+  DPI_VARIANTS(LIST_DPI_HANDLER)
+};
+
 /**
  * @brief Executes a multiply instruction.
  *
  * @param machine The current system state.
+ * @param instruction The decoded instruction.
  */
-void execute_mul(system_state_t *machine) {
+void execute_mul(system_state_t *machine, instruction_t *instruction) {
   word_t result;
-  instruction_t *instruction = machine->decoded_instruction;
   // Do the multiplication
   result = machine->registers[instruction->rm]
            * machine->registers[instruction->rs];
@@ -195,22 +550,21 @@ void execute_mul(system_state_t *machine) {
 
   // Update system state with flags, if required
   if (instruction->flag_1) {
-    machine->registers[CPSR] &= MASK_FIRST_4;
-    machine->registers[CPSR] |= (N * is_negative(result)) << (WORD_SIZE - 4);
-    machine->registers[CPSR] |= (Z * (result == 0)) << (WORD_SIZE - 4);
+    set_flags(machine, result, false);
   }
 }
 
 /**
  * @brief Executes a single data transfer instruction.
  *
+ * Words, bytes and halfwords are transferred (see transfer_t).
  * @param machine The current system state.
+ * @param instruction The decoded instruction.
  */
-void execute_sdt(system_state_t *machine) {
+void execute_sdt(system_state_t *machine, instruction_t *instruction) {
   uint32_t address;
   word_t offset;
   word_t shift_amount;
-  instruction_t *instruction = machine->decoded_instruction;
 
   // Immediate offset or not
   if (instruction->flag_0) {
@@ -221,10 +575,8 @@ void execute_sdt(system_state_t *machine) {
       shift_amount = machine->registers[instruction->rs];
     }
     // Shift the register offset
-    value_carry_t *shifter_out = shifter(instruction->shift_type, shift_amount,
-                                         machine->registers[instruction->rm]);
-    offset = shifter_out->value;
-    free(shifter_out);
+    offset = shifter(instruction->shift_type, shift_amount,
+                     machine->registers[instruction->rm]).value;
   } else {
     // Immediate offset
     offset = instruction->immediate_value;
@@ -247,21 +599,151 @@ void execute_sdt(system_state_t *machine) {
 
   // Load or store - update the system state
   if (instruction->flag_3) {
-    // Execute load (gets word from memory)
-    machine->registers[instruction->rd] = get_word(machine, address);
+    // Execute load (gets value from memory)
+    machine->registers[instruction->rd] = load(machine, instruction->transfer,
+                                               address);
+  } else {
+    // Execute store (sets value in memory)
+    store(machine, instruction->transfer, address,
+          machine->registers[instruction->rd]);
+  }
+}
+
+/**
+ * @brief Loads a word, byte or halfword from memory.
+ *
+ * Bytes and halfwords are zero extended, or sign extended for signed
+ * transfers.
+ * @param machine The current system state.
+ * @param transfer The size of the transfer.
+ * @param address The address to load from.
+ * @returns The value loaded, as a word.
+ */
+static word_t load(system_state_t *machine, transfer_t transfer,
+                   uint32_t address) {
+  switch (transfer) {
+    case BYTE_TRANSFER:
+      return get_byte(machine, address);
+    case HALF_TRANSFER:
+      return get_halfword(machine, address);
+    case SIGNED_BYTE_TRANSFER:
+      return (word_t) (int8_t) get_byte(machine, address);
+    case SIGNED_HALF_TRANSFER:
+      return (word_t) (int16_t) get_halfword(machine, address);
+    case WORD_TRANSFER:
+    default:
+      return get_word(machine, address);
+  }
+}
+
+/**
+ * @brief Stores a word, byte or halfword to memory.
+ *
+ * Bytes and halfwords are the bottom bits of the value.
+ * @param machine The current system state.
+ * @param transfer The size of the transfer.
+ * @param address The address to store to.
+ * @param value The value to store.
+ */
+static void store(system_state_t *machine, transfer_t transfer,
+                  uint32_t address, word_t value) {
+  switch (transfer) {
+    case BYTE_TRANSFER:
+    case SIGNED_BYTE_TRANSFER:
+      set_byte(machine, address, (byte_t) value);
+      break;
+    case HALF_TRANSFER:
+    case SIGNED_HALF_TRANSFER:
+      set_halfword(machine, address, (uint16_t) value);
+      break;
+    case WORD_TRANSFER:
+    default:
+      set_word(machine, address, value);
+      break;
+  }
+}
+
+/**
+ * @brief Executes a block data transfer instruction.
+ *
+ * The lowest register in the list is transferred to or from the lowest
+ * address, and the words are copied with one call to get_words (or
+ * set_words), which checks the whole range at once. Stores use the base
+ * register from before write back, and a load of the base register overrides
+ * write back.
+ * @param machine The current system state.
+ * @param instruction The decoded instruction.
+ */
+void execute_bdt(system_state_t *machine, instruction_t *instruction) {
+  word_t *registers = machine->registers;
+  word_t list = instruction->immediate_value;
+  word_t words[PC + 1];
+  size_t count = 0;
+
+  for (reg_address_t reg = 0; reg <= PC; reg++) {
+    if ((list >> reg) & 1) {
+      words[count++] = registers[reg];
+    }
+  }
+
+  // Find the lowest address transferred, ignoring the bottom 2 bits
+  word_t base = registers[instruction->rn];
+  word_t size = 4 * count;
+  uint32_t address;
+  if (instruction->flag_2) {
+    address = base + (instruction->flag_1 ? 4 : 0);
+  } else {
+    address = base - size + (instruction->flag_1 ? 0 : 4);
+  }
+  address &= ~(uint32_t) 3;
+
+  if (!instruction->flag_3) {
+    set_words(machine, address, words, count);
+  } else {
+    get_words(machine, address, words, count);
+  }
+
+  if (instruction->flag_0) {
+    registers[instruction->rn] = instruction->flag_2 ? base + size
+                                                     : base - size;
+  }
+
+  if (instruction->flag_3) {
+    count = 0;
+    for (reg_address_t reg = 0; reg <= PC; reg++) {
+      if ((list >> reg) & 1) {
+        registers[reg] = words[count++];
+      }
+    }
+  }
+}
+
+/**
+ * @brief Executes a single or block data transfer instruction.
+ *
+ * @param machine The current system state.
+ * @param instruction The decoded instruction, of type SDT or BDT.
+ */
+void execute_transfer(system_state_t *machine, instruction_t *instruction) {
+  if (instruction->type == BDT) {
+    execute_bdt(machine, instruction);
   } else {
-    // Execute store (sets word in memory)
-    set_word(machine, address, machine->registers[instruction->rd]);
+    execute_sdt(machine, instruction);
   }
 }
 
 /**
  * @brief Executes a branch instruction.
  *
+ * A branch with link writes the address of the next instruction to LR.
  * @param machine The current system state.
+ * @param instruction The decoded instruction.
  */
-void execute_branch(system_state_t *machine) {
-  word_t offset = machine->decoded_instruction->immediate_value;
+void execute_branch(system_state_t *machine, instruction_t *instruction) {
+  word_t offset = instruction->immediate_value;
+  if (instruction->flag_3) {
+    machine->registers[LR] = machine->registers[PC] - 4;
+  }
   // Previously fetched instruction not valid, so ignored
   machine->has_fetched_instruction = false;
   // Update system state by changing PC to new address
@@ -6,11 +6,30 @@
 #ifndef EXECUTE_H
 #define EXECUTE_H
 #include "../toolbox.h"
+#include "dpi_variants.h"
 
+extern const bool CONDITION_TABLE[NUM_CONDITIONS][16];
+
+int condition(system_state_t *machine, instruction_t *instruction);
 void execute(system_state_t *machine);
-void execute_dpi(system_state_t *machine);
-void execute_mul(system_state_t *machine);
-void execute_branch(system_state_t *machine);
-void execute_sdt(system_state_t *machine);
+void execute_instruction(system_state_t *machine, instruction_t *instruction);
+word_t operand2(system_state_t *machine, instruction_t *instruction,
+                bool *carry);
+void set_flags(system_state_t *machine, word_t result, bool carry);
+void set_arithmetic_flags(system_state_t *machine, word_t op1, word_t op2,
+                          word_t result, bool subtract);
+void set_dpi_flags(system_state_t *machine, opcode_t operation, word_t op1,
+                   word_t op2, word_t result, bool carry);
+word_t alu(system_state_t *machine, opcode_t operation, word_t op1,
+           word_t op2);
+bool writes_result(opcode_t operation);
+bool writes_pc(instruction_t *instruction);
+void indirect_branch(system_state_t *machine);
+void execute_dpi(system_state_t *machine, instruction_t *instruction);
+void execute_mul(system_state_t *machine, instruction_t *instruction);
+void execute_branch(system_state_t *machine, instruction_t *instruction);
+void execute_sdt(system_state_t *machine, instruction_t *instruction);
+void execute_bdt(system_state_t *machine, instruction_t *instruction);
+void execute_transfer(system_state_t *machine, instruction_t *instruction);
 
 #endif
@@ -0,0 +1,416 @@
+/**
+ * @file fusion.c
+ * @brief Functions for fusing adjacent micro-ops of a block into
+ * superinstructions.
+ *
+ * Once a block has been interpreted FUSE_THRESHOLD times, every place in it
+ * where the pattern of a superinstruction matches is added to the block
+ * cache's profile, weighted by the number of runs. Only superinstructions
+ * which make up at least 1 in PROFILE_SHARE of the profile are used, so the
+ * set in use follows the program being run. The block is then covered by the
+ * superinstructions in use so as to save the most dispatches, preferring the
+ * more frequent superinstructions where coverings save as many. Micro-ops
+ * which are not covered are run one at a time as before.
+ *
+ * A superinstruction runs its micro-ops without dispatching on their type or
+ * checking their condition, as every micro-op fused is unconditional. Those
+ * which end the block decide the branch straight from the flags set by their
+ * test, without writing the flags to CPSR first. Each micro-op still sees PC
+ * as the address of its instruction plus 8, so the state is exactly as if the
+ * micro-ops were run one at a time.
+ */
+
+#include "fusion.h"
+
+/** The inverse of the smallest share of the profile which is fused. */
+#define PROFILE_SHARE 64
+
+/** A handler which runs a superinstruction. */
+typedef block_result_t (*superinstruction_handler_t)(system_state_t *machine,
+                                                     block_t *block,
+                                                     micro_op_t *op,
+                                                     uint32_t address);
+
+/** Names a superinstruction, as a string. */
+#define NAME(name, length, ends_block) #name,
+/** Gives the length of a superinstruction. */
+#define LENGTH(name, length, ends_block) length,
+/** Gives whether a superinstruction ends its block. */
+#define ENDS_BLOCK(name, length, ends_block) ends_block,
+/** Declares the handler for a superinstruction. */
+#define DECLARE_HANDLER(name, length, ends_block) \
+  static block_result_t run_##name(system_state_t *machine, block_t *block, \
+                                   micro_op_t *op, uint32_t address);
+/** Lists the handler for a superinstruction. */
+#define LIST_HANDLER(name, length, ends_block) run_##name,
+
+/** The name of each superinstruction. */
+const char *SUPERINSTRUCTION_NAMES[NUM_SUPERINSTRUCTIONS] = {
+  SUPERINSTRUCTIONS(NAME)
+};
+/** The number of micro-ops fused by each superinstruction. */
+const size_t SUPERINSTRUCTION_LENGTHS[NUM_SUPERINSTRUCTIONS] = {
+  SUPERINSTRUCTIONS(LENGTH)
+};
+/** Whether each superinstruction also runs the branch ending its block. */
+const bool SUPERINSTRUCTION_ENDS_BLOCK[NUM_SUPERINSTRUCTIONS] = {
+  SUPERINSTRUCTIONS(ENDS_BLOCK)
+};
+
+SUPERINSTRUCTIONS(DECLARE_HANDLER)
+static bool matches(superinstruction_t super, block_t *block, size_t index);
+static bool is_alu(micro_op_t *op);
+static bool is_test(micro_op_t *op);
+static bool is_transfer(micro_op_t *op, bool load);
+static size_t dispatches_saved(superinstruction_t super);
+
+/** The handler for each superinstruction. */
+static const superinstruction_handler_t handlers[NUM_SUPERINSTRUCTIONS] = {
+  SUPERINSTRUCTIONS(LIST_HANDLER)
+};
+
+#undef NAME
+#undef LENGTH
+#undef ENDS_BLOCK
+#undef DECLARE_HANDLER
+#undef LIST_HANDLER
+
+/**
+ * @brief Profiles a hot block, and fuses its micro-ops into
+ * superinstructions.
+ *
+ * @param cache The block cache, holding the profile.
+ * @param block The block, which has not been fused.
+ */
+void fuse_block(block_cache_t *cache, block_t *block) {
+  bool matched[MAX_BLOCK_LENGTH][NUM_SUPERINSTRUCTIONS];
+  bool used[NUM_SUPERINSTRUCTIONS];
+  uint64_t total = 0;
+
+  // Add every match to the profile
+  for (size_t i = 0; i < block->length; i++) {
+    for (int super = 0; super < NUM_SUPERINSTRUCTIONS; super++) {
+      matched[i][super] = matches(super, block, i);
+      if (matched[i][super]) {
+        cache->profile[super] += block->count;
+      }
+    }
+  }
+  for (int super = 0; super < NUM_SUPERINSTRUCTIONS; super++) {
+    total += cache->profile[super];
+  }
+  for (int super = 0; super < NUM_SUPERINSTRUCTIONS; super++) {
+    used[super] = cache->profile[super] * PROFILE_SHARE >= total;
+  }
+
+  // The best covering of the micro-ops from each index to the end, found from
+  // the end backwards: the dispatches it saves, the profile counts of its
+  // superinstructions, and the superinstruction starting at the index
+  size_t saved[MAX_BLOCK_LENGTH + 1] = {0};
+  uint64_t frequency[MAX_BLOCK_LENGTH + 1] = {0};
+  superinstruction_t choice[MAX_BLOCK_LENGTH];
+  for (size_t i = block->length; i-- > 0;) {
+    saved[i] = saved[i + 1];
+    frequency[i] = frequency[i + 1];
+    choice[i] = NO_SUPERINSTRUCTION;
+    for (int super = 0; super < NUM_SUPERINSTRUCTIONS; super++) {
+      if (!matched[i][super] || !used[super]) {
+        continue;
+      }
+      size_t end = i + SUPERINSTRUCTION_LENGTHS[super];
+      size_t super_saved = dispatches_saved(super) + saved[end];
+      uint64_t super_frequency = cache->profile[super] + frequency[end];
+      if (super_saved > saved[i]
+        || (super_saved == saved[i] && super_frequency > frequency[i])) {
+        saved[i] = super_saved;
+        frequency[i] = super_frequency;
+        choice[i] = super;
+      }
+    }
+  }
+
+  for (size_t i = 0; i < block->length; i++) {
+    if (choice[i] != NO_SUPERINSTRUCTION) {
+      block->ops[i].fused = choice[i];
+      cache->fused_sites[choice[i]]++;
+      i += SUPERINSTRUCTION_LENGTHS[choice[i]] - 1;
+    }
+  }
+}
+
+/**
+ * @brief Runs the superinstruction starting at a micro-op.
+ *
+ * @param machine The current system state.
+ * @param block The block holding the micro-op.
+ * @param op The micro-op, which starts a superinstruction.
+ * @param address The address of the micro-op's instruction.
+ * @returns LEAVE_BLOCK if the block must be left, otherwise how the block is
+ * left if the superinstruction ends the block, or NEXT_BLOCK if not.
+ */
+block_result_t run_superinstruction(system_state_t *machine, block_t *block,
+                                    micro_op_t *op, uint32_t address) {
+  if (machine->block_cache) {
+    machine->block_cache->fused_runs[op->fused]++;
+  }
+  return handlers[op->fused](machine, block, op, address);
+}
+
+/**
+ * @brief Runs a data processing micro-op.
+ *
+ * @param machine The current system state.
+ * @param op The micro-op.
+ * @param address The address of the instruction.
+ */
+static inline void run_alu(system_state_t *machine, micro_op_t *op,
+                           uint32_t address) {
+  machine->registers[PC] = address + 8;
+  run_dpi(machine, op);
+}
+
+/**
+ * @brief Runs a load micro-op.
+ *
+ * @param machine The current system state.
+ * @param op The micro-op.
+ * @param address The address of the instruction.
+ */
+static inline void run_load(system_state_t *machine, micro_op_t *op,
+                            uint32_t address) {
+  machine->registers[PC] = address + 8;
+  execute_sdt(machine, &op->instruction);
+}
+
+/**
+ * @brief Runs a store micro-op.
+ *
+ * @param machine The current system state.
+ * @param op The micro-op.
+ * @param address The address of the instruction.
+ * @returns Whether the block must be left, as the store wrote to code.
+ */
+static inline bool run_store(system_state_t *machine, micro_op_t *op,
+                             uint32_t address) {
+  machine->registers[PC] = address + 8;
+  return run_transfer(machine, &op->instruction, address);
+}
+
+/**
+ * @brief Runs a test micro-op, and the branch ending its block.
+ *
+ * @param machine The current system state.
+ * @param block The block.
+ * @param op The micro-op, which is the last of the block.
+ * @param address The address of the instruction.
+ * @returns How the block is left.
+ */
+static inline block_result_t run_test_branch(system_state_t *machine,
+                                             block_t *block, micro_op_t *op,
+                                             uint32_t address) {
+  instruction_t *instruction = &op->instruction;
+  word_t *registers = machine->registers;
+
+  registers[PC] = address + 8;
+  word_t op1 = registers[instruction->rn];
+  word_t result = alu(machine, instruction->operation, op1, op->operand);
+  if (op->writes_result) {
+    registers[instruction->rd] = result;
+  }
+  set_dpi_flags(machine, instruction->operation, op1, op->operand, result,
+                op->carry);
+
+  registers[PC] = block->exit_address + 8;
+  if (CONDITION_TABLE[block->exit_instruction.cond]
+                     [pending_flags(machine)]) {
+    return TAKEN_BLOCK;
+  }
+  return NEXT_BLOCK;
+}
+
+/**
+ * @brief Runs two data processing micro-ops.
+ *
+ * @param machine The current system state.
+ * @param block The block.
+ * @param op The first micro-op.
+ * @param address The address of the first instruction.
+ * @returns NEXT_BLOCK.
+ */
+static block_result_t run_ALU_ALU(system_state_t *machine, block_t *block,
+                                  micro_op_t *op, uint32_t address) {
+  run_alu(machine, op, address);
+  run_alu(machine, op + 1, address + 4);
+  return NEXT_BLOCK;
+}
+
+/**
+ * @brief Runs a load, then a data processing micro-op.
+ *
+ * @param machine The current system state.
+ * @param block The block.
+ * @param op The first micro-op.
+ * @param address The address of the first instruction.
+ * @returns NEXT_BLOCK.
+ */
+static block_result_t run_LOAD_ALU(system_state_t *machine, block_t *block,
+                                   micro_op_t *op, uint32_t address) {
+  run_load(machine, op, address);
+  run_alu(machine, op + 1, address + 4);
+  return NEXT_BLOCK;
+}
+
+/**
+ * @brief Runs a data processing micro-op, then a store.
+ *
+ * @param machine The current system state.
+ * @param block The block.
+ * @param op The first micro-op.
+ * @param address The address of the first instruction.
+ * @returns LEAVE_BLOCK if the store wrote to code, otherwise NEXT_BLOCK.
+ */
+static block_result_t run_ALU_STORE(system_state_t *machine, block_t *block,
+                                    micro_op_t *op, uint32_t address) {
+  run_alu(machine, op, address);
+  if (run_store(machine, op + 1, address + 4)) {
+    return LEAVE_BLOCK;
+  }
+  return NEXT_BLOCK;
+}
+
+/**
+ * @brief Runs a load, a data processing micro-op, then a store.
+ *
+ * @param machine The current system state.
+ * @param block The block.
+ * @param op The first micro-op.
+ * @param address The address of the first instruction.
+ * @returns LEAVE_BLOCK if the store wrote to code, otherwise NEXT_BLOCK.
+ */
+static block_result_t run_LOAD_ALU_STORE(system_state_t *machine,
+                                         block_t *block, micro_op_t *op,
+                                         uint32_t address) {
+  run_load(machine, op, address);
+  run_alu(machine, op + 1, address + 4);
+  if (run_store(machine, op + 2, address + 8)) {
+    return LEAVE_BLOCK;
+  }
+  return NEXT_BLOCK;
+}
+
+/**
+ * @brief Runs a test (such as cmp), then the branch ending the block.
+ *
+ * @param machine The current system state.
+ * @param block The block.
+ * @param op The micro-op.
+ * @param address The address of the instruction.
+ * @returns How the block is left.
+ */
+static block_result_t run_TEST_BRANCH(system_state_t *machine, block_t *block,
+                                      micro_op_t *op, uint32_t address) {
+  return run_test_branch(machine, block, op, address);
+}
+
+/**
+ * @brief Runs a data processing micro-op, a test, then the branch ending the
+ * block, such as a decrement, compare and branch.
+ *
+ * @param machine The current system state.
+ * @param block The block.
+ * @param op The first micro-op.
+ * @param address The address of the first instruction.
+ * @returns How the block is left.
+ */
+static block_result_t run_ALU_TEST_BRANCH(system_state_t *machine,
+                                          block_t *block, micro_op_t *op,
+                                          uint32_t address) {
+  run_alu(machine, op, address);
+  return run_test_branch(machine, block, op + 1, address + 4);
+}
+
+/**
+ * @brief Returns whether the pattern of a superinstruction matches the
+ * micro-ops of a block starting at an index.
+ *
+ * @param super The superinstruction.
+ * @param block The block.
+ * @param index The index of the first micro-op.
+ * @returns Whether the pattern matches.
+ */
+static bool matches(superinstruction_t super, block_t *block, size_t index) {
+  micro_op_t *ops = &block->ops[index];
+  size_t end = index + SUPERINSTRUCTION_LENGTHS[super];
+
+  if (end > block->length) {
+    return false;
+  }
+  if (SUPERINSTRUCTION_ENDS_BLOCK[super]
+    && (end != block->length || block->exit != BRANCH_EXIT)) {
+    return false;
+  }
+
+  switch (super) {
+    case ALU_ALU_SUPER:
+      return is_alu(&ops[0]) && is_alu(&ops[1]);
+    case LOAD_ALU_SUPER:
+      return is_transfer(&ops[0], true) && is_alu(&ops[1]);
+    case ALU_STORE_SUPER:
+      return is_alu(&ops[0]) && is_transfer(&ops[1], false);
+    case LOAD_ALU_STORE_SUPER:
+      return is_transfer(&ops[0], true) && is_alu(&ops[1])
+             && is_transfer(&ops[2], false);
+    case TEST_BRANCH_SUPER:
+      return is_test(&ops[0]);
+    case ALU_TEST_BRANCH_SUPER:
+      return is_alu(&ops[0]) && is_test(&ops[1]);
+    default:
+      return false;
+  }
+}
+
+/**
+ * @brief Returns whether a micro-op is an unconditional data processing
+ * instruction.
+ *
+ * @param op The micro-op.
+ * @returns Whether the micro-op can be fused as ALU.
+ */
+static bool is_alu(micro_op_t *op) {
+  return op->type == DPI_OP && op->instruction.cond == AL;
+}
+
+/**
+ * @brief Returns whether a micro-op is an unconditional data processing
+ * instruction with an immediate operand, which sets the flags.
+ *
+ * @param op The micro-op.
+ * @returns Whether the micro-op can be fused as TEST.
+ */
+static bool is_test(micro_op_t *op) {
+  return is_alu(op) && op->resolved_operand && op->instruction.flag_1;
+}
+
+/**
+ * @brief Returns whether a micro-op is an unconditional load or store.
+ *
+ * @param op The micro-op.
+ * @param load Whether a load (rather than a store) is wanted.
+ * @returns Whether the micro-op can be fused as LOAD (or STORE).
+ */
+static bool is_transfer(micro_op_t *op, bool load) {
+  return op->type == SDT_OP && op->instruction.cond == AL
+         && op->instruction.flag_3 == load;
+}
+
+/**
+ * @brief Returns the number of dispatches a superinstruction saves over
+ * running its micro-ops (and branch) one at a time.
+ *
+ * @param super The superinstruction.
+ * @returns The number of dispatches saved.
+ */
+static size_t dispatches_saved(superinstruction_t super) {
+  return SUPERINSTRUCTION_LENGTHS[super] + SUPERINSTRUCTION_ENDS_BLOCK[super]
+         - 1;
+}
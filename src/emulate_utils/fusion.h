@@ -0,0 +1,21 @@
+/**
+ * @file fusion.h
+ * @brief Header file for fusion.c.
+ */
+
+#ifndef FUSION_H
+#define FUSION_H
+#include "block.h"
+
+/** The number of times a block is interpreted before it is fused. */
+#define FUSE_THRESHOLD 8
+
+extern const char *SUPERINSTRUCTION_NAMES[NUM_SUPERINSTRUCTIONS];
+extern const size_t SUPERINSTRUCTION_LENGTHS[NUM_SUPERINSTRUCTIONS];
+extern const bool SUPERINSTRUCTION_ENDS_BLOCK[NUM_SUPERINSTRUCTIONS];
+
+void fuse_block(block_cache_t *cache, block_t *block);
+block_result_t run_superinstruction(system_state_t *machine, block_t *block,
+                                    micro_op_t *op, uint32_t address);
+
+#endif
@@ -0,0 +1,89 @@
+/**
+ * @file gpio.c
+ * @brief The GPIO registers, as a memory-mapped device.
+ *
+ * The access registers may be read and written, and report the pins they
+ * control. The set and clear registers may only be written, and report the
+ * pin turning on or off. Nothing is printed if the machine is quiet.
+ */
+
+#include "gpio.h"
+#include "writer.h"
+
+static bool read_gpio(system_state_t *machine, uint32_t mem_address,
+                      word_t *word);
+static bool write_gpio(system_state_t *machine, uint32_t mem_address,
+                       word_t word);
+static void print_pins(system_state_t *machine, uint32_t mem_address);
+
+/** The GPIO registers, from the access registers to the clear register. */
+const device_t GPIO_DEVICE = {
+  .name = "gpio",
+  .start = GPIO_ACCESS_START,
+  .size = GPIO_CLEAR_START + GPIO_CLEAR_SIZE - GPIO_ACCESS_START,
+  .read = read_gpio,
+  .write = write_gpio,
+};
+
+/**
+ * @brief Reads a GPIO register.
+ *
+ * Reading an access register gives its address.
+ * @param machine The current system state.
+ * @param mem_address The address read from.
+ * @param word Where to write the word which was read.
+ * @returns Whether the address is an access register.
+ */
+static bool read_gpio(system_state_t *machine, uint32_t mem_address,
+                      word_t *word) {
+  if (mem_address < GPIO_ACCESS_START + GPIO_ACCESS_SIZE) {
+    print_pins(machine, mem_address);
+    *word = mem_address;
+    return true;
+  }
+  return false;
+}
+
+/**
+ * @brief Writes a GPIO register.
+ *
+ * @param machine The current system state.
+ * @param mem_address The address written to.
+ * @param word The word written, which is ignored.
+ * @returns Whether the address is an access, set or clear register.
+ */
+static bool write_gpio(system_state_t *machine, uint32_t mem_address,
+                       word_t word) {
+  if (mem_address < GPIO_ACCESS_START + GPIO_ACCESS_SIZE) {
+    print_pins(machine, mem_address);
+  } else if (mem_address >= GPIO_CLEAR_START
+    && mem_address < GPIO_CLEAR_START + GPIO_CLEAR_SIZE) {
+    // GPIO pin cleared
+    if (!machine->quiet) {
+      writer_print("PIN OFF\n");
+    }
+  } else if (mem_address >= GPIO_SET_START
+    && mem_address < GPIO_SET_START + GPIO_SET_SIZE) {
+    // GPIO pin set
+    if (!machine->quiet) {
+      writer_print("PIN ON\n");
+    }
+  } else {
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Prints the pins controlled by an access register.
+ *
+ * @param machine The current system state.
+ * @param mem_address The address of the access register.
+ */
+static void print_pins(system_state_t *machine, uint32_t mem_address) {
+  if (!machine->quiet) {
+    writer_printf("One GPIO pin from %u to %u has been accessed\n",
+                  (mem_address - GPIO_ACCESS_START) / 4 * 10,
+                  (mem_address - GPIO_ACCESS_START) / 4 * 10 + 9);
+  }
+}
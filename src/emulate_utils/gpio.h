@@ -0,0 +1,12 @@
+/**
+ * @file gpio.h
+ * @brief Header file for gpio.c.
+ */
+
+#ifndef GPIO_H
+#define GPIO_H
+#include "mmio.h"
+
+extern const device_t GPIO_DEVICE;
+
+#endif
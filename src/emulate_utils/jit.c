@@ -0,0 +1,820 @@
+/**
+ * @file jit.c
+ * @brief A compiler from translated blocks to native x86-64 code.
+ *
+ * Each micro-op is compiled on its own. Registers are loaded from and stored
+ * to the system state around every instruction, with RBX holding the machine.
+ * Data processing and multiply instructions are compiled inline, and the
+ * condition of the exit branch is compiled into the choice of next block.
+ * Single and block data transfers call run_transfer, and anything else calls
+ * execute_instruction (through run_generic), so memory accesses behave exactly
+ * as in the interpreter. Native code keeps the flags in CPSR up to date, rather
+ * than leaving them pending as the interpreter does.
+ *
+ * Native code is written to an mmap'd buffer, which is only writable while a
+ * block is being compiled.
+ */
+
+#include "jit.h"
+
+#ifdef JIT_SUPPORTED
+#include <stddef.h>
+#include <sys/mman.h>
+
+/** The N flag, as a bit of CPSR. */
+#define N_BIT ((word_t) N << (WORD_SIZE - 4))
+/** The Z flag, as a bit of CPSR. */
+#define Z_BIT ((word_t) Z << (WORD_SIZE - 4))
+/** The C flag, as a bit of CPSR. */
+#define C_BIT ((word_t) C << (WORD_SIZE - 4))
+/** The V flag, as a bit of CPSR. */
+#define V_BIT ((word_t) V << (WORD_SIZE - 4))
+/** The alignment of the start of each block, in bytes. */
+#define CODE_ALIGNMENT 16
+
+/**
+ * @brief An enum that identifies an x86-64 register, by its encoding.
+ */
+typedef enum {
+  EAX = 0,
+  ECX = 1,
+  EDX = 2,
+  EBX = 3,
+  ESI = 6,
+  EDI = 7,
+} x86_register_t;
+
+/**
+ * @brief An enum that identifies an x86-64 opcode used by the compiler.
+ */
+typedef enum {
+  /** Or r/m32 with r32. */
+  OR_RR = 0x09,
+  /** And r/m32 with r32. */
+  AND_RR = 0x21,
+  /** Subtract r32 from r/m32. */
+  SUB_RR = 0x29,
+  /** Exclusive or r/m32 with r32. */
+  XOR_RR = 0x31,
+  /** Add r32 to r/m32. */
+  ADD_RR = 0x01,
+  /** Move r32 to r/m32. */
+  MOV_RR = 0x89,
+  /** Test r/m32 with r32. */
+  TEST_RR = 0x85,
+} x86_opcode_t;
+
+/**
+ * @brief An enum that identifies the operation of an x86-64 opcode extension.
+ */
+typedef enum {
+  /** Rotate right (shift group). */
+  ROR_EXT = 1,
+  /** Or (immediate group). */
+  OR_EXT = 1,
+  /** And (immediate group). */
+  AND_EXT = 4,
+  /** Shift left (shift group). */
+  SHL_EXT = 4,
+  /** Logical shift right (shift group). */
+  SHR_EXT = 5,
+  /** Arithmetic shift right (shift group). */
+  SAR_EXT = 7,
+} x86_extension_t;
+
+/**
+ * @brief An enum that identifies the condition of an x86-64 jump or set.
+ */
+typedef enum {
+  /** Overflow. */
+  JO = 0x0,
+  /** Carry set. */
+  JC = 0x2,
+  /** Carry clear. */
+  JNC = 0x3,
+  /** Zero. */
+  JZ = 0x4,
+} x86_condition_t;
+
+/**
+ * @brief A struct that holds the position in the buffer being written to.
+ */
+typedef struct {
+  /** The next byte to write. */
+  byte_t *next;
+  /** The end of the buffer. */
+  byte_t *end;
+  /** Whether the buffer ran out of space. */
+  bool overflow;
+} emitter_t;
+
+static void run_generic(system_state_t *machine, instruction_t *instruction);
+static bool is_native(micro_op_t *op);
+static void emit_op(emitter_t *e, micro_op_t *op, uint32_t address);
+static void emit_dpi(emitter_t *e, micro_op_t *op);
+static void emit_mul(emitter_t *e, instruction_t *instruction);
+static void emit_flags(emitter_t *e, bool arithmetic);
+static byte_t *emit_condition(emitter_t *e, condition_t cond);
+static void emit_call(emitter_t *e, uintptr_t function, void *argument,
+                      uint32_t address);
+static void emit_return(emitter_t *e, block_result_t result);
+static void emit_load(emitter_t *e, x86_register_t reg, int arm_reg);
+static void emit_store(emitter_t *e, int arm_reg, x86_register_t reg);
+static void emit_store_immediate(emitter_t *e, int arm_reg, word_t value);
+static void emit_register_operand(emitter_t *e, byte_t opcode,
+                                  int reg, int arm_reg);
+static void emit_move_immediate(emitter_t *e, x86_register_t reg,
+                                word_t value);
+static void emit_rr(emitter_t *e, x86_opcode_t opcode, x86_register_t dst,
+                    x86_register_t src);
+static void emit_ri(emitter_t *e, x86_extension_t operation,
+                    x86_register_t reg, word_t value);
+static void emit_bit_test(emitter_t *e, x86_register_t reg,
+                          x86_register_t bit);
+static void emit_shift(emitter_t *e, x86_extension_t operation,
+                       x86_register_t reg, byte_t amount);
+static void emit_set(emitter_t *e, x86_condition_t cond,
+                     x86_register_t reg);
+static byte_t *emit_jump(emitter_t *e, x86_condition_t cond);
+static void patch_jump(emitter_t *e, byte_t *jump);
+static void emit_word(emitter_t *e, word_t word);
+static void emit_byte(emitter_t *e, byte_t byte);
+
+/**
+ * @brief Creates an empty buffer for native code.
+ *
+ * @returns The buffer, or NULL if it cannot be mapped.
+ */
+jit_buffer_t *create_jit_buffer(void) {
+  jit_buffer_t *jit = malloc(sizeof(jit_buffer_t));
+  if (!jit) {
+    return NULL;
+  }
+
+  jit->code = mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_EXEC,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (jit->code == MAP_FAILED) {
+    free(jit);
+    return NULL;
+  }
+  jit->size = JIT_BUFFER_SIZE;
+  jit->used = 0;
+  jit->full = false;
+  return jit;
+}
+
+/**
+ * @brief Frees a buffer of native code.
+ *
+ * @param jit The buffer, or NULL.
+ */
+void free_jit_buffer(jit_buffer_t *jit) {
+  if (jit) {
+    munmap(jit->code, jit->size);
+    free(jit);
+  }
+}
+
+/**
+ * @brief Removes all native code from a buffer.
+ *
+ * @param jit The buffer.
+ */
+void reset_jit_buffer(jit_buffer_t *jit) {
+  jit->used = 0;
+  jit->full = false;
+}
+
+/**
+ * @brief Compiles a block to native code.
+ *
+ * Only blocks which continue at another block can be compiled, as the others
+ * must hand back to the pipeline through the interpreter. If the native code
+ * does not fit, jit->full is set, and the block can be compiled again once
+ * the buffer has been reset.
+ * @param jit The buffer to write the native code to.
+ * @param block The block to compile.
+ * @returns The native code, or NULL if the block cannot be compiled.
+ */
+native_block_t compile_block(jit_buffer_t *jit, block_t *block) {
+  if (block->exit != NEXT_EXIT && block->exit != BRANCH_EXIT) {
+    return NULL;
+  }
+  if (mprotect(jit->code, jit->size, PROT_READ | PROT_WRITE)) {
+    return NULL;
+  }
+
+  emitter_t e = {jit->code + jit->used, jit->code + jit->size, false};
+  while ((e.next - jit->code) % CODE_ALIGNMENT) {
+    // int3
+    emit_byte(&e, 0xCC);
+  }
+  byte_t *start = e.next;
+
+  // push rbx; mov rbx, rdi
+  emit_byte(&e, 0x53);
+  emit_byte(&e, 0x48);
+  emit_rr(&e, MOV_RR, EBX, EDI);
+
+  uint32_t address = block->start;
+  for (size_t i = 0; i < block->length; i++, address += 4) {
+    emit_op(&e, &block->ops[i], address);
+  }
+
+  if (block->exit == NEXT_EXIT) {
+    emit_return(&e, NEXT_BLOCK);
+  } else {
+    emit_store_immediate(&e, PC, block->exit_address + 8);
+    if (block->exit_instruction.cond == AL) {
+      emit_return(&e, TAKEN_BLOCK);
+    } else {
+      byte_t *not_taken = emit_condition(&e, block->exit_instruction.cond);
+      emit_return(&e, TAKEN_BLOCK);
+      patch_jump(&e, not_taken);
+      emit_return(&e, NEXT_BLOCK);
+    }
+  }
+
+  if (mprotect(jit->code, jit->size, PROT_READ | PROT_EXEC)) {
+    perror("Unable to make native code executable");
+    exit(EXIT_FAILURE);
+  }
+  jit->full = e.overflow;
+  if (e.overflow) {
+    return NULL;
+  }
+  jit->used = e.next - jit->code;
+
+  native_block_t native = __extension__ (native_block_t) start;
+  return native;
+}
+
+/**
+ * @brief Returns whether a micro-op can be compiled inline.
+ *
+ * Data processing instructions which shift by a register, or which set the
+ * carry flag from a shift by 0, are left to the interpreter.
+ * @param op The micro-op.
+ * @returns Whether the micro-op can be compiled inline.
+ */
+static bool is_native(micro_op_t *op) {
+  instruction_t *instruction = &op->instruction;
+
+  switch (op->type) {
+    case DPI_OP:
+      switch (instruction->operation) {
+        case AND:
+        case EOR:
+        case TST:
+        case TEQ:
+        case ORR:
+        case MOV:
+          if (instruction->flag_1 && !op->resolved_operand
+            && instruction->shift_amount == 0) {
+            return false;
+          }
+          break;
+        case SUB:
+        case RSB:
+        case ADD:
+        case CMP:
+          break;
+        default:
+          return false;
+      }
+      return op->resolved_operand || instruction->rs == -1;
+    case MUL_OP:
+    case SDT_OP:
+    case BDT_OP:
+      return true;
+    case GENERIC_OP:
+    default:
+      return false;
+  }
+}
+
+/**
+ * @brief Executes an instruction which is not compiled, and writes its flags
+ * to CPSR for the native code which follows.
+ *
+ * @param machine The current system state.
+ * @param instruction The decoded instruction.
+ */
+static void run_generic(system_state_t *machine, instruction_t *instruction) {
+  execute_instruction(machine, instruction);
+  update_flags(machine);
+}
+
+/**
+ * @brief Compiles one micro-op.
+ *
+ * @param e The emitter.
+ * @param op The micro-op.
+ * @param address The address of the instruction.
+ */
+static void emit_op(emitter_t *e, micro_op_t *op, uint32_t address) {
+  instruction_t *instruction = &op->instruction;
+
+  emit_store_immediate(e, PC, address + 8);
+  if (!is_native(op)) {
+    emit_call(e, (uintptr_t) &run_generic, instruction, 0);
+    return;
+  }
+
+  byte_t *skip = NULL;
+  if (instruction->cond != AL) {
+    skip = emit_condition(e, instruction->cond);
+  }
+
+  switch (op->type) {
+    case DPI_OP:
+      emit_dpi(e, op);
+      break;
+    case MUL_OP:
+      emit_mul(e, instruction);
+      break;
+    case SDT_OP:
+    case BDT_OP:
+    default:
+      emit_call(e, (uintptr_t) &run_transfer, instruction, address);
+      // run_transfer returns a bool, so only AL is set
+      // test al, al; jz over the return
+      emit_byte(e, 0x84);
+      emit_byte(e, 0xC0);
+      emit_byte(e, 0x74);
+      emit_byte(e, 7);
+      emit_return(e, LEAVE_BLOCK);
+      break;
+  }
+
+  if (skip) {
+    patch_jump(e, skip);
+  }
+}
+
+/**
+ * @brief Compiles a data processing micro-op.
+ *
+ * The second operand is held in ECX, the shifter carry in EDX (as the C bit)
+ * and the result in EAX. The flags match set_flags, or set_arithmetic_flags,
+ * whose carry and overflow are those of the x86-64 add or sub (with the
+ * carry inverted for a subtraction, as ARM sets it when there is no borrow).
+ * @param e The emitter.
+ * @param op The micro-op.
+ */
+static void emit_dpi(emitter_t *e, micro_op_t *op) {
+  instruction_t *instruction = &op->instruction;
+  bool arithmetic = false;
+  // Only logical operations set the carry flag from the shifter
+  bool shifter_carry = instruction->flag_1
+                       && instruction->operation != SUB
+                       && instruction->operation != RSB
+                       && instruction->operation != ADD
+                       && instruction->operation != CMP;
+
+  // Second operand
+  if (op->resolved_operand) {
+    emit_move_immediate(e, ECX, op->operand);
+    if (shifter_carry) {
+      emit_move_immediate(e, EDX, op->carry ? C_BIT : 0);
+    }
+  } else {
+    emit_load(e, ECX, instruction->rm);
+    byte_t amount = instruction->shift_amount;
+    if (amount) {
+      if (shifter_carry) {
+        // The carry is the last bit shifted out
+        emit_rr(e, MOV_RR, EDX, ECX);
+        emit_shift(e, SHR_EXT, EDX,
+                   instruction->shift_type == LSL ? WORD_SIZE - amount
+                                                  : amount - 1);
+        emit_ri(e, AND_EXT, EDX, 1);
+        emit_shift(e, SHL_EXT, EDX, WORD_SIZE - 3);
+      }
+      switch (instruction->shift_type) {
+        case LSL:
+          emit_shift(e, SHL_EXT, ECX, amount);
+          break;
+        case LSR:
+          emit_shift(e, SHR_EXT, ECX, amount);
+          break;
+        case ASR:
+          emit_shift(e, SAR_EXT, ECX, amount);
+          break;
+        case ROR:
+        default:
+          emit_shift(e, ROR_EXT, ECX, amount);
+          break;
+      }
+    }
+  }
+
+  // Result
+  if (instruction->operation != MOV) {
+    emit_load(e, EAX, instruction->rn);
+  }
+  switch (instruction->operation) {
+    case AND:
+    case TST:
+      emit_rr(e, AND_RR, EAX, ECX);
+      break;
+    case EOR:
+    case TEQ:
+      emit_rr(e, XOR_RR, EAX, ECX);
+      break;
+    case ORR:
+      emit_rr(e, OR_RR, EAX, ECX);
+      break;
+    case MOV:
+      emit_rr(e, MOV_RR, EAX, ECX);
+      break;
+    case SUB:
+    case CMP:
+      emit_rr(e, MOV_RR, ESI, EAX);
+      emit_rr(e, SUB_RR, ESI, ECX);
+      arithmetic = true;
+      break;
+    case RSB:
+      emit_rr(e, MOV_RR, ESI, ECX);
+      emit_rr(e, SUB_RR, ESI, EAX);
+      arithmetic = true;
+      break;
+    case ADD:
+    default:
+      emit_rr(e, MOV_RR, ESI, EAX);
+      emit_rr(e, ADD_RR, ESI, ECX);
+      arithmetic = true;
+      break;
+  }
+  if (arithmetic) {
+    if (instruction->flag_1) {
+      // The C and V bits, from the flags of the add or sub
+      emit_set(e, instruction->operation == ADD ? JC : JNC, EDX);
+      emit_set(e, JO, ECX);
+      emit_shift(e, SHL_EXT, EDX, WORD_SIZE - 3);
+      emit_shift(e, SHL_EXT, ECX, WORD_SIZE - 4);
+      emit_rr(e, OR_RR, EDX, ECX);
+    }
+    emit_rr(e, MOV_RR, EAX, ESI);
+  }
+
+  if (op->writes_result) {
+    emit_store(e, instruction->rd, EAX);
+  }
+  if (instruction->flag_1) {
+    emit_flags(e, arithmetic);
+  }
+}
+
+/**
+ * @brief Compiles a multiply micro-op.
+ *
+ * @param e The emitter.
+ * @param instruction The decoded instruction.
+ */
+static void emit_mul(emitter_t *e, instruction_t *instruction) {
+  emit_load(e, EAX, instruction->rm);
+  // imul eax, [rs]
+  emit_byte(e, 0x0F);
+  emit_register_operand(e, 0xAF, EAX, instruction->rs);
+  if (instruction->flag_0) {
+    // add eax, [rn]
+    emit_register_operand(e, 0x03, EAX, instruction->rn);
+  }
+  emit_store(e, instruction->rd, EAX);
+
+  if (instruction->flag_1) {
+    emit_move_immediate(e, EDX, 0);
+    emit_flags(e, false);
+  }
+}
+
+/**
+ * @brief Compiles setting the flags from the result in EAX and the C bit in
+ * EDX (and the V bit, for an arithmetic instruction).
+ *
+ * @param e The emitter.
+ * @param arithmetic Whether EDX holds the V bit, which is otherwise left as
+ * it is in CPSR.
+ */
+static void emit_flags(emitter_t *e, bool arithmetic) {
+  emit_rr(e, MOV_RR, ESI, EAX);
+  emit_ri(e, AND_EXT, ESI, N_BIT);
+  emit_rr(e, OR_RR, ESI, EDX);
+  emit_rr(e, TEST_RR, EAX, EAX);
+  emit_set(e, JZ, ECX);
+  emit_shift(e, SHL_EXT, ECX, WORD_SIZE - 2);
+  emit_rr(e, OR_RR, ESI, ECX);
+  emit_load(e, ECX, CPSR);
+  emit_ri(e, AND_EXT, ECX, arithmetic ? MASK_FIRST_4 : MASK_FIRST_4 | V_BIT);
+  emit_rr(e, OR_RR, ECX, ESI);
+  emit_store(e, CPSR, ECX);
+}
+
+/**
+ * @brief Compiles a check of a condition against CPSR.
+ *
+ * The row of CONDITION_TABLE for the condition is packed into a 16 bit mask,
+ * and the bit for the flags nibble is tested.
+ * @param e The emitter.
+ * @param cond The condition, which must not be AL.
+ * @returns The jump taken when the condition is not met, to be patched.
+ */
+static byte_t *emit_condition(emitter_t *e, condition_t cond) {
+  word_t mask = 0;
+  for (int flags = 0; flags < 16; flags++) {
+    mask |= (word_t) CONDITION_TABLE[cond][flags] << flags;
+  }
+
+  emit_load(e, ECX, CPSR);
+  emit_shift(e, SHR_EXT, ECX, WORD_SIZE - 4);
+  emit_move_immediate(e, EAX, mask);
+  emit_bit_test(e, EAX, ECX);
+  return emit_jump(e, JNC);
+}
+
+/**
+ * @brief Compiles a call to a C function taking the machine, a pointer and an
+ * address.
+ *
+ * @param e The emitter.
+ * @param function The address of the function.
+ * @param argument The pointer argument.
+ * @param address The address argument.
+ */
+static void emit_call(emitter_t *e, uintptr_t function, void *argument,
+                      uint32_t address) {
+  uint64_t pointer = (uintptr_t) argument;
+
+  // mov rdi, rbx
+  emit_byte(e, 0x48);
+  emit_rr(e, MOV_RR, EDI, EBX);
+  // mov rsi, argument
+  emit_byte(e, 0x48);
+  emit_byte(e, 0xB8 | ESI);
+  emit_word(e, pointer);
+  emit_word(e, pointer >> 32);
+  emit_move_immediate(e, EDX, address);
+  // mov rax, function; call rax
+  emit_byte(e, 0x48);
+  emit_byte(e, 0xB8 | EAX);
+  emit_word(e, function);
+  emit_word(e, (uint64_t) function >> 32);
+  emit_byte(e, 0xFF);
+  emit_byte(e, 0xD0);
+}
+
+/**
+ * @brief Compiles returning from a block.
+ *
+ * @param e The emitter.
+ * @param result The value returned.
+ */
+static void emit_return(emitter_t *e, block_result_t result) {
+  // mov eax, result; pop rbx; ret
+  emit_move_immediate(e, EAX, result);
+  emit_byte(e, 0x5B);
+  emit_byte(e, 0xC3);
+}
+
+/**
+ * @brief Compiles loading an ARM register into an x86-64 register.
+ *
+ * @param e The emitter.
+ * @param reg The x86-64 register.
+ * @param arm_reg The ARM register.
+ */
+static void emit_load(emitter_t *e, x86_register_t reg, int arm_reg) {
+  emit_register_operand(e, 0x8B, reg, arm_reg);
+}
+
+/**
+ * @brief Compiles storing an x86-64 register to an ARM register.
+ *
+ * @param e The emitter.
+ * @param arm_reg The ARM register.
+ * @param reg The x86-64 register.
+ */
+static void emit_store(emitter_t *e, int arm_reg, x86_register_t reg) {
+  emit_register_operand(e, 0x89, reg, arm_reg);
+}
+
+/**
+ * @brief Compiles storing a constant to an ARM register.
+ *
+ * @param e The emitter.
+ * @param arm_reg The ARM register.
+ * @param value The constant.
+ */
+static void emit_store_immediate(emitter_t *e, int arm_reg, word_t value) {
+  emit_register_operand(e, 0xC7, 0, arm_reg);
+  emit_word(e, value);
+}
+
+/**
+ * @brief Compiles an instruction with an ARM register as its memory operand.
+ *
+ * The ARM register is addressed as [rbx + offset].
+ * @param e The emitter.
+ * @param opcode The last byte of the opcode.
+ * @param reg The register (or opcode extension) of the ModRM byte.
+ * @param arm_reg The ARM register.
+ */
+static void emit_register_operand(emitter_t *e, byte_t opcode,
+                                  int reg, int arm_reg) {
+  emit_byte(e, opcode);
+  emit_byte(e, 0x80 | (reg << 3) | EBX);
+  emit_word(e, offsetof(system_state_t, registers) + 4 * arm_reg);
+}
+
+/**
+ * @brief Compiles moving a constant into an x86-64 register.
+ *
+ * @param e The emitter.
+ * @param reg The register.
+ * @param value The constant.
+ */
+static void emit_move_immediate(emitter_t *e, x86_register_t reg,
+                                word_t value) {
+  emit_byte(e, 0xB8 | reg);
+  emit_word(e, value);
+}
+
+/**
+ * @brief Compiles an operation between two x86-64 registers.
+ *
+ * @param e The emitter.
+ * @param opcode The opcode.
+ * @param dst The destination register.
+ * @param src The source register.
+ */
+static void emit_rr(emitter_t *e, x86_opcode_t opcode, x86_register_t dst,
+                    x86_register_t src) {
+  emit_byte(e, opcode);
+  emit_byte(e, 0xC0 | (src << 3) | dst);
+}
+
+/**
+ * @brief Compiles an operation between an x86-64 register and a constant.
+ *
+ * @param e The emitter.
+ * @param operation The operation (AND_EXT or OR_EXT).
+ * @param reg The register.
+ * @param value The constant.
+ */
+static void emit_ri(emitter_t *e, x86_extension_t operation,
+                    x86_register_t reg, word_t value) {
+  emit_byte(e, 0x81);
+  emit_byte(e, 0xC0 | (operation << 3) | reg);
+  emit_word(e, value);
+}
+
+/**
+ * @brief Compiles copying a bit of an x86-64 register to the carry flag.
+ *
+ * @param e The emitter.
+ * @param reg The register tested.
+ * @param bit The register holding the number of the bit, from 0 to 31.
+ */
+static void emit_bit_test(emitter_t *e, x86_register_t reg,
+                          x86_register_t bit) {
+  emit_byte(e, 0x0F);
+  emit_byte(e, 0xA3);
+  emit_byte(e, 0xC0 | (bit << 3) | reg);
+}
+
+/**
+ * @brief Compiles a shift of an x86-64 register by a constant.
+ *
+ * @param e The emitter.
+ * @param operation The shift.
+ * @param reg The register.
+ * @param amount The amount to shift by, from 1 to 31.
+ */
+static void emit_shift(emitter_t *e, x86_extension_t operation,
+                       x86_register_t reg, byte_t amount) {
+  emit_byte(e, 0xC1);
+  emit_byte(e, 0xC0 | (operation << 3) | reg);
+  emit_byte(e, amount);
+}
+
+/**
+ * @brief Compiles setting an x86-64 register to 1 if a condition holds, and
+ * 0 otherwise.
+ *
+ * @param e The emitter.
+ * @param cond The condition.
+ * @param reg The register, which must have a low byte (EAX to EBX).
+ */
+static void emit_set(emitter_t *e, x86_condition_t cond,
+                     x86_register_t reg) {
+  // setcc reg8; movzx reg, reg8
+  emit_byte(e, 0x0F);
+  emit_byte(e, 0x90 | cond);
+  emit_byte(e, 0xC0 | reg);
+  emit_byte(e, 0x0F);
+  emit_byte(e, 0xB6);
+  emit_byte(e, 0xC0 | (reg << 3) | reg);
+}
+
+/**
+ * @brief Compiles a conditional jump, whose target is set by patch_jump.
+ *
+ * @param e The emitter.
+ * @param cond The condition.
+ * @returns The jump.
+ */
+static byte_t *emit_jump(emitter_t *e, x86_condition_t cond) {
+  emit_byte(e, 0x0F);
+  emit_byte(e, 0x80 | cond);
+  byte_t *jump = e->next;
+  emit_word(e, 0);
+  return jump;
+}
+
+/**
+ * @brief Sets the target of a jump to the next byte written.
+ *
+ * @param e The emitter.
+ * @param jump The jump, from emit_jump.
+ */
+static void patch_jump(emitter_t *e, byte_t *jump) {
+  if (e->overflow) {
+    return;
+  }
+  word_t offset = e->next - (jump + 4);
+  for (size_t i = 0; i < 4; i++) {
+    jump[i] = (byte_t) (offset & 0xFF);
+    offset >>= 8;
+  }
+}
+
+/**
+ * @brief Writes a little endian word of native code.
+ *
+ * @param e The emitter.
+ * @param word The word.
+ */
+static void emit_word(emitter_t *e, word_t word) {
+  for (size_t i = 0; i < 4; i++) {
+    emit_byte(e, (byte_t) (word & 0xFF));
+    word >>= 8;
+  }
+}
+
+/**
+ * @brief Writes a byte of native code.
+ *
+ * @param e The emitter.
+ * @param byte The byte.
+ */
+static void emit_byte(emitter_t *e, byte_t byte) {
+  if (e->next < e->end) {
+    *e->next++ = byte;
+  } else {
+    e->overflow = true;
+  }
+}
+
+#else
+
+/**
+ * @brief Creates an empty buffer for native code.
+ *
+ * @returns NULL, as native code is not supported on this host.
+ */
+jit_buffer_t *create_jit_buffer(void) {
+  return NULL;
+}
+
+/**
+ * @brief Frees a buffer of native code.
+ *
+ * @param jit The buffer, or NULL.
+ */
+void free_jit_buffer(jit_buffer_t *jit) {
+  free(jit);
+}
+
+/**
+ * @brief Removes all native code from a buffer.
+ *
+ * @param jit The buffer.
+ */
+void reset_jit_buffer(jit_buffer_t *jit) {
+  jit->used = 0;
+  jit->full = false;
+}
+
+/**
+ * @brief Compiles a block to native code.
+ *
+ * @param jit The buffer to write the native code to.
+ * @param block The block to compile.
+ * @returns NULL, as native code is not supported on this host.
+ */
+native_block_t compile_block(jit_buffer_t *jit, block_t *block) {
+  return NULL;
+}
+
+#endif
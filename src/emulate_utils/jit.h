@@ -0,0 +1,39 @@
+/**
+ * @file jit.h
+ * @brief A header to define the jit_buffer_t type, and header file for jit.c.
+ */
+
+#ifndef JIT_H
+#define JIT_H
+#include "block.h"
+
+#if defined(__x86_64__) && !defined(NO_JIT)
+/** Defined when blocks can be compiled to native code for the host. */
+#define JIT_SUPPORTED
+#endif
+
+/** The number of times a block is interpreted before it is compiled. */
+#define JIT_THRESHOLD 16
+/** The number of bytes of native code held before the buffer is full. */
+#define JIT_BUFFER_SIZE (4 * 1024 * 1024)
+
+/**
+ * @brief A struct that holds an executable buffer of native code.
+ */
+typedef struct jit_buffer {
+  /** The start of the buffer. */
+  byte_t *code;
+  /** The size of the buffer, in bytes. */
+  size_t size;
+  /** The number of bytes in use. */
+  size_t used;
+  /** Whether the last block compiled did not fit in the buffer. */
+  bool full;
+} jit_buffer_t;
+
+jit_buffer_t *create_jit_buffer(void);
+void free_jit_buffer(jit_buffer_t *jit);
+void reset_jit_buffer(jit_buffer_t *jit);
+native_block_t compile_block(jit_buffer_t *jit, block_t *block);
+
+#endif
@@ -0,0 +1,189 @@
+/**
+ * @file loop.c
+ * @brief Functions for fast-forwarding countdown loops.
+ *
+ * Delay loops such as
+ *
+ *     wait:
+ *     sub r2,r2,#1
+ *     cmp r2,#0
+ *     bne wait
+ *
+ * have no effect on memory, and each iteration steps their registers by a
+ * constant. The number of iterations until the counter reaches its exit value
+ * is found in closed form, and every iteration but the last is skipped. The
+ * last iteration is run as normal, which sets CPSR and leaves the loop exactly
+ * as running every iteration would.
+ */
+
+#include "loop.h"
+
+static bool is_counter_test(micro_op_t *op, int counter, word_t *exit_value);
+static bool remaining_iterations(word_t distance, word_t step,
+                                 uint64_t *iterations);
+
+/**
+ * @brief Finds whether a translated block is a countdown loop, and fills in
+ * its summary if so.
+ *
+ * The block must branch back to its start on NE, without link. Every
+ * instruction must be an unconditional data processing instruction with an
+ * immediate operand, and must be one of:
+ * * add or sub rd,rd,#imm, with each register stepped at most once,
+ * * mov rd,#imm,
+ * * cmp rn,#imm, or an add or sub which sets the flags.
+ * The last instruction which sets the flags tests the counter, which must
+ * have been stepped earlier in the loop.
+ * @param block The translated block.
+ */
+void summarise_loop(block_t *block) {
+  loop_summary_t *loop = &block->loop;
+  bool changed[NUM_REGISTERS] = {false};
+  micro_op_t *test = NULL;
+  bool stepped_before_test = false;
+
+  memset(loop, 0, sizeof(loop_summary_t));
+  if (block->exit != BRANCH_EXIT || block->taken_address != block->start
+    || block->exit_instruction.cond != NE || block->exit_instruction.flag_3) {
+    return;
+  }
+
+  for (size_t i = 0; i < block->length; i++) {
+    micro_op_t *op = &block->ops[i];
+    instruction_t *instruction = &op->instruction;
+    if (op->type != DPI_OP || !op->resolved_operand
+      || instruction->cond != AL || instruction->rn == PC) {
+      return;
+    }
+
+    switch (instruction->operation) {
+      case ADD:
+      case SUB:
+        if (instruction->rn != instruction->rd || changed[instruction->rd]) {
+          return;
+        }
+        changed[instruction->rd] = true;
+        loop->steps[instruction->rd] = instruction->operation == ADD
+                                         ? op->operand : -op->operand;
+        break;
+      case MOV:
+        if (changed[instruction->rd]) {
+          return;
+        }
+        changed[instruction->rd] = true;
+        if (instruction->flag_1) {
+          // The flags would not depend on the counter
+          return;
+        }
+        break;
+      case CMP:
+        break;
+      default:
+        return;
+    }
+    if (instruction->flag_1) {
+      test = op;
+      stepped_before_test = changed[instruction->rn];
+    }
+  }
+
+  if (test && stepped_before_test && loop->steps[test->instruction.rn]
+    && is_counter_test(test, test->instruction.rn, &loop->exit_value)) {
+    loop->counter = test->instruction.rn;
+    loop->valid = true;
+  }
+}
+
+/**
+ * @brief Skips all but the last iteration of a countdown loop.
+ *
+ * Does nothing if the block is not a countdown loop, or if the loop would not
+ * end. The number of instructions skipped is added to skipped_instructions,
+ * and to the instruction count.
+ * @param machine The current system state, at the start of the loop.
+ * @param block The translated block.
+ */
+void fast_forward_loop(system_state_t *machine, block_t *block) {
+  loop_summary_t *loop = &block->loop;
+  word_t *registers = machine->registers;
+  uint64_t iterations;
+
+  // The counter is tested after it is stepped, so the first test sees
+  // counter + step
+  word_t distance = loop->exit_value - registers[loop->counter];
+  if (!remaining_iterations(distance, loop->steps[loop->counter], &iterations)
+    || iterations < 2) {
+    return;
+  }
+
+  word_t skipped = (word_t) (iterations - 1);
+  for (int i = 0; i < NUM_REGISTERS; i++) {
+    registers[i] += skipped * loop->steps[i];
+  }
+  // Each iteration runs the micro-ops and the branch
+  uint64_t count = (iterations - 1) * (block->length + 1);
+  machine->skipped_instructions += count;
+  machine->instructions += count;
+}
+
+/**
+ * @brief Returns whether a micro-op sets the Z flag exactly when a counter
+ * register equals a value.
+ *
+ * @param op The micro-op, which sets the flags.
+ * @param counter The register tested.
+ * @param exit_value Set to the value of the counter which sets Z.
+ * @returns Whether the micro-op tests the counter.
+ */
+static bool is_counter_test(micro_op_t *op, int counter, word_t *exit_value) {
+  switch (op->instruction.operation) {
+    case CMP:
+      *exit_value = op->operand;
+      return true;
+    case ADD:
+    case SUB:
+      // Sets Z when the stepped counter is 0
+      *exit_value = 0;
+      return op->instruction.rd == counter;
+    default:
+      return false;
+  }
+}
+
+/**
+ * @brief Finds the smallest positive n such that n * step = distance, modulo
+ * 2^32.
+ *
+ * @param distance The distance from the counter to its exit value.
+ * @param step The amount the counter is stepped by each iteration.
+ * @param iterations Set to n.
+ * @returns Whether there is such an n, which is false when the loop would run
+ * forever.
+ */
+static bool remaining_iterations(word_t distance, word_t step,
+                                 uint64_t *iterations) {
+  // Remove the common powers of 2, leaving an odd step
+  int shift = 0;
+  while (!(step & 1)) {
+    if (distance & 1) {
+      return false;
+    }
+    step >>= 1;
+    distance >>= 1;
+    shift++;
+  }
+
+  // Newton's method for the inverse of an odd number, modulo 2^32
+  word_t inverse = step;
+  for (int i = 0; i < 5; i++) {
+    inverse *= 2 - step * inverse;
+  }
+
+  uint64_t period = (uint64_t) 1 << (WORD_SIZE - shift);
+  *iterations = (uint64_t) (distance * inverse) & (period - 1);
+  if (!*iterations) {
+    // The counter only returns to its exit value after wrapping around
+    *iterations = period;
+  }
+  return true;
+}
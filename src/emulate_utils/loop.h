@@ -0,0 +1,13 @@
+/**
+ * @file loop.h
+ * @brief Header file for loop.c.
+ */
+
+#ifndef LOOP_H
+#define LOOP_H
+#include "block.h"
+
+void summarise_loop(block_t *block);
+void fast_forward_loop(system_state_t *machine, block_t *block);
+
+#endif
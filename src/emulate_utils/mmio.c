@@ -0,0 +1,123 @@
+/**
+ * @file mmio.c
+ * @brief Functions for dispatching accesses outside memory to devices.
+ *
+ * Devices are found through a two-level page table: the top bits of an
+ * address select a table of the directory, which is allocated when a device
+ * is first registered in it, and the next MMIO_TABLE_BITS select the device
+ * owning the page. get_word and set_word only look a device up once an
+ * address is outside memory. The GPIO registers are registered as the
+ * default device the first time a device is looked up.
+ */
+
+#include "mmio.h"
+#include "gpio.h"
+
+static const device_t *find_device(uint32_t mem_address);
+static void register_default_devices(void);
+
+/** The tables of devices owning each page, or NULL where there are none. */
+static const device_t **directory[MMIO_DIRECTORY_SIZE];
+/** Whether the default devices have been registered. */
+static bool registered_defaults = false;
+
+/**
+ * @brief Maps the pages of a device to it.
+ *
+ * The device must outlive every machine which accesses it. Exits if the
+ * device lies inside memory, or shares a page with another device (including
+ * the default devices, which are registered first).
+ * @param device The device to register.
+ */
+void register_device(const device_t *device) {
+  if (!registered_defaults) {
+    register_default_devices();
+  }
+  if (device->start < MAX_MEMORY_SIZE || !device->size
+    || device->start + (device->size - 1) < device->start) {
+    fprintf(stderr, "Device %s does not fit above memory.\n", device->name);
+    exit(EXIT_FAILURE);
+  }
+
+  uint32_t first = device->start >> MMIO_PAGE_BITS;
+  uint32_t last = (device->start + (device->size - 1)) >> MMIO_PAGE_BITS;
+  for (uint32_t page = first; page <= last; page++) {
+    const device_t **table = directory[page >> MMIO_TABLE_BITS];
+    if (!table) {
+      table = calloc(MMIO_TABLE_SIZE, sizeof(device_t *));
+      if (!table) {
+        perror("Unable to allocate memory for a device table.\n");
+        exit(EXIT_FAILURE);
+      }
+      directory[page >> MMIO_TABLE_BITS] = table;
+    }
+
+    const device_t **entry = &table[page % MMIO_TABLE_SIZE];
+    if (*entry) {
+      fprintf(stderr, "Device %s shares a page with device %s.\n",
+              device->name, (*entry)->name);
+      exit(EXIT_FAILURE);
+    }
+    *entry = device;
+  }
+}
+
+/**
+ * @brief Reads a word from the device at an address.
+ *
+ * @param machine The current system state.
+ * @param mem_address The address to read from, outside memory.
+ * @param word Where to write the word which was read.
+ * @returns Whether a device read the word, or false if the access is out of
+ * bounds.
+ */
+bool device_read(system_state_t *machine, uint32_t mem_address, word_t *word) {
+  const device_t *device = find_device(mem_address);
+  return device && device->read && device->read(machine, mem_address, word);
+}
+
+/**
+ * @brief Writes a word to the device at an address.
+ *
+ * @param machine The current system state.
+ * @param mem_address The address to write to, outside memory.
+ * @param word The word to write.
+ * @returns Whether a device took the word, or false if the access is out of
+ * bounds.
+ */
+bool device_write(system_state_t *machine, uint32_t mem_address, word_t word) {
+  const device_t *device = find_device(mem_address);
+  return device && device->write && device->write(machine, mem_address, word);
+}
+
+/**
+ * @brief Returns the device whose range holds an address.
+ *
+ * @param mem_address The address.
+ * @returns The device, or NULL if no device holds the address.
+ */
+static const device_t *find_device(uint32_t mem_address) {
+  if (!registered_defaults) {
+    register_default_devices();
+  }
+
+  const device_t **table = directory[mem_address
+                                     >> (MMIO_PAGE_BITS + MMIO_TABLE_BITS)];
+  if (!table) {
+    return NULL;
+  }
+  const device_t *device = table[(mem_address >> MMIO_PAGE_BITS)
+                                 % MMIO_TABLE_SIZE];
+  if (!device || mem_address - device->start >= device->size) {
+    return NULL;
+  }
+  return device;
+}
+
+/**
+ * @brief Registers the devices which every machine has.
+ */
+static void register_default_devices(void) {
+  registered_defaults = true;
+  register_device(&GPIO_DEVICE);
+}
@@ -0,0 +1,67 @@
+/**
+ * @file mmio.h
+ * @brief A header to define the device_t type, and header file for mmio.c.
+ */
+
+#ifndef MMIO_H
+#define MMIO_H
+#include <stdio.h>
+#include <stdlib.h>
+#include "system_state.h"
+
+/** The number of bits of an address which select a byte of a device page. */
+#define MMIO_PAGE_BITS 12
+/** The number of bits of an address which select a device page. */
+#define MMIO_TABLE_BITS 8
+/** The number of device pages in a table of the directory. */
+#define MMIO_TABLE_SIZE (1 << MMIO_TABLE_BITS)
+/** The number of tables in the directory. */
+#define MMIO_DIRECTORY_SIZE (1 << (32 - MMIO_PAGE_BITS - MMIO_TABLE_BITS))
+
+/**
+ * @brief A function which reads a word from a device register.
+ *
+ * @param machine The current system state.
+ * @param mem_address The address read from, inside the device.
+ * @param word Where to write the word which was read.
+ * @returns Whether the address is a readable register of the device.
+ */
+typedef bool (*device_read_t)(system_state_t *machine, uint32_t mem_address,
+                              word_t *word);
+
+/**
+ * @brief A function which writes a word to a device register.
+ *
+ * @param machine The current system state.
+ * @param mem_address The address written to, inside the device.
+ * @param word The word written.
+ * @returns Whether the address is a writable register of the device.
+ */
+typedef bool (*device_write_t)(system_state_t *machine, uint32_t mem_address,
+                               word_t word);
+
+/**
+ * @brief A struct that describes a memory-mapped device.
+ *
+ * A device owns every page (of 1 << MMIO_PAGE_BITS bytes) which its range
+ * touches, and lies above MAX_MEMORY_SIZE, so above memory. Accesses to its
+ * pages outside its range, or which its callbacks reject, are out of bounds.
+ */
+typedef struct {
+  /** The name of the device, for messages. */
+  const char *name;
+  /** The first address of the device. */
+  uint32_t start;
+  /** The number of bytes of the device. */
+  uint32_t size;
+  /** Reads a register, or NULL if the device cannot be read. */
+  device_read_t read;
+  /** Writes a register, or NULL if the device cannot be written to. */
+  device_write_t write;
+} device_t;
+
+void register_device(const device_t *device);
+bool device_read(system_state_t *machine, uint32_t mem_address, word_t *word);
+bool device_write(system_state_t *machine, uint32_t mem_address, word_t word);
+
+#endif
@@ -0,0 +1,233 @@
+/**
+ * @file options.c
+ * @brief Functions for reading the emulator's command line options.
+ */
+
+#include "options.h"
+
+static bool parse_engine(char *name, engine_t *engine);
+static bool parse_output(char *name, output_t *output);
+static bool parse_limit(int argc, char **argv, int *i, char *name,
+                        uint64_t *limit, bool *valid);
+
+/**
+ * @brief Reads the command line options for the emulator.
+ *
+ * Exactly one argument which is not an option must be provided, which is the
+ * object code file to emulate. The following options are accepted:
+ * * --engine=step runs each instruction through the fetch, decode, execute
+ *   loop (default).
+ * * --engine=threaded runs through the direct-threaded interpreter.
+ * * --engine=block runs through the basic block translator.
+ * * --engine=jit runs through the basic block translator, and compiles hot
+ *   blocks to native code.
+ * * --verify-jit compiles every block, and checks each run of native code
+ *   against the interpreter. Requires --engine=jit.
+ * * --no-fast-forward runs every iteration of countdown loops, which are
+ *   otherwise skipped by the block and jit engines.
+ * * --report-skipped prints the number of instructions skipped by
+ *   fast-forwarding countdown loops to stderr.
+ * * --no-superinstructions runs every micro-op of a block on its own, rather
+ *   than fusing adjacent micro-ops of hot blocks into superinstructions.
+ * * --stats prints statistics on the block translator to stderr, including
+ *   the superinstruction profile.
+ * * --max-instructions N stops the program after about N instructions (at the
+ *   end of a block), with exit status EXIT_WATCHDOG.
+ * * --timeout-ms T stops the program after about T milliseconds, with exit
+ *   status EXIT_WATCHDOG.
+ * * --mem-size B gives the machine B bytes of memory (default NUM_ADDRESSES),
+ *   a multiple of MEMORY_PAGE_BYTES up to MAX_MEMORY_SIZE. Pages of memory
+ *   are only allocated when written to.
+ * * --output=compliant prints the final state in the format of the test
+ *   cases (default).
+ * * --output=verbose prints a trace of each cycle, then the final state in
+ *   detail, and stops on memory errors.
+ * * --output=silent prints nothing.
+ * * --output=binary writes the final registers then all of memory to stdout
+ *   as raw bytes, and prints nothing else.
+ * * --sync-output writes output straight to stdout, rather than buffering it
+ *   for the writer thread, which is easier to follow when debugging.
+ * * --trace prints the registers, memory and flags changed by each cycle, as
+ *   is always done for --output=verbose.
+ * * --snapshot-every N prints the whole state every N cycles of a trace, not
+ *   just the first.
+ *
+ * Options which take a value may be given as --option N or --option=N.
+ *
+ * Prints an error to stderr if the options are not valid.
+ * @param argc The number of arguments.
+ * @param argv The arguments.
+ * @param options The options to fill in.
+ * @returns Whether the options are valid.
+ */
+bool parse_options(int argc, char **argv, options_t *options) {
+  options->filename = NULL;
+  options->engine = STEP_ENGINE;
+  options->verify_jit = false;
+  options->fast_forward = true;
+  options->report_skipped = false;
+  options->fuse = true;
+  options->stats = false;
+  options->max_instructions = 0;
+  options->timeout_ms = 0;
+  options->mem_size = NUM_ADDRESSES;
+  options->output = COMPLIANT_OUTPUT;
+  options->sync_output = false;
+  options->trace = false;
+  options->snapshot_every = 0;
+
+  for (int i = 1; i < argc; i++) {
+    bool valid = true;
+    if (parse_limit(argc, argv, &i, "--max-instructions",
+                    &options->max_instructions, &valid)
+      || parse_limit(argc, argv, &i, "--timeout-ms", &options->timeout_ms,
+                     &valid)
+      || parse_limit(argc, argv, &i, "--mem-size", &options->mem_size,
+                     &valid)
+      || parse_limit(argc, argv, &i, "--snapshot-every",
+                     &options->snapshot_every, &valid)) {
+      if (!valid) {
+        return false;
+      }
+    } else if (!strncmp(argv[i], "--engine=", strlen("--engine="))) {
+      if (!parse_engine(argv[i] + strlen("--engine="), &options->engine)) {
+        fprintf(stderr, "Unknown engine: %s\n", argv[i]);
+        return false;
+      }
+    } else if (!strncmp(argv[i], "--output=", strlen("--output="))) {
+      if (!parse_output(argv[i] + strlen("--output="), &options->output)) {
+        fprintf(stderr, "Unknown output: %s\n", argv[i]);
+        return false;
+      }
+    } else if (!strcmp(argv[i], "--verify-jit")) {
+      options->verify_jit = true;
+    } else if (!strcmp(argv[i], "--no-fast-forward")) {
+      options->fast_forward = false;
+    } else if (!strcmp(argv[i], "--report-skipped")) {
+      options->report_skipped = true;
+    } else if (!strcmp(argv[i], "--no-superinstructions")) {
+      options->fuse = false;
+    } else if (!strcmp(argv[i], "--stats")) {
+      options->stats = true;
+    } else if (!strcmp(argv[i], "--sync-output")) {
+      options->sync_output = true;
+    } else if (!strcmp(argv[i], "--trace")) {
+      options->trace = true;
+    } else if (!strncmp(argv[i], "--", 2)) {
+      fprintf(stderr, "Unknown option: %s\n", argv[i]);
+      return false;
+    } else if (!options->filename) {
+      options->filename = argv[i];
+    } else {
+      fprintf(stderr, "Incorrect number of arguments provided.\n");
+      return false;
+    }
+  }
+
+  if (!options->filename) {
+    fprintf(stderr, "Incorrect number of arguments provided.\n");
+    return false;
+  }
+  if (options->mem_size < NUM_ADDRESSES || options->mem_size > MAX_MEMORY_SIZE
+    || options->mem_size % MEMORY_PAGE_BYTES) {
+    fprintf(stderr, "--mem-size must be a multiple of %d from %d to %d\n",
+            MEMORY_PAGE_BYTES, NUM_ADDRESSES, MAX_MEMORY_SIZE);
+    return false;
+  }
+  options->trace |= options->output == VERBOSE_OUTPUT;
+  if (options->verify_jit && options->engine != JIT_ENGINE) {
+    fprintf(stderr, "--verify-jit requires --engine=jit\n");
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Reads the name of an engine.
+ *
+ * @param name The name of the engine.
+ * @param engine Set to the engine with the given name.
+ * @returns Whether the name is a known engine.
+ */
+static bool parse_engine(char *name, engine_t *engine) {
+  if (!strcmp(name, "step")) {
+    *engine = STEP_ENGINE;
+  } else if (!strcmp(name, "threaded")) {
+    *engine = THREADED_ENGINE;
+  } else if (!strcmp(name, "block")) {
+    *engine = BLOCK_ENGINE;
+  } else if (!strcmp(name, "jit")) {
+    *engine = JIT_ENGINE;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Reads the name of an output format.
+ *
+ * @param name The name of the format.
+ * @param output Set to the format with the given name.
+ * @returns Whether the name is a known format.
+ */
+static bool parse_output(char *name, output_t *output) {
+  if (!strcmp(name, "compliant")) {
+    *output = COMPLIANT_OUTPUT;
+  } else if (!strcmp(name, "verbose")) {
+    *output = VERBOSE_OUTPUT;
+  } else if (!strcmp(name, "silent")) {
+    *output = SILENT_OUTPUT;
+  } else if (!strcmp(name, "binary")) {
+    *output = BINARY_OUTPUT;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Reads an option which sets a limit, if the argument is that option.
+ *
+ * The limit is given as a positive integer, either in the same argument after
+ * '=', or in the next argument.
+ * @param argc The number of arguments.
+ * @param argv The arguments.
+ * @param i The index of the argument, which is moved past the value if it is
+ * in the next argument.
+ * @param name The name of the option, such as "--timeout-ms".
+ * @param limit Set to the limit.
+ * @param valid Set to false, with an error printed, if the limit is not valid.
+ * @returns Whether the argument is the option.
+ */
+static bool parse_limit(int argc, char **argv, int *i, char *name,
+                        uint64_t *limit, bool *valid) {
+  size_t length = strlen(name);
+  char *value;
+
+  if (strncmp(argv[*i], name, length)) {
+    return false;
+  }
+  if (argv[*i][length] == '=') {
+    value = argv[*i] + length + 1;
+  } else if (!argv[*i][length] && *i + 1 < argc) {
+    value = argv[++*i];
+  } else if (!argv[*i][length]) {
+    fprintf(stderr, "%s requires a value\n", name);
+    *valid = false;
+    return true;
+  } else {
+    // A longer option which starts with the name
+    return false;
+  }
+
+  char *end;
+  unsigned long long parsed = strtoull(value, &end, 10);
+  if (!*value || *end || *value == '-' || !parsed) {
+    fprintf(stderr, "%s must be a positive integer: %s\n", name, value);
+    *valid = false;
+    return true;
+  }
+  *limit = parsed;
+  return true;
+}
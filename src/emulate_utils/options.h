@@ -0,0 +1,69 @@
+/**
+ * @file options.h
+ * @brief A header to define the options_t type, and header file for options.c.
+ */
+
+#ifndef OPTIONS_H
+#define OPTIONS_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../global.h"
+
+/**
+ * @brief An enum that identifies the core used to run instructions.
+ */
+typedef enum {
+  /** The fetch, decode, execute loop. */
+  STEP_ENGINE,
+  /** The direct-threaded interpreter. */
+  THREADED_ENGINE,
+  /** The basic block translator. */
+  BLOCK_ENGINE,
+  /** The basic block translator, with hot blocks compiled to native code. */
+  JIT_ENGINE,
+} engine_t;
+
+/**
+ * @brief A struct that holds the command line options for the emulator.
+ */
+typedef struct {
+  /** The object code file to emulate. */
+  char *filename;
+  /** The core used to run instructions. */
+  engine_t engine;
+  /** Whether native code is checked against the interpreter. */
+  bool verify_jit;
+  /** Whether countdown loops are fast-forwarded (block and jit engines). */
+  bool fast_forward;
+  /** Whether the number of instructions skipped by fast-forwarding loops is
+   * reported. */
+  bool report_skipped;
+  /** Whether hot blocks are fused into superinstructions (block and jit
+   * engines). */
+  bool fuse;
+  /** Whether statistics on the block translator are reported. */
+  bool stats;
+  /** The maximum number of instructions to run, or 0 for no limit. */
+  uint64_t max_instructions;
+  /** The maximum time to run for in milliseconds, or 0 for no limit. */
+  uint64_t timeout_ms;
+  /** The number of bytes of memory. */
+  uint64_t mem_size;
+  /** The format of output. */
+  output_t output;
+  /** Whether output is written straight to stdout, without the writer
+   * thread. */
+  bool sync_output;
+  /** Whether the changes made by each cycle are printed. */
+  bool trace;
+  /** The number of cycles between full snapshots of a trace, or 0 for only
+   * the first. */
+  uint64_t snapshot_every;
+} options_t;
+
+bool parse_options(int argc, char **argv, options_t *options);
+
+#endif
@@ -0,0 +1,88 @@
+/**
+ * @file pipeline.c
+ * @brief Functions for moving instructions through the pipeline.
+ */
+
+#include "pipeline.h"
+
+/**
+ * @brief Runs one fetch, decode, execute cycle.
+ *
+ * Executes the decoded instruction (if any), then advances the pipeline.
+ * @param machine The current system state.
+ */
+void cycle(system_state_t *machine) {
+  // Execute
+  if (machine->decoded_instruction.type != NUL) {
+    execute(machine);
+  }
+
+  advance_pipeline(machine);
+}
+
+/**
+ * @brief Runs the decode and fetch stages of a cycle.
+ *
+ * Decodes the fetched instruction (if any) and fetches the word at PC, unless
+ * a stop (ZER) instruction was decoded. PC is then moved to the next word.
+ * When nothing was fetched, only the type of the decoded instruction is
+ * cleared.
+ * @param machine The current system state.
+ */
+void advance_pipeline(system_state_t *machine) {
+  // Decode
+  if (machine->has_fetched_instruction) {
+    decode_instruction_cached(machine);
+  } else {
+    machine->decoded_instruction.type = NUL;
+  }
+
+  // Fetch
+  if (machine->decoded_instruction.type != ZER) {
+    machine->fetched_instruction = get_word(machine, machine->registers[PC]);
+    machine->has_fetched_instruction = true;
+  } else {
+    machine->has_fetched_instruction = false;
+  }
+
+  // Next instruction
+  machine->registers[PC] += 4;
+}
+
+/**
+ * @brief Returns whether another core can take over from the pipeline.
+ *
+ * Another core can only take over when no decoded instruction is waiting to be
+ * executed, and the next instruction to execute is inside memory.
+ * @param machine The current system state.
+ * @param address Set to the address of the next instruction to execute.
+ * @returns Whether another core can take over.
+ */
+bool can_leave_pipeline(system_state_t *machine, uint32_t *address) {
+  *address = machine->registers[PC];
+
+  if (machine->has_fetched_instruction) {
+    // The next instruction has already been fetched
+    *address -= 4;
+  }
+  return machine->decoded_instruction.type == NUL
+         && is_cacheable_address(*address);
+}
+
+/**
+ * @brief Hands control back to the pipeline from another core.
+ *
+ * Sets up the pipeline as it would be after the last instruction the other
+ * core executed, then finishes that cycle.
+ * @param machine The current system state.
+ * @param has_fetched Whether an instruction has been fetched.
+ * @param fetched The fetched instruction.
+ * @param pc The value of PC.
+ */
+void return_to_pipeline(system_state_t *machine, bool has_fetched,
+                        word_t fetched, uint32_t pc) {
+  machine->has_fetched_instruction = has_fetched;
+  machine->fetched_instruction = fetched;
+  machine->registers[PC] = pc;
+  advance_pipeline(machine);
+}
@@ -0,0 +1,17 @@
+/**
+ * @file pipeline.h
+ * @brief Header file for pipeline.c.
+ */
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+#include "decode.h"
+#include "execute.h"
+
+void cycle(system_state_t *machine);
+void advance_pipeline(system_state_t *machine);
+bool can_leave_pipeline(system_state_t *machine, uint32_t *address);
+void return_to_pipeline(system_state_t *machine, bool has_fetched,
+                        word_t fetched, uint32_t pc);
+
+#endif
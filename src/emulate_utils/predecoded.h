@@ -0,0 +1,51 @@
+/**
+ * @file predecoded.h
+ * @brief A header to define the predecoded_t type.
+ */
+
+#ifndef PREDECODED_H
+#define PREDECODED_H
+#include "../instruction.h"
+
+#if defined(__GNUC__) && !defined(NO_LABELS_AS_VALUES)
+/** Whether the threaded interpreter dispatches through label addresses. */
+#define LABELS_AS_VALUES
+/** A threaded interpreter handler, as the address of its label. */
+typedef const void *handler_t;
+#else
+/** A threaded interpreter handler, as its number in a dispatch switch. */
+typedef int handler_t;
+#endif
+
+/**
+ * @brief A struct that holds a cached decode of the word at one address.
+ *
+ * The emulator keeps one entry per word of memory. An entry is filled the
+ * first time the word at its address is decoded (unless the word fetched has
+ * since been overwritten in memory), and is current while the generation of
+ * its page is unchanged (see is_predecoded). A store to a word of code bumps
+ * the generation of the page, which invalidates every entry of the page
+ * without visiting them.
+ */
+typedef struct {
+  /** The generation of the page when the entry was filled, or 0 if unused. */
+  uint32_t generation;
+  /** The word which was decoded. */
+  word_t word;
+  /** The decoded instruction. */
+  instruction_t instruction;
+  /** The threaded interpreter handler for the instruction, or 0 if unset. */
+  handler_t handler;
+} predecoded_t;
+
+/**
+ * @brief Returns whether the word at an address can be held in the cache.
+ *
+ * @param address The address of the word.
+ * @returns Whether the address is word aligned and inside memory.
+ */
+static inline bool is_cacheable_address(uint32_t address) {
+  return address <= NUM_ADDRESSES - 4 && !(address % 4);
+}
+
+#endif
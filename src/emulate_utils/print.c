@@ -8,6 +8,7 @@
 static char *get_cond(condition_t cond);
 static char *get_opcode(opcode_t operation);
 static char *get_shift(shift_t shift);
+static char *get_transfer(transfer_t transfer);
 static void print_value(word_t value);
 static void print_binary_value(word_t value);
 static void print_fetched_instruction(system_state_t *machine);
@@ -25,14 +26,14 @@ static void print_memory(system_state_t *machine);
  */
 void print_array(byte_t *memory, size_t bytes_to_print) {
   for (size_t i = 0; i < bytes_to_print; i++) {
-    printf("%x", memory[i]);
+    writer_printf("%x", memory[i]);
 
     // New line at each word
     if (i % 4 == 3) {
-      printf("\n");
+      writer_printf("\n");
     }
   }
-  printf("\n");
+  writer_printf("\n");
 }
 
 /**
@@ -43,14 +44,37 @@ void print_array(byte_t *memory, size_t bytes_to_print) {
  * @param machine The current system state.
  */
 void print_system_state(system_state_t *machine) {
-  printf("\n--------------------------------------------------\n\n");
-  printf("System State:\n");
+  update_flags(machine);
+  writer_printf("\n--------------------------------------------------\n\n");
+  writer_printf("System State:\n");
   print_registers(machine);
   print_memory(machine);
   print_decoded_instruction(machine);
   print_fetched_instruction(machine);
 }
 
+/**
+ * @brief Writes the system state to stdout as raw bytes.
+ *
+ * Writes the NUM_REGISTERS registers as little endian words, then every byte
+ * of memory in order (so memory.size bytes), for other programs to read.
+ * @param machine The current system state.
+ */
+void print_system_state_binary(system_state_t *machine) {
+  update_flags(machine);
+  byte_t registers[NUM_REGISTERS * 4];
+  for (int i = 0; i < NUM_REGISTERS; i++) {
+    write_le_word(registers + 4 * i, machine->registers[i]);
+  }
+  writer_write(registers, sizeof(registers));
+
+  // Pages not written to are the shared page of zeros
+  for (uint32_t page = 0; page < machine->memory.size >> MEMORY_PAGE_BITS;
+       page++) {
+    writer_write(machine->memory.pages[page], MEMORY_PAGE_BYTES);
+  }
+}
+
 /**
  * @brief Prints the values of registers.
  *
@@ -58,11 +82,11 @@ void print_system_state(system_state_t *machine) {
  * @param machine The current system state.
  */
 static void print_registers(system_state_t *machine) {
-  printf("Register State:\n");
+  writer_printf("Register State:\n");
   for (uint8_t i = 0; i < NUM_REGISTERS; ++i) {
     word_t value = machine->registers[i];
 
-    printf("Register %2d, ", i);
+    writer_printf("Register %2d, ", i);
     print_value(value);
   }
 }
@@ -70,18 +94,16 @@ static void print_registers(system_state_t *machine) {
 /**
  * @brief Prints any non-zero words from memory.
  *
- * Prints any non-zero words from memory and their addresses.
+ * Prints any non-zero words from memory and their addresses. Only the pages
+ * of memory which have been written to are read (see next_nonzero_word).
  * @param machine The current system state.
  */
 static void print_memory(system_state_t *machine) {
-  printf("Memory State:\n");
-  for (uint32_t i = 0; i < NUM_ADDRESSES; i += 4) {
-    word_t value = get_word(machine, i);
-
-    if (value) {
-      printf("Memory Address %5d, ", i);
-      print_value(value);
-    }
+  writer_printf("Memory State:\n");
+  for (uint32_t i = next_nonzero_word(machine, 0); i < machine->memory.size;
+       i = next_nonzero_word(machine, i + 4)) {
+    writer_printf("Memory Address %5d, ", i);
+    print_value(get_word(machine, i));
   }
 }
 
@@ -94,10 +116,12 @@ static void print_memory(system_state_t *machine) {
  * * For data processing instructions, prints the condition, flags, opcodes,
  * operands, and shift information.
  * * For single data transfer instructions, prints flags, registers and offset.
+ * * For block data transfer instructions, prints flags, the base register and
+ * the register list.
  * @param machine The current system state.
  */
 static void print_decoded_instruction(system_state_t *machine) {
-  print_instruction(machine->decoded_instruction);
+  print_instruction(&machine->decoded_instruction);
 }
 
  /**
@@ -109,88 +133,109 @@ static void print_decoded_instruction(system_state_t *machine) {
   * * For data processing instructions, prints the condition, flags, opcodes,
   * operands, and shift information.
   * * For single data transfer instructions, prints flags, registers and offset.
+  * * For block data transfer instructions, prints flags, the base register and
+  * the register list.
   * @param instruction The instruction.
   */
 void print_instruction(instruction_t *instruction) {
   switch (instruction->type) {
     case NUL:
-      printf("Decoded Instruction: None\n");
+      writer_printf("Decoded Instruction: None\n");
       break;
     case ZER:
-      printf("Decoded Instruction: ZER\n");
+      writer_printf("Decoded Instruction: ZER\n");
       break;
     case BRA:
-      printf("Decoded Instruction: BRA\n");
-      printf("  Condition Flag: %s\n", get_cond(instruction->cond));
-      printf("  Offset: 0x%x\n", instruction->immediate_value);
+      writer_printf("Decoded Instruction: BRA\n");
+      writer_printf("  Condition Flag: %s\n", get_cond(instruction->cond));
+      writer_printf("  Link: %u\n", instruction->flag_3);
+      writer_printf("  Offset: 0x%x\n", instruction->immediate_value);
       break;
     case MUL:
-      printf("Decoded Instruction: MUL\n");
-      printf("  Condition Flag: %s\n", get_cond(instruction->cond));
-      printf("  Accumulate: %u\n", instruction->flag_0);
-      printf("  Set Flags: %u\n", instruction->flag_1);
-      printf("  Operand1 Register Rm: %d\n", instruction->rm);
-      printf("  Operand2 Register Rs: %d\n", instruction->rs);
+      writer_printf("Decoded Instruction: MUL\n");
+      writer_printf("  Condition Flag: %s\n", get_cond(instruction->cond));
+      writer_printf("  Accumulate: %u\n", instruction->flag_0);
+      writer_printf("  Set Flags: %u\n", instruction->flag_1);
+      writer_printf("  Operand1 Register Rm: %d\n", instruction->rm);
+      writer_printf("  Operand2 Register Rs: %d\n", instruction->rs);
       if (instruction->flag_0) {
         // Accumulate is set
-        printf("  Accumulate Register Rn: %d\n", instruction->rn);
+        writer_printf("  Accumulate Register Rn: %d\n", instruction->rn);
       }
-      printf("  Destination Register Rd: %d\n", instruction->rd);
+      writer_printf("  Destination Register Rd: %d\n", instruction->rd);
       break;
     case DPI:
-      printf("Decoded Instruction: DPI\n");
-      printf("  Condition Flag: %s\n", get_cond(instruction->cond));
-      printf("  Opcode: %s\n", get_opcode(instruction->operation));
-      printf("  Immediate Operand: %u\n", instruction->flag_0);
-      printf("  Set Flags: %u\n", instruction->flag_1);
-      printf("  Operand1 Register Rn: %d\n", instruction->rn);
+      writer_printf("Decoded Instruction: DPI\n");
+      writer_printf("  Condition Flag: %s\n", get_cond(instruction->cond));
+      writer_printf("  Opcode: %s\n", get_opcode(instruction->operation));
+      writer_printf("  Immediate Operand: %u\n", instruction->flag_0);
+      writer_printf("  Set Flags: %u\n", instruction->flag_1);
+      writer_printf("  Operand1 Register Rn: %d\n", instruction->rn);
       if (instruction->flag_0) {
         // Operand2 is immediate
-        printf("  Operand2 Immediate Value: 0x%x\n",
-               instruction->immediate_value);
-        printf("  Operand2 Rotate Right Amount: %u\n",
-               instruction->shift_amount);
+        writer_printf("  Operand2 Immediate Value: 0x%x\n",
+                      instruction->immediate_value);
+        writer_printf("  Operand2 Rotate Right Amount: %u\n",
+                      instruction->shift_amount);
       } else {
         // Operand2 is register
-        printf("  Operand2 Register Rm: %d\n", instruction->rm);
-        printf("  Operand2 Shift Type: %s\n",
-               get_shift(instruction->shift_type));
+        writer_printf("  Operand2 Register Rm: %d\n", instruction->rm);
+        writer_printf("  Operand2 Shift Type: %s\n",
+                      get_shift(instruction->shift_type));
         if (instruction->rs == -1) {
           // Shift is immediate
-          printf("  Operand2 Shift Amount: %u\n", instruction->shift_amount);
+          writer_printf("  Operand2 Shift Amount: %u\n",
+                        instruction->shift_amount);
         } else {
           // Shift is register
-          printf("  Operand2 Shift Register Rs: %d\n", instruction->rs);
+          writer_printf("  Operand2 Shift Register Rs: %d\n", instruction->rs);
         }
       }
-      printf("  Destination Register Rd: %d\n", instruction->rd);
+      writer_printf("  Destination Register Rd: %d\n", instruction->rd);
       break;
     case SDT:
-      printf("Decoded Instruction: SDT\n");
-      printf("  Condition Flag: %s\n", get_cond(instruction->cond));
-      printf("  Immediate Offset: %u\n", instruction->flag_0);
-      printf("  Pre (1) or Post Indexing (0): %u\n", instruction->flag_1);
-      printf("  Offset Add (1) or Subtract (0): %u\n", instruction->flag_2);
-      printf("  Load (1) or Store (0): %u\n", instruction->flag_3);
-      printf("  Base Register Rn: %d\n", instruction->rn);
+      writer_printf("Decoded Instruction: SDT\n");
+      writer_printf("  Condition Flag: %s\n", get_cond(instruction->cond));
+      writer_printf("  Immediate Offset: %u\n", instruction->flag_0);
+      writer_printf("  Pre (1) or Post Indexing (0): %u\n",
+                    instruction->flag_1);
+      writer_printf("  Offset Add (1) or Subtract (0): %u\n",
+                    instruction->flag_2);
+      writer_printf("  Load (1) or Store (0): %u\n", instruction->flag_3);
+      writer_printf("  Transfer Size: %s\n",
+                    get_transfer(instruction->transfer));
+      writer_printf("  Base Register Rn: %d\n", instruction->rn);
       if (instruction->flag_0) {
         // Offset is register
-        printf("  Offset Register Rm: %d\n", instruction->rm);
-        printf("  Offset Shift Type: %s\n",
-               get_shift(instruction->shift_type));
+        writer_printf("  Offset Register Rm: %d\n", instruction->rm);
+        writer_printf("  Offset Shift Type: %s\n",
+                      get_shift(instruction->shift_type));
         if (instruction->rs == -1) {
           // Shift is immediate
-          printf("  Offset Shift Amount: %u\n", instruction->shift_amount);
+          writer_printf("  Offset Shift Amount: %u\n",
+                        instruction->shift_amount);
         } else {
           // Shift is register
-          printf("  Offset Shift Register Rs: %d\n", instruction->rs);
+          writer_printf("  Offset Shift Register Rs: %d\n", instruction->rs);
         }
       } else {
         // Offset is immediate
-        printf("  Offset Immediate Value: 0x%x\n",
-               instruction->immediate_value);
+        writer_printf("  Offset Immediate Value: 0x%x\n",
+                      instruction->immediate_value);
       }
-      printf("  Source / Destination Register Rd: %d\n", instruction->rd);
+      writer_printf("  Source / Destination Register Rd: %d\n",
+                    instruction->rd);
+      break;
+    case BDT:
+      writer_printf("Decoded Instruction: BDT\n");
+      writer_printf("  Condition Flag: %s\n", get_cond(instruction->cond));
+      writer_printf("  Pre (1) or Post Indexing (0): %u\n",
+                    instruction->flag_1);
+      writer_printf("  Up (1) or Down (0): %u\n", instruction->flag_2);
+      writer_printf("  Write Back: %u\n", instruction->flag_0);
+      writer_printf("  Load (1) or Store (0): %u\n", instruction->flag_3);
+      writer_printf("  Base Register Rn: %d\n", instruction->rn);
+      writer_printf("  Register List: 0x%04x\n", instruction->immediate_value);
       break;
     default:
       assert(false);
@@ -204,10 +249,10 @@ void print_instruction(instruction_t *instruction) {
  */
 static void print_fetched_instruction(system_state_t *machine) {
   if (machine->has_fetched_instruction) {
-    printf("Fetched Instruction, ");
+    writer_printf("Fetched Instruction, ");
     print_value(machine->fetched_instruction);
   } else {
-    printf("Fetched Instruction: None\n");
+    writer_printf("Fetched Instruction: None\n");
   }
 }
 
@@ -217,9 +262,9 @@ static void print_fetched_instruction(system_state_t *machine) {
  * @param value The word to print.
  */
 static void print_value(word_t value) {
-  printf("Value: ");
+  writer_printf("Value: ");
   print_binary_value(value);
-  printf(" (0x%08x) (%ld)\n", value, twos_complement_to_long(value));
+  writer_printf(" (0x%08x) (%ld)\n", value, twos_complement_to_long(value));
 }
 
 /**
@@ -230,7 +275,7 @@ static void print_value(word_t value) {
  */
 static void print_binary_value(word_t value) {
   for (int i = 0; i < WORD_SIZE; ++i) {
-    printf("%u", value >> (WORD_SIZE - 1));
+    writer_printf("%u", value >> (WORD_SIZE - 1));
     value <<= 1;
   }
 }
@@ -247,6 +292,22 @@ static char *get_cond(condition_t cond) {
       return "EQ";
     case NE:
       return "NE";
+    case CS:
+      return "CS";
+    case CC:
+      return "CC";
+    case MI:
+      return "MI";
+    case PL:
+      return "PL";
+    case VS:
+      return "VS";
+    case VC:
+      return "VC";
+    case HI:
+      return "HI";
+    case LS:
+      return "LS";
     case GE:
       return "GE";
     case LT:
@@ -257,6 +318,8 @@ static char *get_cond(condition_t cond) {
       return "LE";
     case AL:
       return "AL";
+    case NV:
+      return "NV";
     default:
       assert(false);
   }
@@ -315,3 +378,26 @@ static char *get_shift(shift_t shift) {
       assert(false);
   }
 }
+
+/**
+ * @brief Returns the string representing the size of a data transfer.
+ *
+ * @param transfer The size of the transfer.
+ * @returns The string of the transfer size for printing.
+ */
+static char *get_transfer(transfer_t transfer) {
+  switch (transfer) {
+    case WORD_TRANSFER:
+      return "Word";
+    case BYTE_TRANSFER:
+      return "Byte";
+    case HALF_TRANSFER:
+      return "Halfword";
+    case SIGNED_BYTE_TRANSFER:
+      return "Signed Byte";
+    case SIGNED_HALF_TRANSFER:
+      return "Signed Halfword";
+    default:
+      assert(false);
+  }
+}
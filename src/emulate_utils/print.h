@@ -9,6 +9,7 @@
 
 void print_array(byte_t *memory, size_t bytes_to_print);
 void print_system_state(system_state_t *machine);
+void print_system_state_binary(system_state_t *machine);
 void print_instruction(instruction_t *instruction);
 
 #endif
@@ -17,9 +17,10 @@ static void print_value_compliant(word_t value);
  * @param machine The current system state.
  */
 void print_system_state_compliant(system_state_t *machine) {
-  printf("Registers:\n");
+  update_flags(machine);
+  writer_printf("Registers:\n");
   print_registers_compliant(machine);
-  printf("Non-zero memory:\n");
+  writer_printf("Non-zero memory:\n");
   print_memory_compliant(machine);
 }
 
@@ -31,28 +32,28 @@ void print_system_state_compliant(system_state_t *machine) {
 static void print_registers_compliant(system_state_t *machine) {
   for (uint8_t i = 0; i <= 12; ++i) {
     word_t value = machine->registers[i];
-    printf("$%-2d : ", i);
+    writer_printf("$%-2d : ", i);
     print_value_compliant(value);
   }
 
-  printf("PC  : ");
+  writer_printf("PC  : ");
   print_value_compliant(machine->registers[15]);
 
-  printf("CPSR: ");
+  writer_printf("CPSR: ");
   print_value_compliant(machine->registers[16]);
 }
 
 /**
  * @brief Prints non-zero memory entries for test cases.
  *
+ * Only the pages of memory which have been written to are read, skipping
+ * runs of zeros (see next_nonzero_word).
  * @param machine The current system state.
  */
 static void print_memory_compliant(system_state_t *machine) {
-  for (uint32_t i = 0; i < NUM_ADDRESSES; i += 4) {
-    word_t value = get_word_compliant(machine, i);
-    if (value) {
-      printf("0x%08x: 0x%08x\n", i, value);
-    }
+  for (uint32_t i = next_nonzero_word(machine, 0); i < machine->memory.size;
+       i = next_nonzero_word(machine, i + 4)) {
+    writer_printf("0x%08x: 0x%08x\n", i, get_word_compliant(machine, i));
   }
 }
 
@@ -62,5 +63,5 @@ static void print_memory_compliant(system_state_t *machine) {
  * @param value The word to print.
  */
 static void print_value_compliant(word_t value) {
-  printf("%10ld (0x%08x)\n", twos_complement_to_long(value), value);
+  writer_printf("%10ld (0x%08x)\n", twos_complement_to_long(value), value);
 }
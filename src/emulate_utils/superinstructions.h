@@ -0,0 +1,53 @@
+/**
+ * @file superinstructions.h
+ * @brief X-macros listing every superinstruction, and the numbering of
+ * superinstructions.
+ *
+ * A superinstruction runs a run of adjacent micro-ops of a block (and, for
+ * some, the branch which ends the block) in a single handler. Which ones are
+ * used in each block is chosen from a profile of the program (see fusion.c).
+ *
+ * To use the list, define a macro X taking the names in the list, and pass it
+ * to the list.
+ */
+
+#ifndef SUPERINSTRUCTIONS_H
+#define SUPERINSTRUCTIONS_H
+
+/**
+ * Every superinstruction, as X(name, length, ends_block), where length is the
+ * number of micro-ops fused, and ends_block is whether the branch ending the
+ * block is fused too. The parts of each name are:
+ * * ALU, any data processing instruction,
+ * * TEST, a data processing instruction with an immediate operand which sets
+ *   the flags (such as cmp),
+ * * LOAD and STORE, single data transfers,
+ * * BRANCH, the branch ending the block.
+ */
+#define SUPERINSTRUCTIONS(X) \
+  X(ALU_ALU, 2, false) \
+  X(LOAD_ALU, 2, false) \
+  X(ALU_STORE, 2, false) \
+  X(LOAD_ALU_STORE, 3, false) \
+  X(TEST_BRANCH, 1, true) \
+  X(ALU_TEST_BRANCH, 2, true)
+
+/** Lists a superinstruction, as an enum constant. */
+#define ENUM_SUPERINSTRUCTION(name, length, ends_block) name##_SUPER,
+
+/**
+ * @brief An enum that identifies a superinstruction.
+ *
+ * Names are those in SUPERINSTRUCTIONS, with the suffix _SUPER.
+ */
+typedef enum {
+  SUPERINSTRUCTIONS(ENUM_SUPERINSTRUCTION)
+  /** The number of superinstructions. */
+  NUM_SUPERINSTRUCTIONS,
+  /** No superinstruction starts at the micro-op. */
+  NO_SUPERINSTRUCTION = NUM_SUPERINSTRUCTIONS,
+} superinstruction_t;
+
+#undef ENUM_SUPERINSTRUCTION
+
+#endif
@@ -6,21 +6,144 @@
 #ifndef SYSTEM_STATE_H
 #define SYSTEM_STATE_H
 #include "../instruction.h"
+#include "predecoded.h"
+
+/**
+ * @brief A struct that holds the inputs of the last instruction which set the
+ * CPSR flags, until the flags are read.
+ */
+typedef struct {
+  /** Whether the flags in CPSR are out of date. */
+  bool pending;
+  /**
+   * Whether the carry and overflow flags are from an addition or
+   * subtraction. Otherwise the overflow flag is left as it is.
+   */
+  bool arithmetic;
+  /** Whether the result is op1 - op2, rather than op1 + op2. */
+  bool subtract;
+  /** The first operand (arithmetic only). */
+  word_t op1;
+  /** The second operand (arithmetic only). */
+  word_t op2;
+  /** The result of the instruction. */
+  word_t result;
+  /** The carry flag (not arithmetic only). */
+  bool carry;
+} lazy_flags_t;
+
+/**
+ * @brief A struct that holds the memory of a machine, in pages.
+ *
+ * Every page which has not been written to is the same page of zeros, so a
+ * program only allocates the pages it writes to.
+ */
+typedef struct {
+  /**
+   * The MEMORY_PAGE_BYTES bytes of each page of memory, or a shared page of
+   * zeros if the page has not been written to.
+   */
+  byte_t **pages;
+  /** A bit per page, which is set once the page has been written to. */
+  uint64_t *written;
+  /**
+   * A bit per page, which is set whenever the page is written to, and cleared
+   * by whatever is watching for changes (the trace).
+   */
+  uint64_t *stored;
+  /** The number of bytes of memory, a multiple of MEMORY_PAGE_BYTES. */
+  uint32_t size;
+} memory_t;
 
 /**
  * @brief A struct that holds information about the current system state.
+ *
+ * The state used on every cycle (the registers, the flags and the two
+ * pipeline stages) comes first, starting on a cache line. A system state must
+ * be allocated by create_system_state, so that it is aligned and has memory,
+ * and freed by free_system_state.
  */
 typedef struct {
   /** Holds the values currently held in registers. */
-  word_t registers[NUM_REGISTERS];
-    /** Holds the values currently held in memory. */
-  byte_t memory[NUM_ADDRESSES];
+  word_t registers[NUM_REGISTERS] __attribute__((aligned(CACHE_LINE_SIZE)));
+    /** The flags to be written to CPSR when it is next read. */
+  lazy_flags_t flags;
     /** Holds the last fetched instruction, as a word. */
   word_t fetched_instruction;
-    /** Holds the last decoded instruction, as an instruction_t type. */
-  instruction_t *decoded_instruction;
     /** Whether or not the system currently has a fetched instruction. */
   bool has_fetched_instruction;
+    /**
+     * Holds the last decoded instruction, which has type NUL if there is none.
+     * Only the type is reset when nothing is decoded, so the other fields are
+     * stale until the next decode.
+     */
+  instruction_t decoded_instruction;
+    /** Holds the predecoded instruction for each word, or NULL if unused. */
+  predecoded_t *decode_cache;
+    /** Whether a cached decode has been invalidated by a store. */
+  bool code_modified;
+    /** Holds the translated basic blocks, or NULL if unused. */
+  struct block_cache *block_cache;
+    /**
+     * Frees block_cache (free_block_cache, which only programs linking the
+     * block translator have), or NULL if it is never freed by exit_program.
+     */
+  void (*free_block_cache)(struct block_cache *cache);
+    /** Whether GPIO accesses and memory errors are not reported. */
+  bool quiet;
+    /** The format of output, which decides how memory errors are handled. */
+  output_t output;
+    /** The number of instructions skipped by fast-forwarding loops. */
+  uint64_t skipped_instructions;
+    /**
+     * The number of instructions run or skipped. The block engines count a
+     * block before it is run.
+     */
+  uint64_t instructions;
+    /** The instruction count at which the watchdog is next checked. */
+  uint64_t next_check;
+    /** The limits on how long the program may run, or NULL if none. */
+  struct watchdog *watchdog;
+    /**
+     * The generation of each page, starting at 1. A store to a word of code
+     * in the page bumps it.
+     */
+  uint32_t page_generations[NUM_PAGES];
+    /** A bit per word of each page, set while its decode is cached. */
+  uint64_t code_bitmap[NUM_PAGES][WORDS_PER_PAGE / 64];
+    /** Holds the values currently held in memory. */
+  memory_t memory;
 } system_state_t;
 
+/**
+ * @brief Returns whether the decode cache holds the current decode of the
+ * word at an address.
+ *
+ * A pre-condition is that the machine has a decode cache, and the address is
+ * cacheable.
+ * @param machine The current system state.
+ * @param address The address of the word.
+ * @returns Whether the entry was filled since the page was last written to.
+ */
+static inline bool is_predecoded(system_state_t *machine, uint32_t address) {
+  return machine->decode_cache[address >> 2].generation
+         == machine->page_generations[address >> PAGE_BITS];
+}
+
+/**
+ * @brief Returns the word of code_bitmap holding the bit of an address.
+ *
+ * @param machine The current system state.
+ * @param address An address inside memory.
+ * @returns The word of the bitmap, whose bit CODE_BIT(address) is the bit of
+ * the word at the address.
+ */
+static inline uint64_t *code_bits(system_state_t *machine, uint32_t address) {
+  return &machine->code_bitmap[address >> PAGE_BITS]
+                              [(address % PAGE_BYTES) >> 8];
+}
+
+/** The bit of the word at an address, in its word of code_bitmap. */
+#define CODE_BIT(address) ((uint64_t) 1 << (((address) >> 2) % 64))
+
 #endif
@@ -0,0 +1,421 @@
+/**
+ * @file threaded.c
+ * @brief A direct-threaded interpreter for the execute cycle.
+ *
+ * Each predecoded instruction carries the handler which executes it. When the
+ * compiler supports labels-as-values, a handler is the address of a label and
+ * every handler jumps straight to the handler of the next instruction.
+ * Otherwise, a handler is a number and handlers return to a single switch.
+ *
+ * The interpreter runs the same instructions as the fetch, decode, execute
+ * loop, so the system state is identical whenever control is handed back.
+ * Instructions are counted, and the watchdog is checked, at each taken branch.
+ */
+
+#include "threaded.h"
+#include "watchdog.h"
+
+/**
+ * @brief An enum that identifies the handler for an instruction.
+ */
+typedef enum {
+  /** No handler has been selected. */
+  UNSET_HANDLER = 0,
+  /** Data processing And. */
+  AND_HANDLER,
+  /** Data processing Exclusive or. */
+  EOR_HANDLER,
+  /** Data processing Subtract. */
+  SUB_HANDLER,
+  /** Data processing Reverse subtract. */
+  RSB_HANDLER,
+  /** Data processing Add. */
+  ADD_HANDLER,
+  /** Data processing And, set flags only. */
+  TST_HANDLER,
+  /** Data processing Exclusive or, set flags only. */
+  TEQ_HANDLER,
+  /** Data processing Subtract, set flags only. */
+  CMP_HANDLER,
+  /** Data processing Or. */
+  ORR_HANDLER,
+  /** Data processing Move. */
+  MOV_HANDLER,
+  /** Multiply. */
+  MUL_HANDLER,
+  /** Single or block data transfer. */
+  SDT_HANDLER,
+  /** Branch. */
+  BRA_HANDLER,
+  /** All zero (STOP) instruction. */
+  ZER_HANDLER,
+  /** Any instruction which writes to PC, as an indirect branch. */
+  PC_WRITE_HANDLER,
+  /** Any other instruction, run through execute_instruction. */
+  GENERIC_HANDLER,
+  /** The number of handlers. */
+  NUM_HANDLERS,
+} handler_index_t;
+
+static handler_index_t select_handler(instruction_t *instruction);
+
+#ifdef LABELS_AS_VALUES
+/** Jumps to the handler of the current instruction. */
+#define JUMP_TO_HANDLER() __extension__ ({ goto *op->handler; })
+#else
+/** Jumps to the dispatch switch for the current instruction. */
+#define JUMP_TO_HANDLER() goto dispatch
+#endif
+
+/** Moves to the instruction at address and jumps to its handler. */
+#define DISPATCH() \
+  do { \
+    if (!is_cacheable_address(address)) { \
+      goto out_of_cache; \
+    } \
+    op = &machine->decode_cache[address >> 2]; \
+    if (!is_predecoded(machine, address) || !op->handler) { \
+      goto resolve; \
+    } \
+    instruction = &op->instruction; \
+    registers[PC] = address + 8; \
+    JUMP_TO_HANDLER(); \
+  } while (0)
+
+/** Moves to the next instruction in memory. */
+#define NEXT() \
+  do { \
+    address += 4; \
+    DISPATCH(); \
+  } while (0)
+
+/**
+ * Counts the instructions run from the start of the current block to the one
+ * before end.
+ */
+#define COUNT_TO(end) \
+  (machine->instructions += ((end) - block_start) / 4)
+
+/** Skips the current instruction if its condition is not met. */
+#define CHECK_CONDITION() \
+  do { \
+    if (instruction->cond != AL && !condition(machine, instruction)) { \
+      goto skip; \
+    } \
+  } while (0)
+
+/**
+ * @brief Runs instructions through the direct-threaded interpreter.
+ *
+ * Runs until the program stops, an instruction is reached that must be run
+ * by the fetch, decode, execute loop, or the watchdog expires. In each case
+ * the pipeline is left exactly as the loop would have left it.
+ * @param machine The current system state.
+ * @param address The address of the next instruction, from can_leave_pipeline.
+ */
+void run_threaded(system_state_t *machine, uint32_t address) {
+#ifdef LABELS_AS_VALUES
+  static const void *const handlers[NUM_HANDLERS] = {
+    [UNSET_HANDLER] = NULL,
+    [AND_HANDLER] = __extension__ &&do_and,
+    [EOR_HANDLER] = __extension__ &&do_eor,
+    [SUB_HANDLER] = __extension__ &&do_sub,
+    [RSB_HANDLER] = __extension__ &&do_rsb,
+    [ADD_HANDLER] = __extension__ &&do_add,
+    [TST_HANDLER] = __extension__ &&do_tst,
+    [TEQ_HANDLER] = __extension__ &&do_teq,
+    [CMP_HANDLER] = __extension__ &&do_cmp,
+    [ORR_HANDLER] = __extension__ &&do_orr,
+    [MOV_HANDLER] = __extension__ &&do_mov,
+    [MUL_HANDLER] = __extension__ &&do_mul,
+    [SDT_HANDLER] = __extension__ &&do_sdt,
+    [BRA_HANDLER] = __extension__ &&do_bra,
+    [ZER_HANDLER] = __extension__ &&do_zer,
+    [PC_WRITE_HANDLER] = __extension__ &&do_pc_write,
+    [GENERIC_HANDLER] = __extension__ &&do_generic,
+  };
+#endif
+  word_t *registers = machine->registers;
+  predecoded_t *op;
+  instruction_t *instruction;
+  word_t op1;
+  word_t op2;
+  word_t result;
+  word_t latched;
+  bool carry;
+  // The address of the first instruction since the last taken branch
+  uint32_t block_start = address;
+
+  DISPATCH();
+
+resolve:
+  // Decode the instruction and select its handler
+  op = predecode(machine, address);
+  if (!op->handler) {
+#ifdef LABELS_AS_VALUES
+    op->handler = handlers[select_handler(&op->instruction)];
+#else
+    op->handler = select_handler(&op->instruction);
+#endif
+  }
+  instruction = &op->instruction;
+  registers[PC] = address + 8;
+  JUMP_TO_HANDLER();
+
+#ifndef LABELS_AS_VALUES
+dispatch:
+  switch (op->handler) {
+    case AND_HANDLER:
+      goto do_and;
+    case EOR_HANDLER:
+      goto do_eor;
+    case SUB_HANDLER:
+      goto do_sub;
+    case RSB_HANDLER:
+      goto do_rsb;
+    case ADD_HANDLER:
+      goto do_add;
+    case TST_HANDLER:
+      goto do_tst;
+    case TEQ_HANDLER:
+      goto do_teq;
+    case CMP_HANDLER:
+      goto do_cmp;
+    case ORR_HANDLER:
+      goto do_orr;
+    case MOV_HANDLER:
+      goto do_mov;
+    case MUL_HANDLER:
+      goto do_mul;
+    case SDT_HANDLER:
+      goto do_sdt;
+    case BRA_HANDLER:
+      goto do_bra;
+    case ZER_HANDLER:
+      goto do_zer;
+    case PC_WRITE_HANDLER:
+      goto do_pc_write;
+    case GENERIC_HANDLER:
+    default:
+      goto do_generic;
+  }
+#endif
+
+skip:
+  NEXT();
+
+do_and:
+  CHECK_CONDITION();
+  op2 = operand2(machine, instruction, &carry);
+  result = registers[instruction->rn] & op2;
+  registers[instruction->rd] = result;
+  if (instruction->flag_1) {
+    set_flags(machine, result, carry);
+  }
+  NEXT();
+
+do_eor:
+  CHECK_CONDITION();
+  op2 = operand2(machine, instruction, &carry);
+  result = registers[instruction->rn] ^ op2;
+  registers[instruction->rd] = result;
+  if (instruction->flag_1) {
+    set_flags(machine, result, carry);
+  }
+  NEXT();
+
+do_sub:
+  CHECK_CONDITION();
+  op2 = operand2(machine, instruction, &carry);
+  op1 = registers[instruction->rn];
+  result = op1 + negate(op2);
+  registers[instruction->rd] = result;
+  if (instruction->flag_1) {
+    set_arithmetic_flags(machine, op1, op2, result, true);
+  }
+  NEXT();
+
+do_rsb:
+  CHECK_CONDITION();
+  op2 = operand2(machine, instruction, &carry);
+  op1 = registers[instruction->rn];
+  result = op2 + negate(op1);
+  registers[instruction->rd] = result;
+  if (instruction->flag_1) {
+    set_arithmetic_flags(machine, op2, op1, result, true);
+  }
+  NEXT();
+
+do_add:
+  CHECK_CONDITION();
+  op2 = operand2(machine, instruction, &carry);
+  op1 = registers[instruction->rn];
+  result = op1 + op2;
+  registers[instruction->rd] = result;
+  if (instruction->flag_1) {
+    set_arithmetic_flags(machine, op1, op2, result, false);
+  }
+  NEXT();
+
+do_tst:
+  CHECK_CONDITION();
+  op2 = operand2(machine, instruction, &carry);
+  if (instruction->flag_1) {
+    set_flags(machine, registers[instruction->rn] & op2, carry);
+  }
+  NEXT();
+
+do_teq:
+  CHECK_CONDITION();
+  op2 = operand2(machine, instruction, &carry);
+  if (instruction->flag_1) {
+    set_flags(machine, registers[instruction->rn] ^ op2, carry);
+  }
+  NEXT();
+
+do_cmp:
+  CHECK_CONDITION();
+  op2 = operand2(machine, instruction, &carry);
+  if (instruction->flag_1) {
+    op1 = registers[instruction->rn];
+    result = op1 + negate(op2);
+    set_arithmetic_flags(machine, op1, op2, result, true);
+  }
+  NEXT();
+
+do_orr:
+  CHECK_CONDITION();
+  op2 = operand2(machine, instruction, &carry);
+  result = registers[instruction->rn] | op2;
+  registers[instruction->rd] = result;
+  if (instruction->flag_1) {
+    set_flags(machine, result, carry);
+  }
+  NEXT();
+
+do_mov:
+  CHECK_CONDITION();
+  result = operand2(machine, instruction, &carry);
+  registers[instruction->rd] = result;
+  if (instruction->flag_1) {
+    set_flags(machine, result, carry);
+  }
+  NEXT();
+
+do_mul:
+  CHECK_CONDITION();
+  execute_mul(machine, instruction);
+  NEXT();
+
+do_sdt:
+  CHECK_CONDITION();
+  if (instruction->flag_3 || !is_cacheable_address(address + 4)) {
+    execute_transfer(machine, instruction);
+    NEXT();
+  }
+  // The next instruction was fetched before this store was executed
+  latched = get_word(machine, address + 4);
+  execute_transfer(machine, instruction);
+  if (get_word(machine, address + 4) != latched) {
+    COUNT_TO(address + 4);
+    return_to_pipeline(machine, true, latched, address + 8);
+    return;
+  }
+  NEXT();
+
+do_bra:
+  CHECK_CONDITION();
+  COUNT_TO(address + 4);
+  if (instruction->flag_3) {
+    registers[LR] = address + 4;
+  }
+  address = registers[PC] + instruction->immediate_value;
+  block_start = address;
+  if (watchdog_expired(machine)) {
+    goto stopped;
+  }
+  DISPATCH();
+
+do_zer:
+  COUNT_TO(address);
+  return_to_pipeline(machine, true, op->word, address + 4);
+  return;
+
+do_pc_write:
+  CHECK_CONDITION();
+  COUNT_TO(address + 4);
+  // The decode cache is indexed by address, so the target is found directly
+  execute_instruction(machine, instruction);
+  address = registers[PC];
+  block_start = address;
+  if (watchdog_expired(machine)) {
+    goto stopped;
+  }
+  DISPATCH();
+
+do_generic:
+  execute_instruction(machine, instruction);
+  NEXT();
+
+stopped:
+  if (is_cacheable_address(address)) {
+    // Stop before the target, as the block engines do
+    return_to_pipeline(machine, true, get_word(machine, address), address + 4);
+    return;
+  }
+
+out_of_cache:
+  COUNT_TO(address);
+  return_to_pipeline(machine, false, 0, address);
+}
+
+/**
+ * @brief Selects the handler for a decoded instruction.
+ *
+ * @param instruction The decoded instruction.
+ * @returns The handler which executes the instruction.
+ */
+static handler_index_t select_handler(instruction_t *instruction) {
+  if (writes_pc(instruction)) {
+    return PC_WRITE_HANDLER;
+  }
+
+  switch (instruction->type) {
+    case DPI:
+      switch (instruction->operation) {
+        case AND:
+          return AND_HANDLER;
+        case EOR:
+          return EOR_HANDLER;
+        case SUB:
+          return SUB_HANDLER;
+        case RSB:
+          return RSB_HANDLER;
+        case ADD:
+          return ADD_HANDLER;
+        case TST:
+          return TST_HANDLER;
+        case TEQ:
+          return TEQ_HANDLER;
+        case CMP:
+          return CMP_HANDLER;
+        case ORR:
+          return ORR_HANDLER;
+        case MOV:
+          return MOV_HANDLER;
+        default:
+          return GENERIC_HANDLER;
+      }
+    case MUL:
+      return MUL_HANDLER;
+    case SDT:
+    case BDT:
+      return SDT_HANDLER;
+    case BRA:
+      return BRA_HANDLER;
+    case ZER:
+      return ZER_HANDLER;
+    default:
+      return GENERIC_HANDLER;
+  }
+}
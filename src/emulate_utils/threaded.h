@@ -0,0 +1,12 @@
+/**
+ * @file threaded.h
+ * @brief Header file for threaded.c.
+ */
+
+#ifndef THREADED_H
+#define THREADED_H
+#include "pipeline.h"
+
+void run_threaded(system_state_t *machine, uint32_t address);
+
+#endif
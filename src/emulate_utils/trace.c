@@ -0,0 +1,165 @@
+/**
+ * @file trace.c
+ * @brief Functions for printing the changes to the system state each cycle.
+ *
+ * A trace keeps a copy of the registers and memory as last printed. Each
+ * cycle, the registers are compared with the copy, and memory is only
+ * compared on the pages which have been stored to since the last cycle
+ * (see memory_t.stored), so a cycle costs about the same whatever the size
+ * of memory. A cycle is a pass of the emulator's main loop, which is a single
+ * instruction for the fetch, decode, execute loop, or a run of blocks.
+ */
+
+#include "trace.h"
+
+static void trace_registers(system_state_t *machine, trace_t *trace,
+                            bool print);
+static void trace_memory(system_state_t *machine, trace_t *trace, bool print);
+static void print_flags(word_t cpsr);
+
+/**
+ * @brief Starts a trace of a machine.
+ *
+ * Nothing has been printed yet, so the first cycle prints a full snapshot,
+ * and takes the copy of every page stored to so far (including the program
+ * loaded). Exits if memory cannot be allocated.
+ * @param machine The current system state, with the program loaded.
+ * @param snapshot_every The number of cycles between full snapshots, or 0 for
+ * only a snapshot of the first cycle.
+ * @returns The trace, to be freed with free_trace.
+ */
+trace_t *create_trace(system_state_t *machine, uint64_t snapshot_every) {
+  trace_t *trace = malloc(sizeof(trace_t));
+  if (!trace) {
+    perror("Unable to allocate memory for the trace.\n");
+    exit(EXIT_FAILURE);
+  }
+  trace->previous = create_system_state();
+  trace->previous->quiet = true;
+  set_memory_size(trace->previous, machine->memory.size);
+  trace->snapshot_every = snapshot_every;
+  trace->cycles = 0;
+  return trace;
+}
+
+/**
+ * @brief Prints what has changed since the last cycle.
+ *
+ * The first cycle, and every snapshot_every cycles, prints the whole state
+ * with print_system_state instead. Otherwise prints the cycle number and PC,
+ * then each other register written, each word of memory stored to and any
+ * change to the flags in CPSR.
+ * @param machine The current system state.
+ * @param trace The trace of the machine.
+ */
+void trace_cycle(system_state_t *machine, trace_t *trace) {
+  update_flags(machine);
+  bool snapshot = !trace->cycles
+                  || (trace->snapshot_every
+                      && !(trace->cycles % trace->snapshot_every));
+
+  if (snapshot) {
+    print_system_state(machine);
+  } else {
+    writer_printf("Cycle %llu, PC 0x%08x\n",
+                  (unsigned long long) trace->cycles, machine->registers[PC]);
+  }
+  trace_registers(machine, trace, !snapshot);
+  trace_memory(machine, trace, !snapshot);
+  trace->cycles++;
+}
+
+/**
+ * @brief Frees a trace.
+ *
+ * @param trace The trace, or NULL.
+ */
+void free_trace(trace_t *trace) {
+  if (trace) {
+    free_system_state(trace->previous);
+    free(trace);
+  }
+}
+
+/**
+ * @brief Prints the registers which have changed, and updates the copy.
+ *
+ * PC is left out, as it is printed every cycle, and CPSR is printed as the
+ * flags.
+ * @param machine The current system state.
+ * @param trace The trace of the machine.
+ * @param print Whether to print the changes.
+ */
+static void trace_registers(system_state_t *machine, trace_t *trace,
+                            bool print) {
+  word_t *previous = trace->previous->registers;
+
+  for (int i = 0; print && i < PC; i++) {
+    if (machine->registers[i] != previous[i]) {
+      writer_printf("  Register %2d: 0x%08x -> 0x%08x\n", i, previous[i],
+                    machine->registers[i]);
+    }
+  }
+  if (print && machine->registers[CPSR] != previous[CPSR]) {
+    writer_printf("  Flags: ");
+    print_flags(previous[CPSR]);
+    writer_printf(" -> ");
+    print_flags(machine->registers[CPSR]);
+    writer_printf("\n");
+  }
+  memcpy(previous, machine->registers, sizeof(machine->registers));
+}
+
+/**
+ * @brief Prints the words of memory which have changed, and updates the copy.
+ *
+ * Only the pages stored to since the last cycle are compared, after which
+ * they are no longer marked as stored to.
+ * @param machine The current system state.
+ * @param trace The trace of the machine.
+ * @param print Whether to print the changes.
+ */
+static void trace_memory(system_state_t *machine, trace_t *trace, bool print) {
+  system_state_t *previous = trace->previous;
+  uint32_t num_pages = machine->memory.size >> MEMORY_PAGE_BITS;
+  if (previous->memory.size != machine->memory.size) {
+    set_memory_size(previous, machine->memory.size);
+  }
+
+  for (uint32_t i = 0; i < (num_pages + 63) / 64; i++) {
+    uint64_t bits = machine->memory.stored[i];
+    machine->memory.stored[i] = 0;
+    while (bits) {
+      uint32_t page = i * 64 + __builtin_ctzll(bits);
+      bits &= bits - 1;
+
+      uint32_t start = page << MEMORY_PAGE_BITS;
+      for (uint32_t address = start; address < start + MEMORY_PAGE_BYTES;
+           address += 4) {
+        word_t value = get_word(machine, address);
+        word_t old = get_word(previous, address);
+        if (value != old) {
+          if (print) {
+            writer_printf("  Memory 0x%08x: 0x%08x -> 0x%08x\n", address, old,
+                          value);
+          }
+          set_word(previous, address, value);
+        }
+      }
+    }
+  }
+  // The copy is only read by the trace
+  memset(previous->memory.stored, 0,
+         (num_pages + 63) / 64 * sizeof(uint64_t));
+}
+
+/**
+ * @brief Prints the N, Z, C and V flags of CPSR, in upper case when set.
+ *
+ * @param cpsr The value of CPSR.
+ */
+static void print_flags(word_t cpsr) {
+  writer_printf("%c%c%c%c", cpsr & (1u << 31) ? 'N' : 'n',
+                cpsr & (1u << 30) ? 'Z' : 'z', cpsr & (1u << 29) ? 'C' : 'c',
+                cpsr & (1u << 28) ? 'V' : 'v');
+}
@@ -0,0 +1,27 @@
+/**
+ * @file trace.h
+ * @brief A header to define the trace_t type, and header file for trace.c.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+#include "../toolbox.h"
+
+/**
+ * @brief A struct that holds the state last printed by a trace, so that each
+ * cycle only prints what has changed.
+ */
+typedef struct {
+  /** The registers and memory as last printed. */
+  system_state_t *previous;
+  /** The number of cycles between full snapshots, or 0 for only the first. */
+  uint64_t snapshot_every;
+  /** The number of cycles traced. */
+  uint64_t cycles;
+} trace_t;
+
+trace_t *create_trace(system_state_t *machine, uint64_t snapshot_every);
+void trace_cycle(system_state_t *machine, trace_t *trace);
+void free_trace(trace_t *trace);
+
+#endif
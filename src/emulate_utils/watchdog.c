@@ -0,0 +1,111 @@
+/**
+ * @file watchdog.c
+ * @brief Functions for stopping programs which run for too long.
+ *
+ * Each engine adds to the instruction count of the system state once per
+ * block (or per cycle, for the fetch, decode, execute loop), and calls
+ * watchdog_expired between blocks. That only compares the count with
+ * next_check, which is at the instruction limit, or every WATCHDOG_INTERVAL
+ * instructions when there is a time limit, so the clock is rarely read. A
+ * program may run past its instruction limit by the rest of a block, or by
+ * the instructions skipped in a countdown loop.
+ */
+
+#include "watchdog.h"
+
+static bool past_deadline(watchdog_t *watchdog);
+
+/**
+ * @brief Sets limits on how long a program may run.
+ *
+ * @param machine The current system state.
+ * @param watchdog The watchdog to fill in, which must outlive the program.
+ * @param max_instructions The maximum number of instructions, or
+ * NO_INSTRUCTION_LIMIT.
+ * @param timeout_ms The maximum time in milliseconds, or 0 for no limit.
+ */
+void start_watchdog(system_state_t *machine, watchdog_t *watchdog,
+                    uint64_t max_instructions, uint64_t timeout_ms) {
+  watchdog->max_instructions = max_instructions;
+  watchdog->timed = timeout_ms != 0;
+  watchdog->reached = NO_LIMIT;
+  if (watchdog->timed) {
+    clock_gettime(CLOCK_MONOTONIC, &watchdog->deadline);
+    watchdog->deadline.tv_sec += timeout_ms / 1000;
+    watchdog->deadline.tv_nsec += (timeout_ms % 1000) * 1000000;
+    if (watchdog->deadline.tv_nsec >= 1000000000) {
+      watchdog->deadline.tv_sec++;
+      watchdog->deadline.tv_nsec -= 1000000000;
+    }
+  }
+
+  machine->watchdog = watchdog;
+  machine->next_check = machine->instructions;
+  check_watchdog(machine);
+}
+
+/**
+ * @brief Checks the limits on a program, and sets when they are next checked.
+ *
+ * Once a limit has been reached, the limits are checked every time.
+ * @param machine The current system state.
+ * @returns Whether a limit has been reached.
+ */
+bool check_watchdog(system_state_t *machine) {
+  watchdog_t *watchdog = machine->watchdog;
+
+  if (!watchdog) {
+    machine->next_check = UINT64_MAX;
+    return false;
+  }
+  if (watchdog->reached == NO_LIMIT) {
+    if (machine->instructions >= watchdog->max_instructions) {
+      watchdog->reached = INSTRUCTION_LIMIT;
+    } else if (watchdog->timed && past_deadline(watchdog)) {
+      watchdog->reached = TIME_LIMIT;
+    }
+  }
+  if (watchdog->reached != NO_LIMIT) {
+    machine->next_check = 0;
+    return true;
+  }
+
+  machine->next_check = watchdog->max_instructions;
+  if (watchdog->timed
+    && machine->next_check - machine->instructions > WATCHDOG_INTERVAL) {
+    machine->next_check = machine->instructions + WATCHDOG_INTERVAL;
+  }
+  return false;
+}
+
+/**
+ * @brief Returns the name of a limit, for messages.
+ *
+ * @param limit The limit.
+ * @returns The name of the limit.
+ */
+const char *limit_name(limit_t limit) {
+  switch (limit) {
+    case INSTRUCTION_LIMIT:
+      return "instruction limit";
+    case TIME_LIMIT:
+      return "time limit";
+    case NO_LIMIT:
+    default:
+      return "no limit";
+  }
+}
+
+/**
+ * @brief Returns whether the deadline of a watchdog has passed.
+ *
+ * @param watchdog The watchdog, which has a time limit.
+ * @returns Whether the deadline has passed.
+ */
+static bool past_deadline(watchdog_t *watchdog) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec > watchdog->deadline.tv_sec
+         || (now.tv_sec == watchdog->deadline.tv_sec
+             && now.tv_nsec >= watchdog->deadline.tv_nsec);
+}
@@ -0,0 +1,63 @@
+/**
+ * @file watchdog.h
+ * @brief A header to define the watchdog_t type, and header file for
+ * watchdog.c.
+ */
+
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+#include <time.h>
+#include "../toolbox.h"
+
+/** The exit status of the emulator when the watchdog stops a program. */
+#define EXIT_WATCHDOG 2
+/** The number of instructions run between checks of the clock. */
+#define WATCHDOG_INTERVAL 65536
+/** No limit on the number of instructions. */
+#define NO_INSTRUCTION_LIMIT UINT64_MAX
+
+/**
+ * @brief An enum that identifies the limit which stopped a program.
+ */
+typedef enum {
+  /** No limit has been reached. */
+  NO_LIMIT,
+  /** The program ran the maximum number of instructions. */
+  INSTRUCTION_LIMIT,
+  /** The program ran for the maximum time. */
+  TIME_LIMIT,
+} limit_t;
+
+/**
+ * @brief A struct that holds the limits on how long a program may run.
+ */
+typedef struct watchdog {
+  /** The maximum number of instructions, or NO_INSTRUCTION_LIMIT. */
+  uint64_t max_instructions;
+  /** Whether the program has a time limit. */
+  bool timed;
+  /** The time at which the program is stopped, if timed. */
+  struct timespec deadline;
+  /** The limit which stopped the program, or NO_LIMIT. */
+  limit_t reached;
+} watchdog_t;
+
+void start_watchdog(system_state_t *machine, watchdog_t *watchdog,
+                    uint64_t max_instructions, uint64_t timeout_ms);
+bool check_watchdog(system_state_t *machine);
+const char *limit_name(limit_t limit);
+
+/**
+ * @brief Returns whether the program must be stopped.
+ *
+ * The engines call this between blocks, so it only compares the instruction
+ * count with the point at which the limits are next checked.
+ * @param machine The current system state.
+ * @returns Whether a limit has been reached.
+ */
+static inline bool watchdog_expired(system_state_t *machine) {
+  return machine->instructions >= machine->next_check
+         && check_watchdog(machine);
+}
+
+#endif
@@ -0,0 +1,275 @@
+/**
+ * @file writer.c
+ * @brief Functions for writing the emulator's output from another thread.
+ *
+ * Everything the emulator prints to stdout goes through writer_printf or
+ * writer_write. Once start_writer has been called, output is copied into a
+ * ring buffer of WRITER_BUFFER_BYTES, which a writer thread drains to stdout,
+ * so a program printing often (such as through GPIO) only pays for formatting
+ * its messages. There is a single buffer, so output is written in exactly the
+ * order it was printed. Until then (and in the assembler and the translator,
+ * which never start it) output is written to stdout straight away. The unit
+ * tests only start it in their last test, which leaves it running.
+ *
+ * The buffer is flushed by flush_writer, which exit_program calls, and when
+ * the process exits.
+ */
+
+#include "writer.h"
+
+static void *run_writer(void *unused);
+static void write_out(uint64_t end);
+static bool wait_for_batch(void);
+static void wake_writer(void);
+static void stop_writer(void);
+
+/** The output waiting to be written, from tail to head. */
+static char buffer[WRITER_BUFFER_BYTES];
+/** The number of bytes ever put in the buffer (only moved by the emulator). */
+static uint64_t head = 0;
+/** The number of bytes ever written to stdout (only moved by the writer). */
+static uint64_t tail = 0;
+/** The value of head when the writer thread was last woken. */
+static uint64_t woken_at = 0;
+/** Whether the writer thread is waiting for any output at all. */
+static bool idle = false;
+/** Whether the writer thread is running. */
+static bool started = false;
+/** Whether flush_writer is waiting, so the writer should not wait. */
+static bool flushing = false;
+/** Whether the writer thread should stop once the buffer is empty. */
+static bool stopping = false;
+static pthread_t thread;
+/** Guards flushing and stopping, and the waits of both threads. */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+/** Signalled when the writer thread should look at the buffer again. */
+static pthread_cond_t has_output = PTHREAD_COND_INITIALIZER;
+/** Signalled when output has been written out of the buffer. */
+static pthread_cond_t has_space = PTHREAD_COND_INITIALIZER;
+
+/**
+ * @brief Starts the writer thread, so that output is buffered.
+ *
+ * The buffer is flushed and the thread stopped when the process exits. If the
+ * thread cannot be started, output carries on being written straight away.
+ */
+void start_writer(void) {
+  if (started) {
+    return;
+  }
+  if (pthread_create(&thread, NULL, run_writer, NULL)) {
+    perror("Unable to start the output writer.\n");
+    return;
+  }
+  started = true;
+  atexit(stop_writer);
+}
+
+/**
+ * @brief Waits until all output printed so far has been written to stdout.
+ */
+void flush_writer(void) {
+  if (!started) {
+    fflush(stdout);
+    return;
+  }
+  pthread_mutex_lock(&lock);
+  flushing = true;
+  pthread_cond_signal(&has_output);
+  while (__atomic_load_n(&tail, __ATOMIC_ACQUIRE) != head) {
+    pthread_cond_wait(&has_space, &lock);
+  }
+  flushing = false;
+  pthread_mutex_unlock(&lock);
+}
+
+/**
+ * @brief Prints a string, without formatting it.
+ *
+ * Cheaper than writer_printf for messages which are always the same.
+ * @param text The string to print.
+ */
+void writer_print(const char *text) {
+  writer_write(text, strlen(text));
+}
+
+/**
+ * @brief Prints formatted output, as printf does.
+ *
+ * Messages up to WRITER_LINE_BYTES long are formatted on the stack, and
+ * longer ones in a temporary allocation.
+ * @param format The format string.
+ * @param ... The values to format.
+ */
+void writer_printf(const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  if (!started) {
+    vprintf(format, args);
+    va_end(args);
+    return;
+  }
+
+  char line[WRITER_LINE_BYTES];
+  va_list retry;
+  va_copy(retry, args);
+  int length = vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+  if (length >= 0 && (size_t) length < sizeof(line)) {
+    writer_write(line, length);
+  } else if (length >= 0) {
+    char *long_line = malloc(length + 1);
+    if (!long_line) {
+      perror("Unable to allocate memory for output.\n");
+      exit(EXIT_FAILURE);
+    }
+    vsnprintf(long_line, length + 1, format, retry);
+    writer_write(long_line, length);
+    free(long_line);
+  }
+  va_end(retry);
+}
+
+/**
+ * @brief Writes bytes of output.
+ *
+ * Copying into the buffer takes no lock. The writer thread is only woken
+ * when it is idle, or a batch of WRITER_BATCH_BYTES is ready, and waited for
+ * if the buffer is full.
+ * @param bytes The bytes to write.
+ * @param size The number of bytes to write.
+ */
+void writer_write(const void *bytes, size_t size) {
+  if (!started) {
+    fwrite(bytes, 1, size, stdout);
+    return;
+  }
+
+  const char *next = bytes;
+  while (size) {
+    uint64_t space = WRITER_BUFFER_BYTES
+                     - (head - __atomic_load_n(&tail, __ATOMIC_ACQUIRE));
+    if (!space) {
+      pthread_mutex_lock(&lock);
+      pthread_cond_signal(&has_output);
+      while (head - __atomic_load_n(&tail, __ATOMIC_ACQUIRE)
+             == WRITER_BUFFER_BYTES) {
+        pthread_cond_wait(&has_space, &lock);
+      }
+      pthread_mutex_unlock(&lock);
+      continue;
+    }
+
+    // Copy as much as fits before the buffer is full or wraps around
+    size_t to_end = WRITER_BUFFER_BYTES - head % WRITER_BUFFER_BYTES;
+    size_t chunk = size < space ? size : space;
+    chunk = chunk < to_end ? chunk : to_end;
+    memcpy(buffer + head % WRITER_BUFFER_BYTES, next, chunk);
+    __atomic_store_n(&head, head + chunk, __ATOMIC_SEQ_CST);
+    next += chunk;
+    size -= chunk;
+
+    // Either this sees idle, or the writer sees the new head
+    if (__atomic_load_n(&idle, __ATOMIC_SEQ_CST)
+      || head - woken_at >= WRITER_BATCH_BYTES) {
+      wake_writer();
+    }
+  }
+}
+
+/**
+ * @brief Writes the buffer to stdout until the writer is stopped.
+ *
+ * Output is written once a batch is ready, after waiting WRITER_DELAY_MS for
+ * one, or straight away when flushing or stopping.
+ * @param unused Unused.
+ * @returns NULL.
+ */
+static void *run_writer(void *unused) {
+  bool late = false;
+  pthread_mutex_lock(&lock);
+  while (true) {
+    uint64_t end = __atomic_load_n(&head, __ATOMIC_SEQ_CST);
+    uint64_t available = end - tail;
+    if (!available && stopping) {
+      break;
+    }
+    if (available >= WRITER_BATCH_BYTES
+      || (available && (late || flushing || stopping))) {
+      pthread_mutex_unlock(&lock);
+      write_out(end);
+      pthread_mutex_lock(&lock);
+      pthread_cond_broadcast(&has_space);
+      late = false;
+    } else if (available) {
+      late = wait_for_batch();
+    } else {
+      // Either this sees the new head, or the emulator sees idle
+      __atomic_store_n(&idle, true, __ATOMIC_SEQ_CST);
+      if (__atomic_load_n(&head, __ATOMIC_SEQ_CST) == tail && !stopping) {
+        pthread_cond_wait(&has_output, &lock);
+      }
+      __atomic_store_n(&idle, false, __ATOMIC_SEQ_CST);
+    }
+  }
+  pthread_mutex_unlock(&lock);
+  return NULL;
+}
+
+/**
+ * @brief Writes the buffer up to a point to stdout.
+ *
+ * The lock is not held, as the bytes being written are not reused until tail
+ * moves past them.
+ * @param end The value of head to write up to.
+ */
+static void write_out(uint64_t end) {
+  for (uint64_t start = tail; start != end;) {
+    size_t to_end = WRITER_BUFFER_BYTES - start % WRITER_BUFFER_BYTES;
+    size_t chunk = end - start < to_end ? end - start : to_end;
+    fwrite(buffer + start % WRITER_BUFFER_BYTES, 1, chunk, stdout);
+    start += chunk;
+  }
+  fflush(stdout);
+  __atomic_store_n(&tail, end, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Waits up to WRITER_DELAY_MS for the rest of a batch.
+ *
+ * Must be called with the lock held.
+ * @returns Whether the wait timed out.
+ */
+static bool wait_for_batch(void) {
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_nsec += WRITER_DELAY_MS * 1000000L;
+  if (deadline.tv_nsec >= 1000000000L) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000L;
+  }
+  return pthread_cond_timedwait(&has_output, &lock, &deadline) != 0;
+}
+
+/**
+ * @brief Wakes the writer thread to look at the buffer.
+ */
+static void wake_writer(void) {
+  pthread_mutex_lock(&lock);
+  pthread_cond_signal(&has_output);
+  pthread_mutex_unlock(&lock);
+  woken_at = head;
+}
+
+/**
+ * @brief Flushes the buffer and stops the writer thread, when the process
+ * exits.
+ */
+static void stop_writer(void) {
+  pthread_mutex_lock(&lock);
+  stopping = true;
+  pthread_cond_signal(&has_output);
+  pthread_mutex_unlock(&lock);
+  pthread_join(thread, NULL);
+  started = false;
+}
@@ -0,0 +1,32 @@
+/**
+ * @file writer.h
+ * @brief Header file for writer.c.
+ */
+
+#ifndef WRITER_H
+#define WRITER_H
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/** The number of bytes of output buffered for the writer thread. */
+#define WRITER_BUFFER_BYTES (1 << 20)
+/** The number of bytes the writer thread waits for before writing. */
+#define WRITER_BATCH_BYTES (1 << 16)
+/** The longest time output waits for a batch to fill, in milliseconds. */
+#define WRITER_DELAY_MS 10
+/** The number of bytes of a formatted message which are kept on the stack. */
+#define WRITER_LINE_BYTES 256
+
+void start_writer(void);
+void flush_writer(void);
+void writer_print(const char *text);
+void writer_printf(const char *format, ...);
+void writer_write(const void *bytes, size_t size);
+
+#endif
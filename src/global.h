@@ -9,19 +9,56 @@
 
 /** The total number of registers. */
 #define NUM_REGISTERS 17
-/** The total number of memory addresses. */
+/**
+ * The number of addresses in which programs are loaded and code is cached,
+ * which is also the default size of memory.
+ */
 #define NUM_ADDRESSES 65536
+/** The total number of words in which code is cached. */
+#define NUM_WORDS (NUM_ADDRESSES / 4)
+/** The log2 of the number of bytes in a page of cached code. */
+#define PAGE_BITS 10
+/** The number of bytes in a page of cached code. */
+#define PAGE_BYTES (1 << PAGE_BITS)
+/** The total number of pages of cached code. */
+#define NUM_PAGES (NUM_ADDRESSES / PAGE_BYTES)
+/** The number of words in a page of cached code. */
+#define WORDS_PER_PAGE (PAGE_BYTES / 4)
+/** The log2 of the number of bytes in a page of memory. */
+#define MEMORY_PAGE_BITS 12
+/** The number of bytes in a page of memory, which is allocated when written. */
+#define MEMORY_PAGE_BYTES (1 << MEMORY_PAGE_BITS)
+/** The number of bytes of memory tested at once when scanning for zeros. */
+#define SCAN_CHUNK_BYTES 64
+/** The largest size of memory. Devices (such as GPIO) lie above memory. */
+#define MAX_MEMORY_SIZE 0x20000000
 /** The architecture word size. */
 #define WORD_SIZE 32
+/** The size of a host cache line, in bytes. */
+#define CACHE_LINE_SIZE 64
+/** The register number of the stack pointer. */
+#define SP 13
+/** The register number of the link register. */
+#define LR 14
 /** The register number of the program counter. */
 #define PC 15
 /** The register number of the current program status register. */
 #define CPSR 16
+/** The number of condition codes. */
+#define NUM_CONDITIONS 16
 /** A mask which removes the first 4 bits when used with bitwise and. */
 #define MASK_FIRST_4 0xFFFFFFF
 /** A mask which removes the first 8 bits when used with bitwise and. */
 #define MASK_FIRST_8 0xFFFFFF
 
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+/**
+ * Defined when the host stores words in the same (little endian) byte order
+ * as the emulated memory, so words can be copied to and from memory directly.
+ */
+#define HOST_LITTLE_ENDIAN
+#endif
+
 /** The first memory address for accessing GPIO pins. */
 #define GPIO_ACCESS_START 0x20200000
 /** The number of bytes allocated for accessing GPIO pins. */
@@ -43,25 +80,54 @@
 #define MAX_LINE_LENGTH 512
 
 /**
- * @brief A setting which determines the format of output.
- *
- * * Using COMPLIANT_MODE will print to stdout in the exact format required by
- * test cases. Only registers and memory are printed. Errors are printed to
- * stdout.
- * * Otherwise, a much more detailed ouput will be printed, including details
- * on instructions. Formatting is improved. Errors are printed to stderr. The
- * recommended setting is false.
+ * @brief An enum that identifies the format of the emulator's output, chosen
+ * with --output.
  */
-#define COMPLIANT_MODE true
+typedef enum {
+  /**
+   * The exact format required by test cases. Only registers and memory are
+   * printed. Memory errors are printed to stdout, and the program carries on.
+   */
+  COMPLIANT_OUTPUT = 0,
+  /**
+   * A much more detailed output, including a trace of each cycle and details
+   * on instructions. Memory errors are printed to stderr, and stop the
+   * program.
+   */
+  VERBOSE_OUTPUT,
+  /** Nothing is printed, and memory errors are ignored, as when compliant. */
+  SILENT_OUTPUT,
+  /**
+   * The final registers (as little endian words) then every byte of memory
+   * are written to stdout. Nothing else is printed, as when silent.
+   */
+  BINARY_OUTPUT,
+} output_t;
 
 /**
  * @brief An enum that identifies the type of condition.
  */
 typedef enum {
-  /** Equal. */
+  /** Equal (Z set). */
   EQ = 0,
-  /** Not equal. */
+  /** Not equal (Z clear). */
   NE = 1,
+  /** Carry set, or unsigned higher or same (C set). */
+  CS = 2,
+  /** Carry clear, or unsigned lower (C clear). */
+  CC = 3,
+  /** Minus, or negative (N set). */
+  MI = 4,
+  /** Plus, or positive or zero (N clear). */
+  PL = 5,
+  /** Overflow (V set). */
+  VS = 6,
+  /** No overflow (V clear). */
+  VC = 7,
+  /** Unsigned higher (C set and Z clear). */
+  HI = 8,
+  /** Unsigned lower or same (C clear or Z set). */
+  LS = 9,
   /** Greater or equal. */
   GE = 0xA,
   /** Less than. */
@@ -72,6 +138,11 @@ typedef enum {
   LE = 0xD,
   /** No condition (always). */
   AL = 0xE,
+  /**
+   * Never. ARMv6 uses this code for unconditional extensions, which are not
+   * emulated, so it never passes.
+   */
+  NV = 0xF,
 } condition_t;
 
 /**
@@ -86,6 +157,8 @@ typedef enum {
   SDT,
   /** Branch instruction. */
   BRA,
+  /** Block data transfer (load or store multiple) instruction. */
+  BDT,
   /** All zero (STOP) instruction. */
   ZER,
   /** NULL (not present) instruction. */
@@ -132,6 +205,22 @@ typedef enum {
   MOV = 0xD,
 } opcode_t;
 
+/**
+ * @brief An enum used for defining the size of a single data transfer.
+ */
+typedef enum {
+  /** A word (ldr and str). */
+  WORD_TRANSFER = 0,
+  /** An unsigned byte (ldrb and strb). */
+  BYTE_TRANSFER,
+  /** An unsigned halfword (ldrh and strh). */
+  HALF_TRANSFER,
+  /** A byte, sign extended when loaded (ldrsb). */
+  SIGNED_BYTE_TRANSFER,
+  /** A halfword, sign extended when loaded (ldrsh). */
+  SIGNED_HALF_TRANSFER,
+} transfer_t;
+
 /**
  * @brief An enum used for retrieving individual flag bits from CPSR register
  */
@@ -178,6 +267,10 @@ typedef enum {
   LDR_M,
   /** Store.*/
   STR_M,
+  /** Load multiple.*/
+  LDM_M,
+  /** Store multiple.*/
+  STM_M,
   /** Branch if equal.*/
   BEQ_M,
   /** Branch if negative.*/
@@ -190,8 +283,28 @@ typedef enum {
   BGT_M,
   /** Branch if less than or equal.*/
   BLE_M,
+  /** Branch if carry set (unsigned higher or same).*/
+  BCS_M,
+  /** Branch if carry clear (unsigned lower).*/
+  BCC_M,
+  /** Branch if negative.*/
+  BMI_M,
+  /** Branch if positive or zero.*/
+  BPL_M,
+  /** Branch if overflow.*/
+  BVS_M,
+  /** Branch if no overflow.*/
+  BVC_M,
+  /** Branch if unsigned higher.*/
+  BHI_M,
+  /** Branch if unsigned lower or same.*/
+  BLS_M,
+  /** Branch never.*/
+  BNV_M,
   /** Unconditional branch.*/
   B_M,
+  /** Branch with link, with any condition.*/
+  BL_M,
   /** Shift.*/
   SHIFT_M,
   /** And eq, an all zero command. */
@@ -202,8 +315,8 @@ typedef enum {
 typedef uint8_t byte_t;
 /** A type alias for a register number (supports up to 2^8 registers). */
 typedef int8_t reg_address_t;
-/** A type alias for a memory address (supports up to 2^16 addresses). */
-typedef uint16_t address_t;
+/** A type alias for a memory address (supports up to 2^32 addresses). */
+typedef uint32_t address_t;
 /** A type alias for a word (32 bits). */
 typedef uint32_t word_t;
 
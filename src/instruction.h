@@ -12,14 +12,17 @@
  * @brief A struct that holds information about a decoded instruction.
  */
 typedef struct {
-  /** The type of instruction (None, Zero, DPI, MUL, SDT, or BRA). */
+  /** The type of instruction (None, Zero, DPI, MUL, SDT, BRA or BDT). */
   instruction_type_t type;
   /** The condition code. */
   byte_t cond;
   /** The opcode, for data processing instructions. */
   opcode_t operation;
 
-  /** An immediate offset or operand. */
+  /**
+   * An immediate offset or operand, or the register list of a block data
+   * transfer (bit n set if register n is transferred).
+   */
   uint32_t immediate_value;
 
   /** Register Rn. */
@@ -31,19 +34,24 @@ typedef struct {
   /** Register Rm. */
   reg_address_t rm;
 
-  /** Holds the I or A bit (depending on instruction type). */
+  /** Holds the I, A or W bit (depending on instruction type). */
   bool flag_0;
   /** Holds the S or P bit (depending on instruction type). */
   bool flag_1;
-  /** Holds the U bit (SDT instructions only). */
+  /** Holds the U bit (SDT and BDT instructions only). */
   bool flag_2;
-  /** Holds the L bit (SDT instructions only). */
+  /** Holds the L bit (SDT, BDT and BRA instructions only). */
   bool flag_3;
 
   /** The type of shift to be used. */
   shift_t shift_type;
   /** The number of shifts to be applied. */
   byte_t shift_amount;
+  /** The size of a single data transfer (a transfer_t). */
+  byte_t transfer;
+
+  /** The variant, for data processing instructions (see dpi_variants.h). */
+  uint16_t variant;
 } instruction_t;
 
 #endif
@@ -4,29 +4,55 @@
  */
 
 #include "toolbox.h"
+#include "emulate_utils/mmio.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static byte_t *writable_page(system_state_t *machine, uint32_t page);
+static bool in_one_page(system_state_t *machine, uint32_t mem_address,
+                        uint32_t size);
+static uint32_t next_written_page(system_state_t *machine, uint32_t page);
+static bool is_zero_chunk(const byte_t *bytes);
+static void write_to_code(system_state_t *machine, uint32_t mem_address);
+
+/**
+ * The page of every machine's memory which has not been written to. It is
+ * never written to.
+ */
+static byte_t zero_page[MEMORY_PAGE_BYTES];
 
 /**
  * @brief Loads a binary file into the memory.
  *
- * Writes the contents of the provided binary object code file to the memory,
- * starting at the provided location. Returns an error message and exits if the
- * file cannot be opened or cannot be read.
+ * Writes the contents of the provided binary object code file to the memory
+ * of the machine, starting at address 0. Only pages holding non-zero bytes
+ * are allocated. Returns an error message and exits if the file cannot be
+ * opened or cannot be read.
  * @param fname The filename containing object code to be loaded.
- * @param memory A pointer to the first byte of memory to be written to.
+ * @param machine The system state to load the object code into.
  */
-void load_file(char *fname, byte_t *memory) {
+void load_file(char *fname, system_state_t *machine) {
    // Try to open the file
    FILE *file = fopen(fname, "rb");
    if (file == NULL) {
      perror("Error in opening object code file.");
      exit(EXIT_FAILURE);
    }
-   // Try to read all lines into the memory
-   size_t size = fread(memory, NUM_ADDRESSES, 1, file);
-   if (ferror(file)) {
-     printf("File size: %lu", size);
-     perror("Error in reading from object code file.");
-     exit(EXIT_FAILURE);
+   // Read the file a page at a time, up to the end of memory
+   byte_t page[MEMORY_PAGE_BYTES];
+   for (uint32_t address = 0; address < machine->memory.size;
+        address += MEMORY_PAGE_BYTES) {
+     size_t size = fread(page, 1, MEMORY_PAGE_BYTES, file);
+     if (ferror(file)) {
+       writer_printf("File size: %lu", (unsigned long) (address + size));
+       perror("Error in reading from object code file.");
+       exit(EXIT_FAILURE);
+     }
+     write_bytes(machine, address, page, size);
+     if (size < MEMORY_PAGE_BYTES) {
+       break;
+     }
    }
    // Close the file
    fclose(file);
@@ -35,113 +61,640 @@ void load_file(char *fname, byte_t *memory) {
 /**
  * @brief Exits gracefully.
  *
- * Prints the current system state, frees allocated memory and exits with a
- * failure. To be used in the case of an error which cannot be recovered from.
+ * Prints the current system state (unless the machine is quiet), waits for
+ * all output to be written, frees allocated memory and exits with a failure.
+ * To be used in the case of an error which cannot be recovered from.
  * @param machine The current system state.
  */
 void exit_program(system_state_t *machine) {
-  print_system_state(machine);
-  free(machine->decoded_instruction);
-  free(machine);
+  if (!machine->quiet) {
+    print_system_state(machine);
+  }
+  flush_writer();
+  if (machine->free_block_cache) {
+    machine->free_block_cache(machine->block_cache);
+  }
+  free(machine->decode_cache);
+  free_system_state(machine);
   exit(EXIT_FAILURE);
 }
 
+/**
+ * @brief Allocates a 0-initialised system state, aligned to a cache line.
+ *
+ * Nothing has been fetched or decoded, and memory is NUM_ADDRESSES bytes,
+ * none of which are allocated. Exits if memory cannot be allocated.
+ * @returns The system state, to be freed with free_system_state.
+ */
+system_state_t *create_system_state(void) {
+  void *allocated;
+  if (posix_memalign(&allocated, CACHE_LINE_SIZE, sizeof(system_state_t))) {
+    perror("Cannot allocate memory to store system_state.\n");
+    exit(EXIT_FAILURE);
+  }
+  system_state_t *machine = allocated;
+  memset(machine, 0, sizeof(system_state_t));
+  machine->decoded_instruction.type = NUL;
+  machine->next_check = UINT64_MAX;
+  for (size_t i = 0; i < NUM_PAGES; i++) {
+    // Unused decode cache entries have generation 0, so are never current
+    machine->page_generations[i] = 1;
+  }
+  set_memory_size(machine, NUM_ADDRESSES);
+  return machine;
+}
+
+/**
+ * @brief Frees a system state and its memory.
+ *
+ * The decode and block caches are not freed.
+ * @param machine The system state, from create_system_state.
+ */
+void free_system_state(system_state_t *machine) {
+  for (uint32_t i = 0; i < machine->memory.size >> MEMORY_PAGE_BITS; i++) {
+    if (machine->memory.pages[i] != zero_page) {
+      free(machine->memory.pages[i]);
+    }
+  }
+  free(machine->memory.pages);
+  free(machine->memory.written);
+  free(machine->memory.stored);
+  free(machine);
+}
+
+/**
+ * @brief Sets the number of bytes of memory.
+ *
+ * Pages added are unallocated, and pages removed are freed. Only the table of
+ * pages is allocated, at one pointer per MEMORY_PAGE_BYTES bytes. Exits if
+ * memory cannot be allocated.
+ * @param machine The current system state.
+ * @param size The size of memory, a multiple of MEMORY_PAGE_BYTES from
+ * NUM_ADDRESSES to MAX_MEMORY_SIZE.
+ */
+void set_memory_size(system_state_t *machine, uint32_t size) {
+  assert(size % MEMORY_PAGE_BYTES == 0);
+  assert(size >= NUM_ADDRESSES && size <= MAX_MEMORY_SIZE);
+  uint32_t old_pages = machine->memory.size >> MEMORY_PAGE_BITS;
+  uint32_t new_pages = size >> MEMORY_PAGE_BITS;
+
+  for (uint32_t i = new_pages; i < old_pages; i++) {
+    if (machine->memory.pages[i] != zero_page) {
+      free(machine->memory.pages[i]);
+      machine->memory.written[i / 64] &= ~((uint64_t) 1 << (i % 64));
+    }
+    machine->memory.stored[i / 64] &= ~((uint64_t) 1 << (i % 64));
+  }
+  byte_t **pages = realloc(machine->memory.pages, new_pages * sizeof(byte_t *));
+  size_t old_words = (old_pages + 63) / 64;
+  size_t new_words = (new_pages + 63) / 64;
+  uint64_t *written = realloc(machine->memory.written,
+                              new_words * sizeof(uint64_t));
+  uint64_t *stored = realloc(machine->memory.stored,
+                             new_words * sizeof(uint64_t));
+  if (!pages || !written || !stored) {
+    perror("Cannot allocate memory to store the memory page table.\n");
+    exit(EXIT_FAILURE);
+  }
+  for (uint32_t i = old_pages; i < new_pages; i++) {
+    pages[i] = zero_page;
+  }
+  for (size_t i = old_words; i < new_words; i++) {
+    written[i] = 0;
+    stored[i] = 0;
+  }
+  machine->memory.pages = pages;
+  machine->memory.written = written;
+  machine->memory.stored = stored;
+  machine->memory.size = size;
+}
+
+/**
+ * @brief Returns a page of memory, if it has been written to.
+ *
+ * Used to walk only the memory which may not be 0.
+ * @param machine The current system state.
+ * @param page The number of the page (its address >> MEMORY_PAGE_BITS).
+ * @returns The bytes of the page, or NULL if it has not been written to.
+ */
+const byte_t *memory_page(system_state_t *machine, uint32_t page) {
+  byte_t *bytes = machine->memory.pages[page];
+  return bytes == zero_page ? NULL : bytes;
+}
+
+/**
+ * @brief Returns the address of the next non-zero word of memory.
+ *
+ * Only pages which have been written to are read, found from the bitmap of
+ * written pages, and each is scanned SCAN_CHUNK_BYTES at a time, skipping
+ * chunks of zeros (with SSE2, where the host has it).
+ * @param machine The current system state.
+ * @param mem_address The word aligned address to search from.
+ * @returns The address of the first non-zero word at or after mem_address, or
+ * the size of memory if there is none.
+ */
+uint32_t next_nonzero_word(system_state_t *machine, uint32_t mem_address) {
+  uint32_t num_pages = machine->memory.size >> MEMORY_PAGE_BITS;
+  uint32_t page = mem_address >> MEMORY_PAGE_BITS;
+  uint32_t offset = mem_address % MEMORY_PAGE_BYTES;
+
+  for (page = next_written_page(machine, page); page < num_pages;
+       page = next_written_page(machine, page + 1), offset = 0) {
+    const byte_t *bytes = machine->memory.pages[page];
+    while (offset < MEMORY_PAGE_BYTES) {
+      if (!(offset % SCAN_CHUNK_BYTES) && is_zero_chunk(bytes + offset)) {
+        offset += SCAN_CHUNK_BYTES;
+        continue;
+      }
+      if (read_le_word(bytes + offset)) {
+        return (page << MEMORY_PAGE_BITS) + offset;
+      }
+      offset += 4;
+    }
+  }
+  return machine->memory.size;
+}
+
+/**
+ * @brief Copies the memory of one machine to another.
+ *
+ * Only pages which have been written to in either machine are copied.
+ * @param to The system state to copy to.
+ * @param from The system state to copy from.
+ */
+void copy_memory(system_state_t *to, system_state_t *from) {
+  if (to->memory.size != from->memory.size) {
+    set_memory_size(to, from->memory.size);
+  }
+  for (uint32_t i = 0; i < from->memory.size >> MEMORY_PAGE_BITS; i++) {
+    if (from->memory.pages[i] != zero_page) {
+      memcpy(writable_page(to, i), from->memory.pages[i], MEMORY_PAGE_BYTES);
+    } else if (to->memory.pages[i] != zero_page) {
+      memset(to->memory.pages[i], 0, MEMORY_PAGE_BYTES);
+    }
+  }
+}
+
+/**
+ * @brief Returns whether two machines hold the same memory.
+ *
+ * @param machine The first system state.
+ * @param other The second system state.
+ * @returns Whether every byte of memory is the same.
+ */
+bool same_memory(system_state_t *machine, system_state_t *other) {
+  if (machine->memory.size != other->memory.size) {
+    return false;
+  }
+  for (uint32_t i = 0; i < machine->memory.size >> MEMORY_PAGE_BITS; i++) {
+    if (memcmp(machine->memory.pages[i], other->memory.pages[i],
+               MEMORY_PAGE_BYTES)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Writes bytes to memory, without checking for code.
+ *
+ * Used to load programs. Pages are only allocated for non-zero bytes.
+ * @param machine The current system state.
+ * @param mem_address The address of the first byte.
+ * @param bytes The bytes to write.
+ * @param size The number of bytes, which must fit in memory.
+ */
+void write_bytes(system_state_t *machine, uint32_t mem_address,
+                 const byte_t *bytes, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    uint32_t address = mem_address + i;
+    byte_t *page = machine->memory.pages[address >> MEMORY_PAGE_BITS];
+    if (bytes[i] || page != zero_page) {
+      page = writable_page(machine, address >> MEMORY_PAGE_BITS);
+      page[address % MEMORY_PAGE_BYTES] = bytes[i];
+    }
+  }
+}
+
 /**
  * @brief Gets a memory word from a given address.
  *
- * * If GPIO access adddress is read, prints a message to stdout.
- * * If another out of bounds address is read, prints an error.
+ * Memory is checked first, so an ordinary load is two comparisons, a lookup
+ * of its page and one host load (on a little endian host).
+ * * If a device (such as GPIO) is read, it is read by device_read.
+ * * If another out of bounds address is read, prints an error, which stops
+ *   the program for VERBOSE_OUTPUT.
+ *
+ * Nothing is printed if the machine is quiet.
  * @param machine The current system state.
  * @param mem_address The memory address to be read from.
  * @returns The word at the given memory address in the current system state.
  */
 word_t get_word(system_state_t *machine, uint32_t mem_address) {
-  if (mem_address >= GPIO_ACCESS_START
-    && mem_address < GPIO_ACCESS_START + GPIO_ACCESS_SIZE) {
-    // GPIO pin accessed
-    printf("One GPIO pin from %u to %u has been accessed\n",
-           (mem_address - GPIO_ACCESS_START) / 4 * 10,
-           (mem_address - GPIO_ACCESS_START) / 4 * 10 + 9);
-    return mem_address;
-  } else if (mem_address > NUM_ADDRESSES - 4) {
-    // Out of bounds memory access
-    if (COMPLIANT_MODE) {
-      printf("Error: Out of bounds memory access at address 0x%08x\n",
-             mem_address);
-      return 0;
-    } else {
-      fprintf(stderr, "Address: 0x%x was out of bounds in get_word",
-              mem_address);
-      exit_program(machine);
-    }
-  }
-  word_t value = 0;
-  for (size_t i = 0; i < 4; i++) {
-    value |= ((word_t) machine->memory[mem_address + i]) << (i * 8);
+  if (in_one_page(machine, mem_address, 4)) {
+    return read_le_word(machine->memory.pages[mem_address >> MEMORY_PAGE_BITS]
+                        + mem_address % MEMORY_PAGE_BYTES);
+  } else if (mem_address <= machine->memory.size - 4) {
+    // An unaligned word across two pages
+    word_t word = 0;
+    for (uint32_t i = 0; i < 4; i++) {
+      word |= (word_t) get_byte(machine, mem_address + i) << (8 * i);
+    }
+    return word;
   }
-  return value;
+  word_t word;
+  if (device_read(machine, mem_address, &word)) {
+    return word;
+  }
+
+  // Out of bounds memory access
+  if (machine->output != VERBOSE_OUTPUT) {
+    if (!machine->quiet) {
+      writer_printf("Error: Out of bounds memory access at address 0x%08x\n",
+                    mem_address);
+    }
+    return 0;
+  }
+  fprintf(stderr, "Address: 0x%x was out of bounds in get_word", mem_address);
+  exit_program(machine);
+  return 0;
 }
 
 /**
  * @brief Gets a memory word from a given address (for printing only).
  *
- * For use in compliant printing. Gets the word in little endian order.
+ * For use in compliant printing. Gets the word in little endian order, as
+ * the byte swap of the word which get_word reads.
  * @param machine The current system state.
- * @param mem_address The memory address to be read from.
+ * @param mem_address The memory address to be read from, inside memory.
  * @returns The word at the given memory address in the current system state.
  */
 word_t get_word_compliant(system_state_t *machine, address_t mem_address) {
-  word_t value = 0;
-  for (size_t i = 0; i < 4; i++) {
-    value |= ((word_t) machine->memory[mem_address + 3 - i]) << (i * 8);
-  }
-  return value;
+  return swap_bytes(get_word(machine, mem_address));
 }
 
 /**
  * @brief Writes a word to memory at a given address.
  *
- * * If GPIO access adddress is written to, prints a message to stdout.
- * * If GPIO clear or set adddress is written to, prints a message to stdout.
- * * If another out of bounds address is read, prints an error.
+ * Memory is checked first, so an ordinary store is two comparisons, a lookup
+ * of its page and one host store (on a little endian host), then the check
+ * for code. The page is allocated if it has not been written to.
+ * * If a device (such as GPIO) is written to, it is written by device_write.
+ * * If another out of bounds address is written to, prints an error, which
+ *   stops the program for VERBOSE_OUTPUT.
+ *
+ * Nothing is printed if the machine is quiet. If a word written to holds
+ * cached code, every cached decode of its page is invalidated.
  * @param machine The current system state.
  * @param mem_address The memory address to write to.
  * @param word The word to write to memory.
  */
 void set_word(system_state_t *machine, uint32_t mem_address, word_t word) {
-  if (mem_address >= GPIO_ACCESS_START
-    && mem_address < GPIO_ACCESS_START + GPIO_ACCESS_SIZE) {
-    // GPIO pin accessed
-    printf("One GPIO pin from %u to %u has been accessed\n",
-           (mem_address - GPIO_ACCESS_START) / 4 * 10,
-           (mem_address - GPIO_ACCESS_START) / 4 * 10 + 9);
+  if (in_one_page(machine, mem_address, 4)) {
+    write_le_word(writable_page(machine, mem_address >> MEMORY_PAGE_BITS)
+                  + mem_address % MEMORY_PAGE_BYTES, word);
+
+    // Check the (up to two) words written to for code
+    write_to_code(machine, mem_address);
+    if (mem_address % 4) {
+      write_to_code(machine, mem_address + 3);
+    }
     return;
-  } else if (mem_address >= GPIO_CLEAR_START
-    && mem_address < GPIO_CLEAR_START + GPIO_CLEAR_SIZE) {
-    // GPIO pin cleared
-    printf("PIN OFF\n");
+  } else if (mem_address <= machine->memory.size - 4) {
+    // An unaligned word across two pages
+    for (uint32_t i = 0; i < 4; i++) {
+      set_byte(machine, mem_address + i, (byte_t) (word >> (8 * i)));
+    }
     return;
-  } else if (mem_address >= GPIO_SET_START
-    && mem_address < GPIO_SET_START + GPIO_SET_SIZE) {
-    // GPIO pin set
-    printf("PIN ON\n");
+  } else if (device_write(machine, mem_address, word)) {
     return;
-  } else if (mem_address > NUM_ADDRESSES - 4) {
-    // Out of bounds memory access
-    if (COMPLIANT_MODE) {
-      printf("Error: Out of bounds memory access at address 0x%x\n",
-             mem_address);
-      return;
-    } else {
-      fprintf(stderr, "Address: 0x%x was out of bounds in set_word",
-              mem_address);
-      exit_program(machine);
+  }
+
+  // Out of bounds memory access
+  if (machine->output != VERBOSE_OUTPUT) {
+    if (!machine->quiet) {
+      writer_printf("Error: Out of bounds memory access at address 0x%x\n",
+                    mem_address);
     }
+    return;
+  }
+  fprintf(stderr, "Address: 0x%x was out of bounds in set_word", mem_address);
+  exit_program(machine);
+}
+
+/**
+ * @brief Gets a byte from memory at a given address.
+ *
+ * Addresses outside memory (GPIO and out of bounds) are passed to get_word,
+ * which reports them as it does for a word, and the bottom byte of its result
+ * is returned.
+ * @param machine The current system state.
+ * @param mem_address The memory address to be read from.
+ * @returns The byte at the given memory address.
+ */
+byte_t get_byte(system_state_t *machine, uint32_t mem_address) {
+  if (mem_address >= machine->memory.size) {
+    return (byte_t) get_word(machine, mem_address);
+  }
+  return machine->memory.pages[mem_address >> MEMORY_PAGE_BITS]
+                              [mem_address % MEMORY_PAGE_BYTES];
+}
+
+/**
+ * @brief Gets a little endian halfword from memory at a given address.
+ *
+ * An aligned halfword is read with a single host load (on a little endian
+ * host). Addresses outside memory are handled as in get_byte.
+ * @param machine The current system state.
+ * @param mem_address The memory address to be read from.
+ * @returns The halfword at the given memory address.
+ */
+uint16_t get_halfword(system_state_t *machine, uint32_t mem_address) {
+  if (mem_address > machine->memory.size - 2) {
+    return (uint16_t) get_word(machine, mem_address);
   }
-  for (size_t i = 0; i < 4; i++) {
-    machine->memory[mem_address + i] = (byte_t) (word & 0xFF);
-    word >>= 8;
+
+#ifdef HOST_LITTLE_ENDIAN
+  if (!(mem_address % 2)) {
+    // An aligned halfword is never across two pages
+    uint16_t halfword;
+    memcpy(&halfword, machine->memory.pages[mem_address >> MEMORY_PAGE_BITS]
+                      + mem_address % MEMORY_PAGE_BYTES, sizeof(halfword));
+    return halfword;
   }
+#endif
+  return (uint16_t) (get_byte(machine, mem_address)
+                     | (get_byte(machine, mem_address + 1) << 8));
+}
+
+/**
+ * @brief Writes a byte to memory at a given address.
+ *
+ * Addresses outside memory (GPIO and out of bounds) are passed to set_word,
+ * which reports them as it does for a word. If the byte is part of cached
+ * code, every cached decode of its page is invalidated.
+ * @param machine The current system state.
+ * @param mem_address The memory address to write to.
+ * @param byte The byte to write to memory.
+ */
+void set_byte(system_state_t *machine, uint32_t mem_address, byte_t byte) {
+  if (mem_address >= machine->memory.size) {
+    set_word(machine, mem_address, byte);
+    return;
+  }
+  writable_page(machine, mem_address >> MEMORY_PAGE_BITS)
+    [mem_address % MEMORY_PAGE_BYTES] = byte;
+  write_to_code(machine, mem_address);
+}
+
+/**
+ * @brief Writes a little endian halfword to memory at a given address.
+ *
+ * An aligned halfword is written with a single host store (on a little endian
+ * host). Addresses outside memory, and code, are handled as in set_byte.
+ * @param machine The current system state.
+ * @param mem_address The memory address to write to.
+ * @param halfword The halfword to write to memory.
+ */
+void set_halfword(system_state_t *machine, uint32_t mem_address,
+                  uint16_t halfword) {
+  if (mem_address > machine->memory.size - 2) {
+    set_word(machine, mem_address, halfword);
+    return;
+  }
+
+#ifdef HOST_LITTLE_ENDIAN
+  if (!(mem_address % 2)) {
+    memcpy(writable_page(machine, mem_address >> MEMORY_PAGE_BITS)
+           + mem_address % MEMORY_PAGE_BYTES, &halfword, sizeof(halfword));
+    write_to_code(machine, mem_address);
+    return;
+  }
+#endif
+  set_byte(machine, mem_address, (byte_t) halfword);
+  set_byte(machine, mem_address + 1, (byte_t) (halfword >> 8));
+}
+
+/**
+ * @brief Reads consecutive words from memory, as a block data transfer does.
+ *
+ * When every word is in one page of memory, the range is checked once and
+ * copied in bulk (directly, on a little endian host). Otherwise each word is
+ * read with get_word, so GPIO and out of bounds accesses behave as single
+ * loads.
+ * @param machine The current system state.
+ * @param mem_address The word aligned address of the first word.
+ * @param words The array to read into.
+ * @param count The number of words to read.
+ */
+void get_words(system_state_t *machine, uint32_t mem_address, word_t *words,
+               size_t count) {
+  if (!in_one_page(machine, mem_address, 4 * count)) {
+    for (size_t i = 0; i < count; i++) {
+      words[i] = get_word(machine, mem_address + 4 * i);
+    }
+    return;
+  }
+
+  byte_t *bytes = machine->memory.pages[mem_address >> MEMORY_PAGE_BITS]
+                  + mem_address % MEMORY_PAGE_BYTES;
+#ifdef HOST_LITTLE_ENDIAN
+  memcpy(words, bytes, 4 * count);
+#else
+  for (size_t i = 0; i < count; i++) {
+    words[i] = read_le_word(bytes + 4 * i);
+  }
+#endif
+}
+
+/**
+ * @brief Writes consecutive words to memory, as a block data transfer does.
+ *
+ * When every word is in one page of memory, the range is checked once and
+ * copied in bulk (directly, on a little endian host), and then each word is
+ * checked for code. Otherwise each word is written with set_word.
+ * @param machine The current system state.
+ * @param mem_address The word aligned address of the first word.
+ * @param words The words to write.
+ * @param count The number of words to write.
+ */
+void set_words(system_state_t *machine, uint32_t mem_address,
+               const word_t *words, size_t count) {
+  if (!in_one_page(machine, mem_address, 4 * count)) {
+    for (size_t i = 0; i < count; i++) {
+      set_word(machine, mem_address + 4 * i, words[i]);
+    }
+    return;
+  }
+
+  byte_t *bytes = writable_page(machine, mem_address >> MEMORY_PAGE_BITS)
+                  + mem_address % MEMORY_PAGE_BYTES;
+#ifdef HOST_LITTLE_ENDIAN
+  memcpy(bytes, words, 4 * count);
+#else
+  for (size_t i = 0; i < count; i++) {
+    write_le_word(bytes + 4 * i, words[i]);
+  }
+#endif
+  for (size_t i = 0; i < count; i++) {
+    write_to_code(machine, mem_address + 4 * i);
+  }
+}
+
+/**
+ * @brief Returns a page of memory which may be written to, allocating it if
+ * it has not been written to before.
+ *
+ * Every store goes through here, so the page is marked as stored to. Exits if
+ * memory cannot be allocated.
+ * @param machine The current system state.
+ * @param page The number of the page, inside memory.
+ * @returns The bytes of the page.
+ */
+static byte_t *writable_page(system_state_t *machine, uint32_t page) {
+  byte_t *bytes = machine->memory.pages[page];
+  machine->memory.stored[page / 64] |= (uint64_t) 1 << (page % 64);
+  if (bytes == zero_page) {
+    bytes = calloc(1, MEMORY_PAGE_BYTES);
+    if (!bytes) {
+      perror("Cannot allocate memory to store a memory page.\n");
+      exit(EXIT_FAILURE);
+    }
+    machine->memory.pages[page] = bytes;
+    machine->memory.written[page / 64] |= (uint64_t) 1 << (page % 64);
+  }
+  return bytes;
+}
+
+/**
+ * @brief Returns the next page of memory which has been written to.
+ *
+ * Reads the bitmap of written pages a word (of 64 pages) at a time.
+ * @param machine The current system state.
+ * @param page The page to search from.
+ * @returns The first written page at or after page, or the number of pages of
+ * memory if there is none.
+ */
+static uint32_t next_written_page(system_state_t *machine, uint32_t page) {
+  uint32_t num_pages = machine->memory.size >> MEMORY_PAGE_BITS;
+  while (page < num_pages) {
+    uint64_t bits = machine->memory.written[page / 64] >> (page % 64);
+    if (bits) {
+      return page + __builtin_ctzll(bits);
+    }
+    page = (page / 64 + 1) * 64;
+  }
+  return num_pages;
+}
+
+/**
+ * @brief Returns whether a chunk of memory is all zeros.
+ *
+ * @param bytes The first byte of the chunk, which is SCAN_CHUNK_BYTES
+ * aligned in its page.
+ * @returns Whether all SCAN_CHUNK_BYTES bytes are 0.
+ */
+static bool is_zero_chunk(const byte_t *bytes) {
+#ifdef __SSE2__
+  __m128i any = _mm_setzero_si128();
+  for (size_t i = 0; i < SCAN_CHUNK_BYTES; i += sizeof(__m128i)) {
+    any = _mm_or_si128(any, _mm_loadu_si128((const __m128i *) (bytes + i)));
+  }
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(any, _mm_setzero_si128()))
+         == 0xFFFF;
+#else
+  uint64_t any = 0;
+  for (size_t i = 0; i < SCAN_CHUNK_BYTES; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, bytes + i, sizeof(word));
+    any |= word;
+  }
+  return !any;
+#endif
+}
+
+/**
+ * @brief Returns whether a range of addresses lies inside a single page of
+ * memory.
+ *
+ * @param machine The current system state.
+ * @param mem_address The first address of the range.
+ * @param size The number of bytes in the range, from 1 to MEMORY_PAGE_BYTES.
+ * @returns Whether every address of the range is in the same page of memory.
+ */
+static bool in_one_page(system_state_t *machine, uint32_t mem_address,
+                        uint32_t size) {
+  return mem_address <= machine->memory.size - size
+         && mem_address % MEMORY_PAGE_BYTES <= MEMORY_PAGE_BYTES - size;
+}
+
+/**
+ * @brief Invalidates the cached decodes of a page if a store wrote to code.
+ *
+ * Only the bitmap is read when the word written to is not code, so stores to
+ * data cost a single test. Otherwise the generation of the page is bumped,
+ * and its bitmap is cleared until words of the page are decoded again. Code
+ * is only cached in the first NUM_ADDRESSES bytes of memory.
+ * @param machine The current system state.
+ * @param mem_address An address inside the word written to.
+ */
+static void write_to_code(system_state_t *machine, uint32_t mem_address) {
+  if (mem_address >= NUM_ADDRESSES
+    || !(*code_bits(machine, mem_address) & CODE_BIT(mem_address))) {
+    return;
+  }
+
+  uint32_t page = mem_address >> PAGE_BITS;
+  if (!++machine->page_generations[page]) {
+    // Generation 0 marks unused entries
+    machine->page_generations[page] = 1;
+  }
+  memset(machine->code_bitmap[page], 0, sizeof(machine->code_bitmap[page]));
+  machine->code_modified = true;
+}
+
+/**
+ * @brief Writes any pending flags to CPSR.
+ *
+ * Flag-setting instructions only record their inputs (see set_flags). This
+ * must be called before CPSR is read.
+ * @param machine The current system state.
+ */
+void update_flags(system_state_t *machine) {
+  lazy_flags_t *flags = &machine->flags;
+  if (!flags->pending) {
+    return;
+  }
+
+  // Only want the first four bits
+  machine->registers[CPSR] = (machine->registers[CPSR] & MASK_FIRST_4)
+                             | pending_flags(machine) << (WORD_SIZE - 4);
+  flags->pending = false;
+}
+
+/**
+ * @brief Returns the flags which update_flags writes for recorded flags.
+ *
+ * The overflow flag is only changed by arithmetic instructions, so is
+ * otherwise taken from CPSR.
+ * @param machine The current system state, with flags recorded.
+ * @returns The flags, as the top 4 bits of CPSR (N, Z, C and V).
+ */
+word_t pending_flags(system_state_t *machine) {
+  lazy_flags_t *flags = &machine->flags;
+  word_t cpsr_flags;
+  if (flags->arithmetic) {
+    cpsr_flags = C * arithmetic_carry(flags->op1, flags->op2, flags->result,
+                                      flags->subtract);
+    cpsr_flags |= V * arithmetic_overflow(flags->op1, flags->op2,
+                                          flags->result, flags->subtract);
+  } else {
+    cpsr_flags = C * flags->carry;
+    cpsr_flags |= (machine->registers[CPSR] >> (WORD_SIZE - 4)) & V;
+  }
+  cpsr_flags |= (N * is_negative(flags->result));
+  cpsr_flags |= (Z * (flags->result == 0));
+  return cpsr_flags;
 }
 
 /**
@@ -164,6 +717,39 @@ bool is_negative(word_t value) {
   return value >> 31;
 }
 
+/**
+ * @brief Returns the carry flag for an arithmetic operation.
+ *
+ * An addition carries out of bit 31, and a subtraction sets the flag when it
+ * does not borrow (op1 >= op2 unsigned), as ARM does.
+ * @param op1 The first operand.
+ * @param op2 The second operand.
+ * @param result The result of the operation.
+ * @param subtract Whether the result is op1 - op2, rather than op1 + op2.
+ * @returns Whether the carry flag is set.
+ */
+bool arithmetic_carry(word_t op1, word_t op2, word_t result, bool subtract) {
+  return subtract ? op1 >= op2 : result < op1;
+}
+
+/**
+ * @brief Returns the overflow flag for an arithmetic operation.
+ *
+ * The flag is set when the signed result does not fit in a word: the operands
+ * of an addition have the same sign (or those of a subtraction differ), and
+ * the result has the other sign to op1.
+ * @param op1 The first operand.
+ * @param op2 The second operand.
+ * @param result The result of the operation.
+ * @param subtract Whether the result is op1 - op2, rather than op1 + op2.
+ * @returns Whether the overflow flag is set.
+ */
+bool arithmetic_overflow(word_t op1, word_t op2, word_t result,
+                         bool subtract) {
+  word_t same_sign = subtract ? op1 ^ op2 : ~(op1 ^ op2);
+  return is_negative(same_sign & (op1 ^ result));
+}
+
 /**
  * @brief Returns absolute two's complement value.
  *
@@ -207,49 +793,74 @@ long twos_complement_to_long(word_t value) {
 }
 
 /**
- * @brief Shifts a value and returns a pointer.
+ * @brief Shifts a value.
  *
+ * Amounts of 32 or more are reduced modulo 32 where a shift would otherwise
+ * fall outside the word, as on x86-64, so that every amount has a defined
+ * result. A shift by 0 never sets the carry.
  * @param type The type of shift to use.
  * @param shift_amount The amount to shift by.
  * @param value The value to shift.
- * @returns The pointer to the shifted value.
+ * @returns The shifted value and carry.
  */
- value_carry_t *shifter(shift_t type, word_t shift_amount, word_t value) {
-   value_carry_t *result = malloc(sizeof(value_carry_t));
+value_carry_t shifter(shift_t type, word_t shift_amount, word_t value) {
+  value_carry_t result;
+  // The amount by which the carry is moved to the end of the word
+  word_t complement = (WORD_SIZE - shift_amount) & (WORD_SIZE - 1);
 
-   if (!result) {
-     perror("Unable to allocate memory for result of shifter");
-     exit(EXIT_FAILURE);
-   }
+  switch (type) {
+    case LSL:
+      result.value = (shift_amount >= WORD_SIZE) ? 0 : value << shift_amount;
+      result.carry = (value >> complement) & 0x1;
+      break;
+    case LSR:
+      result.value = (shift_amount >= WORD_SIZE) ? 0 : value >> shift_amount;
+      result.carry = (value << complement) >> (WORD_SIZE - 1);
+      break;
+    case ASR: {
+      uint64_t fill = ~((UINT64_C(1) << ((WORD_SIZE - shift_amount) & 63)) - 1);
+      result.value = (value >> (shift_amount & (WORD_SIZE - 1)))
+                     | (is_negative(value) ? (word_t) fill : 0);
+      result.carry = (value << complement) >> (WORD_SIZE - 1);
+      break;
+    }
+    case ROR:
+      result.value = (value << complement)
+                     | (value >> (shift_amount & (WORD_SIZE - 1)));
+      result.carry = (value << complement) >> (WORD_SIZE - 1);
+      break;
+    default:
+      fprintf(stderr, "Unknown shift type: %u", type);
+      exit(EXIT_FAILURE);
+  }
 
-   switch(type) {
-     case LSL:
-       result->value = (shift_amount >= WORD_SIZE) ? 0 : value << shift_amount;
-       result->carry = (value >> (WORD_SIZE - shift_amount)) & 0x1;
-       break;
-     case LSR:
-       result->value = (shift_amount >= WORD_SIZE) ? 0 : value >> shift_amount;
-       result->carry = (value << (WORD_SIZE - shift_amount)) & 0x80000000;
-       break;
-     case ASR:
-       result->value = (value >> shift_amount)
-                       | ((value & 0x80000000) ?
-                         ~((1L << (WORD_SIZE - shift_amount)) - 1L) : 0L);
-       result->carry = (value << (WORD_SIZE - shift_amount)) & 0x80000000;
-       break;
-     case ROR:
-       result->value = (value << (WORD_SIZE - shift_amount))
-                       | (value >> shift_amount);
-       result->carry = (value << (WORD_SIZE - shift_amount)) & 0x80000000;
-       break;
-     default:
-       fprintf(stderr, "Unknown shift type: %u", type);
-       exit(EXIT_FAILURE);
-   }
+  if (shift_amount == 0) {
+    result.carry = false;
+  }
 
-   if (shift_amount == 0) {
-     result->carry = false;
-   }
+  return result;
+}
 
-   return result;
- }
+/**
+ * @brief Rotates an immediate operand of a data processing instruction.
+ *
+ * Immediates are 8 bits, rotated right by an even amount up to 30, so every
+ * result is looked up in a table which is filled on the first call.
+ * @param rotation The amount to rotate by, as decoded into shift_amount.
+ * @param immediate The 8 bit immediate value.
+ * @returns The rotated value and carry, as shifter(ROR, ...) returns.
+ */
+value_carry_t rotate_immediate(word_t rotation, word_t immediate) {
+  static value_carry_t table[WORD_SIZE / 2][1 << 8];
+  static bool filled = false;
+
+  if (!filled) {
+    for (word_t i = 0; i < WORD_SIZE / 2; i++) {
+      for (word_t j = 0; j < (1 << 8); j++) {
+        table[i][j] = shifter(ROR, i << 1, j);
+      }
+    }
+    filled = true;
+  }
+  return table[rotation >> 1][immediate];
+}
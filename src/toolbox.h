@@ -8,23 +8,99 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "emulate_utils/system_state.h"
 #include "emulate_utils/value_carry.h"
 #include "emulate_utils/print.h"
+#include "emulate_utils/writer.h"
 
-void load_file(char *fname, byte_t *memory);
+void load_file(char *fname, system_state_t *machine);
 void exit_program(system_state_t *machine);
+system_state_t *create_system_state(void);
+void free_system_state(system_state_t *machine);
+
+void set_memory_size(system_state_t *machine, uint32_t size);
+const byte_t *memory_page(system_state_t *machine, uint32_t page);
+uint32_t next_nonzero_word(system_state_t *machine, uint32_t mem_address);
+void copy_memory(system_state_t *to, system_state_t *from);
+bool same_memory(system_state_t *machine, system_state_t *other);
+void write_bytes(system_state_t *machine, uint32_t mem_address,
+                 const byte_t *bytes, size_t size);
 
 word_t get_word(system_state_t *machine, uint32_t mem_address);
 word_t get_word_compliant(system_state_t *machine, address_t mem_address);
 void set_word(system_state_t *machine, uint32_t mem_address, word_t word);
+byte_t get_byte(system_state_t *machine, uint32_t mem_address);
+uint16_t get_halfword(system_state_t *machine, uint32_t mem_address);
+void set_byte(system_state_t *machine, uint32_t mem_address, byte_t byte);
+void set_halfword(system_state_t *machine, uint32_t mem_address,
+                  uint16_t halfword);
+void get_words(system_state_t *machine, uint32_t mem_address, word_t *words,
+               size_t count);
+void set_words(system_state_t *machine, uint32_t mem_address,
+               const word_t *words, size_t count);
+
+void update_flags(system_state_t *machine);
+word_t pending_flags(system_state_t *machine);
 
 word_t negate(word_t value);
 bool is_negative(word_t value);
+bool arithmetic_carry(word_t op1, word_t op2, word_t result, bool subtract);
+bool arithmetic_overflow(word_t op1, word_t op2, word_t result,
+                         bool subtract);
 word_t absolute(word_t value);
 uint32_t signed_to_twos_complement(int32_t value);
 long twos_complement_to_long(word_t value);
 
-value_carry_t *shifter(shift_t type, word_t shift_amount, word_t value);
+value_carry_t shifter(shift_t type, word_t shift_amount, word_t value);
+value_carry_t rotate_immediate(word_t rotation, word_t immediate);
+
+/**
+ * @brief Reads a little endian word from host memory.
+ *
+ * On a little endian host this is a single (possibly unaligned) load.
+ * @param bytes The first byte of the word.
+ * @returns The word.
+ */
+static inline word_t read_le_word(const byte_t *bytes) {
+#ifdef HOST_LITTLE_ENDIAN
+  word_t word;
+  memcpy(&word, bytes, sizeof(word));
+  return word;
+#else
+  return (word_t) bytes[0] | ((word_t) bytes[1] << 8)
+         | ((word_t) bytes[2] << 16) | ((word_t) bytes[3] << 24);
+#endif
+}
+
+/**
+ * @brief Writes a little endian word to host memory.
+ *
+ * On a little endian host this is a single (possibly unaligned) store.
+ * @param bytes The first byte of the word.
+ * @param word The word to write.
+ */
+static inline void write_le_word(byte_t *bytes, word_t word) {
+#ifdef HOST_LITTLE_ENDIAN
+  memcpy(bytes, &word, sizeof(word));
+#else
+  bytes[0] = (byte_t) word;
+  bytes[1] = (byte_t) (word >> 8);
+  bytes[2] = (byte_t) (word >> 16);
+  bytes[3] = (byte_t) (word >> 24);
+#endif
+}
+
+/**
+ * @brief Reverses the order of the bytes of a word.
+ *
+ * Compilers recognise this as a single byte swap instruction.
+ * @param word The word to reverse.
+ * @returns The reversed word.
+ */
+static inline word_t swap_bytes(word_t word) {
+  return (word >> 24) | ((word >> 8) & 0xFF00) | ((word << 8) & 0xFF0000)
+         | (word << 24);
+}
 
 #endif
@@ -1,6 +1,16 @@
+#include <unistd.h>
+#include "arm2c_utils/cfg.h"
+#include "emulate_utils/block.h"
 #include "emulate_utils/decode.h"
 #include "emulate_utils/execute.h"
+#include "emulate_utils/fusion.h"
+#include "emulate_utils/jit.h"
+#include "emulate_utils/mmio.h"
+#include "emulate_utils/options.h"
 #include "emulate_utils/print_compliant.h"
+#include "emulate_utils/threaded.h"
+#include "emulate_utils/trace.h"
+#include "emulate_utils/watchdog.h"
 
 #define run_test(fn_name) \
   printf("Running tests: %-20s ", #fn_name); \
@@ -8,37 +18,40 @@
   printf("Passed!\n");
 
 void test_load_file(void) {
-  byte_t load_file_memory[NUM_ADDRESSES] = {0};
-
-  load_file("unit_tests_utils/load_file_fname", load_file_memory);
-
-  assert(0x01 == load_file_memory[0]);
-  assert(0x10 == load_file_memory[1]);
-  assert(0xa0 == load_file_memory[2]);
-  assert(0xe3 == load_file_memory[3]);
-  assert(0x02 == load_file_memory[4]);
-  assert(0x20 == load_file_memory[5]);
-  assert(0xa0 == load_file_memory[6]);
-  assert(0xe3 == load_file_memory[7]);
-  assert(0x02 == load_file_memory[8]);
-  assert(0x00 == load_file_memory[9]);
-  assert(0x11 == load_file_memory[10]);
-  assert(0xe1 == load_file_memory[11]);
-  assert(0x00 == load_file_memory[12]);
-  assert(0x00 == load_file_memory[13]);
-  assert(0x00 == load_file_memory[14]);
-  assert(0x0a == load_file_memory[15]);
-  assert(0x03 == load_file_memory[16]);
-  assert(0x30 == load_file_memory[17]);
-  assert(0xa0 == load_file_memory[18]);
-  assert(0xe3 == load_file_memory[19]);
-  assert(0x04 == load_file_memory[20]);
-  assert(0x40 == load_file_memory[21]);
-  assert(0xa0 == load_file_memory[22]);
-  assert(0xe3 == load_file_memory[23]);
+  system_state_t *machine = create_system_state();
+
+  load_file("unit_tests_utils/load_file_fname", machine);
+
+  assert(0x01 == get_byte(machine, 0));
+  assert(0x10 == get_byte(machine, 1));
+  assert(0xa0 == get_byte(machine, 2));
+  assert(0xe3 == get_byte(machine, 3));
+  assert(0x02 == get_byte(machine, 4));
+  assert(0x20 == get_byte(machine, 5));
+  assert(0xa0 == get_byte(machine, 6));
+  assert(0xe3 == get_byte(machine, 7));
+  assert(0x02 == get_byte(machine, 8));
+  assert(0x00 == get_byte(machine, 9));
+  assert(0x11 == get_byte(machine, 10));
+  assert(0xe1 == get_byte(machine, 11));
+  assert(0x00 == get_byte(machine, 12));
+  assert(0x00 == get_byte(machine, 13));
+  assert(0x00 == get_byte(machine, 14));
+  assert(0x0a == get_byte(machine, 15));
+  assert(0x03 == get_byte(machine, 16));
+  assert(0x30 == get_byte(machine, 17));
+  assert(0xa0 == get_byte(machine, 18));
+  assert(0xe3 == get_byte(machine, 19));
+  assert(0x04 == get_byte(machine, 20));
+  assert(0x40 == get_byte(machine, 21));
+  assert(0xa0 == get_byte(machine, 22));
+  assert(0xe3 == get_byte(machine, 23));
   for (uint32_t i = 24; i < NUM_ADDRESSES; i++) {
-    assert(0x00 == load_file_memory[i]);
+    assert(0x00 == get_byte(machine, i));
   }
+  // Only the page holding the program is allocated
+  assert(memory_page(machine, 0) && !memory_page(machine, 1));
+  free_system_state(machine);
 }
 
 void test_print_system_state(void) {
@@ -52,26 +65,21 @@ void test_print_system_state(void) {
     .flag_0 = true,
     .flag_1 = true,
   };
-  system_state_t pss_state = {
-    .registers = {0},
-    .memory = {0},
-    .fetched_instruction = 0,
-    .decoded_instruction = &pss_instruction,
-    .has_fetched_instruction = false,
-  };
-  pss_state.registers[3] = 0xabcd0123;
-  pss_state.registers[16] = 0x0123abcd;
-  pss_state.memory[0] = 0xab;
-  pss_state.memory[3] = 0x12;
-  pss_state.memory[4] = 0x12;
-  pss_state.memory[65535] = 0xab;
-  print_system_state(&pss_state);
+  system_state_t *pss_state = create_system_state();
+  pss_state->decoded_instruction = pss_instruction;
+  pss_state->registers[3] = 0xabcd0123;
+  pss_state->registers[16] = 0x0123abcd;
+  set_byte(pss_state, 0, 0xab);
+  set_byte(pss_state, 3, 0x12);
+  set_byte(pss_state, 4, 0x12);
+  set_byte(pss_state, 65535, 0xab);
+  print_system_state(pss_state);
+  free_system_state(pss_state);
 }
 
-void test_shifter_values(word_t correct_value, bool correct_carry, value_carry_t *shifter_out) {
-  assert(shifter_out->value == correct_value);
-  assert(shifter_out->carry == correct_carry);
-  free(shifter_out);
+void test_shifter_values(word_t correct_value, bool correct_carry, value_carry_t shifter_out) {
+  assert(shifter_out.value == correct_value);
+  assert(shifter_out.carry == correct_carry);
 }
 
 void test_shifter (void) {
@@ -95,9 +103,19 @@ void test_shifter (void) {
   test_shifter_values(0x0F00001F, false, shifter(ROR, 32, 0x0F00001F));
   test_shifter_values(0xF0F00001, true, shifter(ROR, 36, 0x0F00001F));
   test_shifter_values(0x80000000, true, shifter(ROR, 64, 0x80000000));
+
+  // The rotate table matches the shifter for every immediate operand
+  test_shifter_values(0x3F000000, false, rotate_immediate(8, 0x3F));
+  for (word_t rotation = 0; rotation < WORD_SIZE; rotation += 2) {
+    for (word_t immediate = 0; immediate <= 0xFF; immediate++) {
+      value_carry_t expected = shifter(ROR, rotation, immediate);
+      test_shifter_values(expected.value, expected.carry,
+                          rotate_immediate(rotation, immediate));
+    }
+  }
 }
 
-static const instruction_t NULL_INSTRUCTION = {
+static const instruction_t BLANK_INSTRUCTION = {
   .type = NUL,
   .cond = AL,
   .operation = AND,
@@ -132,7 +150,7 @@ int equal_instruction(instruction_t i1, instruction_t i2) {
 }
 
 void test_decode_dpi(void) {
-  system_state_t *fetch1 = malloc(sizeof(system_state_t));
+  system_state_t *fetch1 = create_system_state();
   system_state_t fetch1_struct = {
     .registers = {0},
     .memory = {0},
@@ -142,8 +160,7 @@ void test_decode_dpi(void) {
     .has_fetched_instruction = true,
   };
   *fetch1 = fetch1_struct;
-  fetch1->decoded_instruction = malloc(sizeof(instruction_t));
-  *fetch1->decoded_instruction = NULL_INSTRUCTION;
+  fetch1->decoded_instruction = BLANK_INSTRUCTION;
   instruction_t decode1 = {
     .type = DPI,
     .cond = AL,
@@ -160,7 +177,7 @@ void test_decode_dpi(void) {
     .shift_type = ROR,
     .shift_amount = 4,
   };
-  system_state_t *fetch2 = malloc(sizeof(system_state_t));
+  system_state_t *fetch2 = create_system_state();
   system_state_t fetch2_struct = {
     .registers = {0},
     .memory = {0},
@@ -170,8 +187,7 @@ void test_decode_dpi(void) {
     .has_fetched_instruction = true,
   };
   *fetch2 = fetch2_struct;
-  fetch2->decoded_instruction = malloc(sizeof(instruction_t));
-  *fetch2->decoded_instruction = NULL_INSTRUCTION;
+  fetch2->decoded_instruction = BLANK_INSTRUCTION;
   instruction_t decode2 = {
     .type = DPI,
     .cond = EQ,
@@ -188,7 +204,7 @@ void test_decode_dpi(void) {
     .shift_type = LSL,
     .shift_amount = 4,
   };
-  system_state_t *fetch3 = malloc(sizeof(system_state_t));
+  system_state_t *fetch3 = create_system_state();
   system_state_t fetch3_struct = {
     .registers = {0},
     .memory = {0},
@@ -198,8 +214,7 @@ void test_decode_dpi(void) {
     .has_fetched_instruction = true,
   };
   *fetch3 = fetch3_struct;
-  fetch3->decoded_instruction = malloc(sizeof(instruction_t));
-  *fetch3->decoded_instruction = NULL_INSTRUCTION;
+  fetch3->decoded_instruction = BLANK_INSTRUCTION;
   instruction_t decode3 = {
     .type = DPI,
     .cond = GE,
@@ -219,19 +234,16 @@ void test_decode_dpi(void) {
   decode_instruction(fetch1);
   decode_instruction(fetch2);
   decode_instruction(fetch3);
-  assert(equal_instruction(*fetch1->decoded_instruction, decode1));
-  assert(equal_instruction(*fetch2->decoded_instruction, decode2));
-  assert(equal_instruction(*fetch3->decoded_instruction, decode3));
-  free(fetch1->decoded_instruction);
-  free(fetch2->decoded_instruction);
-  free(fetch3->decoded_instruction);
-  free(fetch1);
-  free(fetch2);
-  free(fetch3);
+  assert(equal_instruction(fetch1->decoded_instruction, decode1));
+  assert(equal_instruction(fetch2->decoded_instruction, decode2));
+  assert(equal_instruction(fetch3->decoded_instruction, decode3));
+  free_system_state(fetch1);
+  free_system_state(fetch2);
+  free_system_state(fetch3);
 }
 
 void test_decode_mul(void) {
-  system_state_t *fetch4 = malloc(sizeof(system_state_t));
+  system_state_t *fetch4 = create_system_state();
   system_state_t fetch4_struct = {
     .registers = {0},
     .memory = {0},
@@ -241,8 +253,7 @@ void test_decode_mul(void) {
     .has_fetched_instruction = true,
   };
   *fetch4 = fetch4_struct;
-  fetch4->decoded_instruction = malloc(sizeof(instruction_t));
-  *fetch4->decoded_instruction = NULL_INSTRUCTION;
+  fetch4->decoded_instruction = BLANK_INSTRUCTION;
   instruction_t decode4 = {
     .type = MUL,
     .cond = AL,
@@ -259,7 +270,7 @@ void test_decode_mul(void) {
     .shift_type = ROR,
     .shift_amount = 0,
   };
-  system_state_t *fetch5 = malloc(sizeof(system_state_t));
+  system_state_t *fetch5 = create_system_state();
   system_state_t fetch5_struct = {
     .registers = {0},
     .memory = {0},
@@ -269,8 +280,7 @@ void test_decode_mul(void) {
     .has_fetched_instruction = true,
   };
   *fetch5 = fetch5_struct;
-  fetch5->decoded_instruction = malloc(sizeof(instruction_t));
-  *fetch5->decoded_instruction = NULL_INSTRUCTION;
+  fetch5->decoded_instruction = BLANK_INSTRUCTION;
   instruction_t decode5 = {
     .type = MUL,
     .cond = AL,
@@ -289,16 +299,14 @@ void test_decode_mul(void) {
   };
   decode_instruction(fetch4);
   decode_instruction(fetch5);
-  assert(equal_instruction(*fetch4->decoded_instruction, decode4));
-  assert(equal_instruction(*fetch5->decoded_instruction, decode5));
-  free(fetch4->decoded_instruction);
-  free(fetch5->decoded_instruction);
-  free(fetch4);
-  free(fetch5);
+  assert(equal_instruction(fetch4->decoded_instruction, decode4));
+  assert(equal_instruction(fetch5->decoded_instruction, decode5));
+  free_system_state(fetch4);
+  free_system_state(fetch5);
 }
 
 void test_decode_sdt(void) {
-  system_state_t *fetch6 = malloc(sizeof(system_state_t));
+  system_state_t *fetch6 = create_system_state();
   system_state_t fetch6_struct = {
     .registers = {0},
     .memory = {0},
@@ -308,8 +316,7 @@ void test_decode_sdt(void) {
     .has_fetched_instruction = true,
   };
   *fetch6 = fetch6_struct;
-  fetch6->decoded_instruction = malloc(sizeof(instruction_t));
-  *fetch6->decoded_instruction = NULL_INSTRUCTION;
+  fetch6->decoded_instruction = BLANK_INSTRUCTION;
   instruction_t decode6 = {
     .type = SDT,
     .cond = AL,
@@ -326,7 +333,7 @@ void test_decode_sdt(void) {
     .shift_type = ASR,
     .shift_amount = 0,
   };
-  system_state_t *fetch7 = malloc(sizeof(system_state_t));
+  system_state_t *fetch7 = create_system_state();
   system_state_t fetch7_struct = {
     .registers = {0},
     .memory = {0},
@@ -336,8 +343,7 @@ void test_decode_sdt(void) {
     .has_fetched_instruction = true,
   };
   *fetch7 = fetch7_struct;
-  fetch7->decoded_instruction = malloc(sizeof(instruction_t));
-  *fetch7->decoded_instruction = NULL_INSTRUCTION;
+  fetch7->decoded_instruction = BLANK_INSTRUCTION;
   instruction_t decode7 = {
     .type = SDT,
     .cond = AL,
@@ -356,16 +362,14 @@ void test_decode_sdt(void) {
   };
   decode_instruction(fetch6);
   decode_instruction(fetch7);
-  assert(equal_instruction(*fetch6->decoded_instruction, decode6));
-  assert(equal_instruction(*fetch7->decoded_instruction, decode7));
-  free(fetch6->decoded_instruction);
-  free(fetch7->decoded_instruction);
-  free(fetch6);
-  free(fetch7);
+  assert(equal_instruction(fetch6->decoded_instruction, decode6));
+  assert(equal_instruction(fetch7->decoded_instruction, decode7));
+  free_system_state(fetch6);
+  free_system_state(fetch7);
 }
 
 void test_decode_bra(void) {
-  system_state_t *fetch8 = malloc(sizeof(system_state_t));
+  system_state_t *fetch8 = create_system_state();
   system_state_t fetch8_struct = {
     .registers = {0},
     .memory = {0},
@@ -375,8 +379,7 @@ void test_decode_bra(void) {
     .has_fetched_instruction = true,
   };
   *fetch8 = fetch8_struct;
-  fetch8->decoded_instruction = malloc(sizeof(instruction_t));
-  *fetch8->decoded_instruction = NULL_INSTRUCTION;
+  fetch8->decoded_instruction = BLANK_INSTRUCTION;
   instruction_t decode8 = {
     .type = BRA,
     .cond = GE,
@@ -394,9 +397,867 @@ void test_decode_bra(void) {
     .shift_amount = 0,
   };
   decode_instruction(fetch8);
-  assert(equal_instruction(*fetch8->decoded_instruction, decode8));
-  free(fetch8->decoded_instruction);
-  free(fetch8);
+  assert(equal_instruction(fetch8->decoded_instruction, decode8));
+  free_system_state(fetch8);
+}
+
+void test_decode_cache(void) {
+  system_state_t *cached = create_system_state();
+  cached->decode_cache = calloc(NUM_WORDS, sizeof(predecoded_t));
+  // AL      I MOV  S Rn0  Rd1  ROR0 Imm 1
+  // 1110 00 1 1101 0 0000 0001 0000 00000001
+  set_word(cached, 0x10, 0xE3A01001);
+  cached->registers[PC] = 0x14;
+  cached->fetched_instruction = 0xE3A01001;
+  cached->has_fetched_instruction = true;
+
+  // First decode fills the entry
+  cached->decoded_instruction = BLANK_INSTRUCTION;
+  decode_instruction_cached(cached);
+  assert(is_predecoded(cached, 0x10));
+  assert(cached->decode_cache[0x10 >> 2].word == 0xE3A01001);
+  assert(equal_instruction(cached->decode_cache[0x10 >> 2].instruction,
+                           cached->decoded_instruction));
+
+  // Second decode hits the entry
+  cached->decoded_instruction = BLANK_INSTRUCTION;
+  decode_instruction_cached(cached);
+  assert(cached->decoded_instruction.type == DPI);
+  assert(cached->decoded_instruction.operation == MOV);
+  assert(cached->decoded_instruction.rd == 1);
+
+  // Writing to data, in the same page or another, leaves the page alone
+  set_word(cached, 0x14, 0x12345678);
+  set_word(cached, PAGE_BYTES + 0x10, 0);
+  assert(is_predecoded(cached, 0x10));
+  assert(cached->page_generations[0] == 1);
+  assert(!cached->code_modified);
+
+  // Writing to either word overlapping the entry invalidates its page
+  set_word(cached, 0x10, 0);
+  assert(!is_predecoded(cached, 0x10));
+  assert(cached->page_generations[0] == 2);
+  assert(cached->code_modified);
+  cached->fetched_instruction = 0;
+  decode_instruction_cached(cached);
+  assert(is_predecoded(cached, 0x10));
+  set_word(cached, 0x0E, 0);
+  assert(!is_predecoded(cached, 0x10));
+  assert(cached->page_generations[0] == 3);
+
+  // A word overwritten after it was fetched runs as fetched, but is not
+  // cached, so the next decode sees the word in memory
+  cached->fetched_instruction = 0xE3A01001;
+  decode_instruction_cached(cached);
+  assert(cached->decoded_instruction.operation == MOV);
+  assert(!is_predecoded(cached, 0x10));
+  cached->fetched_instruction = get_word(cached, 0x10);
+  decode_instruction_cached(cached);
+  assert(is_predecoded(cached, 0x10));
+  assert(cached->decode_cache[0x10 >> 2].word == 0x00000000);
+
+  free(cached->decode_cache);
+  free_system_state(cached);
+}
+
+void test_dpi_variants(void) {
+  static const opcode_t opcodes[] = {AND, EOR, SUB, RSB, ADD, TST, TEQ, CMP,
+                                     ORR, MOV};
+  system_state_t *machine = create_system_state();
+  system_state_t *expected = create_system_state();
+
+  // Every variant matches operand2, alu and set_dpi_flags
+  for (size_t i = 0; i < sizeof(opcodes) / sizeof(opcodes[0]); i++) {
+    for (word_t operand = 0; operand < 0x1000; operand += 0x1D) {
+      for (word_t bits = 0; bits < 4; bits++) {
+        // I bit and S bit, with Rn = 1, Rd = 2 and Rm = 3. Shifts by a
+        // register (bit 4) keep bit 7 clear, as otherwise they are multiplies
+        word_t shift = operand & ((operand & 0x10) ? 0xF70 : 0xFF0);
+        word_t word = 0xE0012000 | ((bits & 1) << 25) | (opcodes[i] << 21)
+                      | ((bits >> 1) << 20)
+                      | ((bits & 1) ? operand : shift | 0x3);
+        machine->fetched_instruction = word;
+        machine->decoded_instruction = NULL_INSTRUCTION;
+        decode_instruction(machine);
+        instruction_t *instruction = &machine->decoded_instruction;
+        bool s = bits >> 1;
+        assert(instruction->variant % 2 == s);
+
+        for (int j = 0; j < NUM_REGISTERS; j++) {
+          machine->registers[j] = 0x9E3779B9 * (j + operand);
+        }
+        machine->registers[3] = operand & 0x7 ? 0x80000001 * operand : 33;
+        memory_t memory = expected->memory;
+        *expected = *machine;
+        expected->memory = memory;
+
+        bool carry;
+        word_t op2 = operand2(expected, instruction, &carry);
+        word_t op1 = expected->registers[instruction->rn];
+        word_t result = alu(expected, instruction->operation, op1, op2);
+        if (writes_result(instruction->operation)) {
+          expected->registers[instruction->rd] = result;
+        }
+        if (s) {
+          set_dpi_flags(expected, instruction->operation, op1, op2, result,
+                        carry);
+        }
+        execute_dpi(machine, instruction);
+
+        update_flags(machine);
+        update_flags(expected);
+        for (int j = 0; j < NUM_REGISTERS; j++) {
+          assert(machine->registers[j] == expected->registers[j]);
+        }
+      }
+    }
+  }
+
+  free_system_state(machine);
+  free_system_state(expected);
+}
+
+void test_system_state(void) {
+  system_state_t *machine = create_system_state();
+  assert((uintptr_t) machine->registers % CACHE_LINE_SIZE == 0);
+  assert(machine->decoded_instruction.type == NUL);
+
+  // The decoded slot is filled in place, and only its type is cleared when
+  // nothing was fetched
+  machine->fetched_instruction = 0xE3A01001;
+  machine->has_fetched_instruction = true;
+  machine->registers[PC] = 4;
+  advance_pipeline(machine);
+  assert(machine->decoded_instruction.type == DPI);
+  assert(machine->decoded_instruction.rd == 1);
+  machine->has_fetched_instruction = false;
+  advance_pipeline(machine);
+  assert(machine->decoded_instruction.type == NUL);
+
+  // Words are little endian in memory, even unaligned or at the end of it
+  machine->quiet = true;
+  set_word(machine, 0x101, 0x12345678);
+  assert(get_byte(machine, 0x101) == 0x78 && get_byte(machine, 0x104) == 0x12);
+  assert(get_word(machine, 0x101) == 0x12345678);
+  assert(get_word_compliant(machine, 0x101) == 0x78563412);
+  set_word(machine, NUM_ADDRESSES - 4, 0xCAFEF00D);
+  assert(get_word(machine, NUM_ADDRESSES - 4) == 0xCAFEF00D);
+  assert(get_word(machine, GPIO_ACCESS_START + 4) == GPIO_ACCESS_START + 4);
+
+  free_system_state(machine);
+}
+
+void test_lazy_flags(void) {
+  system_state_t *machine = create_system_state();
+  machine->registers[CPSR] = 0x1000001F;
+
+  // cmp of 1 with 2 is only recorded until the flags are read
+  set_arithmetic_flags(machine, 1, 2, 1 - 2, true);
+  assert(machine->flags.pending);
+  assert(machine->registers[CPSR] == 0x1000001F);
+  update_flags(machine);
+  assert(!machine->flags.pending);
+  assert(machine->registers[CPSR] == 0x8000001F);
+
+  // Reading the flags through a condition also writes them
+  instruction_t instruction = NULL_INSTRUCTION;
+  instruction.cond = EQ;
+  set_flags(machine, 0, true);
+  assert(condition(machine, &instruction));
+  assert(machine->registers[CPSR] == 0x6000001F);
+
+  // A logical operation leaves the overflow flag from an arithmetic one
+  set_arithmetic_flags(machine, 0x7FFFFFFF, 1, 0x80000000, false);
+  set_flags(machine, 1, false);
+  update_flags(machine);
+  assert(machine->registers[CPSR] == 0x1000001F);
+
+  free_system_state(machine);
+}
+
+void test_conditions(void) {
+  system_state_t *machine = create_system_state();
+  instruction_t instruction = NULL_INSTRUCTION;
+
+  // Every condition, for every combination of flags
+  for (word_t flags = 0; flags < 16; flags++) {
+    bool n = flags & N, z = flags & Z, c = flags & C, v = flags & V;
+    bool passes[NUM_CONDITIONS] = {
+      [EQ] = z, [NE] = !z, [CS] = c, [CC] = !c,
+      [MI] = n, [PL] = !n, [VS] = v, [VC] = !v,
+      [HI] = c && !z, [LS] = !c || z, [GE] = n == v, [LT] = n != v,
+      [GT] = !z && n == v, [LE] = z || n != v, [AL] = true, [NV] = false,
+    };
+    machine->registers[CPSR] = (flags << (WORD_SIZE - 4)) | 0x1F;
+    for (int cond = 0; cond < NUM_CONDITIONS; cond++) {
+      instruction.cond = cond;
+      assert(CONDITION_TABLE[cond][flags] == passes[cond]);
+      assert(!condition(machine, &instruction) == !passes[cond]);
+    }
+  }
+
+  // Unsigned comparisons, from cmp of 1 with 2
+  set_arithmetic_flags(machine, 1, 2, 1 - 2, true);
+  instruction.cond = CC;
+  assert(condition(machine, &instruction));
+  instruction.cond = HI;
+  assert(!condition(machine, &instruction));
+
+  // cmp of 0x80000000 with 1 is higher, and overflows
+  set_arithmetic_flags(machine, 0x80000000, 1, 0x7FFFFFFF, true);
+  instruction.cond = HI;
+  assert(condition(machine, &instruction));
+  instruction.cond = VS;
+  assert(condition(machine, &instruction));
+  instruction.cond = GE;
+  assert(!condition(machine, &instruction));
+  assert(machine->registers[CPSR] == 0x3000001F);
+
+  // cmp of 0xFFFFFFFF with 0 is higher, but signed less than
+  set_arithmetic_flags(machine, 0xFFFFFFFF, 0, 0xFFFFFFFF, true);
+  instruction.cond = HI;
+  assert(condition(machine, &instruction));
+  instruction.cond = LT;
+  assert(condition(machine, &instruction));
+  instruction.cond = VS;
+  assert(!condition(machine, &instruction));
+
+  // An add which overflows, without a carry
+  set_arithmetic_flags(machine, 0x7FFFFFFF, 1, 0x80000000, false);
+  instruction.cond = VS;
+  assert(condition(machine, &instruction));
+  instruction.cond = CS;
+  assert(!condition(machine, &instruction));
+
+  // An add which carries, without overflowing
+  set_arithmetic_flags(machine, 0xFFFFFFFF, 1, 0, false);
+  instruction.cond = CS;
+  assert(condition(machine, &instruction));
+  instruction.cond = VC;
+  assert(condition(machine, &instruction));
+
+  free_system_state(machine);
+}
+
+system_state_t *load_machine(char *fname) {
+  system_state_t *machine = create_system_state();
+  machine->decoded_instruction = NULL_INSTRUCTION;
+  machine->decode_cache = calloc(NUM_WORDS, sizeof(predecoded_t));
+  load_file(fname, machine);
+  return machine;
+}
+
+system_state_t *load_words(const word_t *words, size_t num_words) {
+  system_state_t *machine = create_system_state();
+  machine->decoded_instruction = NULL_INSTRUCTION;
+  machine->decode_cache = calloc(NUM_WORDS, sizeof(predecoded_t));
+  for (size_t i = 0; i < num_words; i++) {
+    set_word(machine, i * 4, words[i]);
+  }
+  return machine;
+}
+
+void free_machine(system_state_t *machine) {
+  free_block_cache(machine->block_cache);
+  free(machine->decode_cache);
+  free_system_state(machine);
+}
+
+void run_to_stop(system_state_t *machine, engine_t engine) {
+  uint32_t address;
+  while (machine->decoded_instruction.type != ZER
+    && !watchdog_expired(machine)) {
+    if (engine != STEP_ENGINE && can_leave_pipeline(machine, &address)) {
+      if (engine == THREADED_ENGINE) {
+        run_threaded(machine, address);
+      } else {
+        run_blocks(machine, address);
+      }
+    } else {
+      machine->instructions += machine->decoded_instruction.type != NUL;
+      cycle(machine);
+    }
+  }
+}
+
+void assert_same_state(system_state_t *a, system_state_t *b) {
+  update_flags(a);
+  update_flags(b);
+  for (int i = 0; i < NUM_REGISTERS; i++) {
+    assert(a->registers[i] == b->registers[i]);
+  }
+  assert(same_memory(a, b));
+}
+
+FILE *start_capture(int *saved_stdout) {
+  fflush(stdout);
+  FILE *output = tmpfile();
+  *saved_stdout = dup(fileno(stdout));
+  assert(output && *saved_stdout >= 0);
+  dup2(fileno(output), fileno(stdout));
+  return output;
+}
+
+void end_capture(FILE *output, int saved_stdout) {
+  flush_writer();
+  dup2(saved_stdout, fileno(stdout));
+  close(saved_stdout);
+  rewind(output);
+}
+
+void test_sparse_memory(void) {
+  system_state_t *machine = create_system_state();
+  machine->quiet = true;
+  set_memory_size(machine, 0x1000000);
+
+  // A word across two pages, and a word near the end of memory
+  set_word(machine, 0x1FFE, 0x12345678);
+  assert(get_word(machine, 0x1FFE) == 0x12345678);
+  assert(get_halfword(machine, 0x1FFF) == 0x3456);
+  set_word(machine, 0xFFFFFC, 0xCAFEF00D);
+  assert(get_word(machine, 0xFFFFFC) == 0xCAFEF00D);
+  // Reading does not allocate, and an address past memory reads 0
+  assert(get_word(machine, 0x800000) == 0);
+  assert(get_word(machine, 0x1000000) == 0);
+  for (uint32_t page = 0; page < 0x1000; page++) {
+    bool written = page == 1 || page == 2 || page == 0xFFF;
+    assert(!memory_page(machine, page) == !written);
+  }
+
+  system_state_t *copy = create_system_state();
+  copy_memory(copy, machine);
+  assert(same_memory(copy, machine));
+  set_byte(copy, 0x800000, 1);
+  assert(!same_memory(copy, machine));
+  free_system_state(copy);
+  free_system_state(machine);
+}
+
+void test_memory_scan(void) {
+  system_state_t *machine = create_system_state();
+  set_memory_size(machine, 0x1000000);
+  // Words at the start and end of a chunk, a written page holding only zeros,
+  // and words on either side of a page boundary
+  uint32_t addresses[] = {0x40, 0x7C, 0x3FFC, 0x4000, 0x20000, 0xFFFFFC};
+  size_t count = sizeof(addresses) / sizeof(uint32_t);
+  set_word(machine, 0x5000, 0);
+  for (size_t i = 0; i < count; i++) {
+    set_word(machine, addresses[i], i + 1);
+  }
+
+  uint32_t address = next_nonzero_word(machine, 0);
+  for (size_t i = 0; i < count; i++) {
+    assert(address == addresses[i]);
+    address = next_nonzero_word(machine, address + 4);
+  }
+  assert(address == machine->memory.size);
+  assert(next_nonzero_word(machine, 0x44) == 0x7C);
+  free_system_state(machine);
+}
+
+void test_trace(void) {
+  system_state_t *machine = create_system_state();
+  set_memory_size(machine, 0x100000);
+  set_word(machine, 0x40, 0xE3A01005);
+  trace_t *trace = create_trace(machine, 3);
+
+  // Send the trace to a file rather than the test output
+  int saved_stdout;
+  FILE *output = start_capture(&saved_stdout);
+
+  trace_cycle(machine, trace);
+  machine->registers[1] = 5;
+  machine->registers[CPSR] = 1u << 30;
+  set_word(machine, 0x80000, 7);
+  trace_cycle(machine, trace);
+  trace_cycle(machine, trace);
+  trace_cycle(machine, trace);
+  end_capture(output, saved_stdout);
+
+  // Only the second cycle has changes to print, and the fourth is a snapshot
+  char text[4096];
+  text[fread(text, 1, sizeof(text) - 1, output)] = '\0';
+  fclose(output);
+  char *second = strstr(text, "Cycle 1,");
+  char *third = strstr(text, "Cycle 2,");
+  assert(second && third && !strstr(text, "Cycle 3,"));
+  *third = '\0';
+  assert(strstr(second, "Register  1: 0x00000000 -> 0x00000005"));
+  assert(strstr(second, "Flags: nzcv -> nZcv"));
+  assert(strstr(second, "Memory 0x00080000: 0x00000000 -> 0x00000007"));
+  assert(!strstr(second, "0x00000040"));
+  assert(!strstr(third + 1, "->"));
+
+  assert(get_word(trace->previous, 0x80000) == 7);
+  assert(get_word(trace->previous, 0x40) == 0xE3A01005);
+  assert(!machine->memory.stored[0]);
+  free_trace(trace);
+  free_system_state(machine);
+}
+
+void test_binary_output(void) {
+  system_state_t *machine = create_system_state();
+  machine->registers[0] = 0x12345678;
+  machine->registers[PC] = 0x40;
+  set_word(machine, 0x2000, 0xE3A01005);
+
+  int saved_stdout;
+  FILE *output = start_capture(&saved_stdout);
+  print_system_state_binary(machine);
+  end_capture(output, saved_stdout);
+
+  // The registers, then all of memory, as little endian bytes
+  size_t size = NUM_REGISTERS * 4 + NUM_ADDRESSES;
+  byte_t *bytes = malloc(size + 1);
+  assert(fread(bytes, 1, size + 1, output) == size);
+  fclose(output);
+  assert(read_le_word(bytes) == 0x12345678);
+  assert(read_le_word(bytes + 4 * PC) == 0x40);
+  assert(read_le_word(bytes + NUM_REGISTERS * 4 + 0x2000) == 0xE3A01005);
+  assert(!read_le_word(bytes + NUM_REGISTERS * 4 + 0x1000));
+  free(bytes);
+  free_system_state(machine);
+}
+
+// Loops 5 times adding 1 to r0, but the third pass stores add r0,r0,#16
+// over the add at 0x24, which has already been fetched, so runs once more
+static const word_t OVERWRITE_FETCHED[] = {
+  0xe3a00000, 0xe59f202c, 0xe3a03005, 0xe3a06000, 0xe3a07024, 0xe2866001,
+  0xe3560003, 0x1a000000, 0xe5872000, 0xe2800001, 0xe2433001, 0xe3530000,
+  0x1afffff7, 0x00000000, 0xe2800010,
+};
+
+void test_self_modifying(void) {
+  size_t length = sizeof(OVERWRITE_FETCHED) / sizeof(word_t);
+  system_state_t *stepped = load_words(OVERWRITE_FETCHED, length);
+  run_to_stop(stepped, STEP_ENGINE);
+  assert(stepped->registers[0] == 1 + 1 + 1 + 16 + 16);
+
+  // Every engine runs the new instruction once the old one has run
+  for (engine_t engine = THREADED_ENGINE; engine <= JIT_ENGINE; engine++) {
+    system_state_t *machine = load_words(OVERWRITE_FETCHED, length);
+    if (engine != THREADED_ENGINE) {
+      machine->block_cache = create_block_cache(engine == JIT_ENGINE, false);
+    }
+    run_to_stop(machine, engine);
+    assert_same_state(stepped, machine);
+    free_machine(machine);
+  }
+  free_machine(stepped);
+}
+
+void test_threaded(void) {
+  system_state_t *stepped = load_machine("../test_suite/test_cases/factorial");
+  system_state_t *threaded = load_machine("../test_suite/test_cases/factorial");
+
+  run_to_stop(stepped, STEP_ENGINE);
+  uint32_t address;
+  assert(can_leave_pipeline(threaded, &address));
+  run_to_stop(threaded, THREADED_ENGINE);
+
+  assert_same_state(stepped, threaded);
+  free_machine(stepped);
+  free_machine(threaded);
+
+  // After the store over the fetched add hands back to the pipeline, the
+  // engine resolves the new add, rather than the one the pipeline ran
+  size_t length = sizeof(OVERWRITE_FETCHED) / sizeof(word_t);
+  threaded = load_words(OVERWRITE_FETCHED, length);
+  run_to_stop(threaded, THREADED_ENGINE);
+  assert(threaded->registers[0] == 1 + 1 + 1 + 16 + 16);
+  predecoded_t *add = &threaded->decode_cache[0x24 >> 2];
+  assert(is_predecoded(threaded, 0x24) && add->handler);
+  assert(add->word == 0xE2800010);
+  assert(add->instruction.immediate_value == 16);
+  free_machine(threaded);
+}
+
+void test_blocks(void) {
+  system_state_t *stepped = load_machine("../test_suite/test_cases/loop02");
+  system_state_t *blocks = load_machine("../test_suite/test_cases/loop02");
+  blocks->block_cache = create_block_cache(false, false);
+
+  run_to_stop(stepped, STEP_ENGINE);
+  uint32_t address;
+  assert(can_leave_pipeline(blocks, &address));
+  run_to_stop(blocks, BLOCK_ENGINE);
+  // The loop body is translated once and linked to itself
+  assert(blocks->block_cache->num_blocks > 0);
+  assert(blocks->block_cache->flushes == 0);
+
+  assert_same_state(stepped, blocks);
+  free_machine(stepped);
+  free_machine(blocks);
+
+  // The third pass stores add r0,r0,#16 over the add at 0x2C, which was
+  // fetched but not yet run, and every pass stores it over the add at 0x34
+  word_t program[] = {
+    0xe3a00000, 0xe59f103c, 0xe59f203c, 0xe3a03005, 0xe3a06000, 0xe3a0702c,
+    0xe3a08034, 0xe2866001, 0xe3560003, 0x1a000000, 0xe5872000, 0xe2800001,
+    0xe5882000, 0xe2800c01, 0xe2433001, 0xe3530000, 0x1afffff5, 0x00000000,
+    0xe2800001, 0xe2800010,
+  };
+  size_t length = sizeof(program) / sizeof(word_t);
+  stepped = load_words(program, length);
+  run_to_stop(stepped, STEP_ENGINE);
+  assert(stepped->registers[0] == 0x163);
+  for (engine_t engine = BLOCK_ENGINE; engine <= JIT_ENGINE; engine++) {
+    blocks = load_words(program, length);
+    blocks->block_cache = create_block_cache(engine == JIT_ENGINE, false);
+    blocks->block_cache->fast_forward = false;
+    run_to_stop(blocks, engine);
+    // The blocks were translated again from the new code
+    assert(blocks->block_cache->flushes > 0);
+    block_t *skip = blocks->block_cache->lookup[0x2C >> 2];
+    assert(skip && skip->ops[0].instruction.immediate_value == 16);
+    assert_same_state(stepped, blocks);
+    free_machine(blocks);
+  }
+  free_machine(stepped);
+}
+
+void test_jit(void) {
+  system_state_t *stepped = load_machine("../test_suite/test_cases/loop01");
+  system_state_t *jit = load_machine("../test_suite/test_cases/loop01");
+  jit->block_cache = create_block_cache(true, false);
+  // Run every iteration, so that the loop body becomes hot
+  jit->block_cache->fast_forward = false;
+
+  run_to_stop(stepped, STEP_ENGINE);
+  run_to_stop(jit, JIT_ENGINE);
+#ifdef JIT_SUPPORTED
+  // The loop body is hot, so has been compiled
+  assert(jit->block_cache->jit->used > 0);
+  assert(jit->block_cache->lookup[0x4 >> 2]->native);
+#endif
+
+  assert_same_state(stepped, jit);
+  free_machine(jit);
+
+#ifdef JIT_SUPPORTED
+  // With the buffer full, native code is discarded and the loop compiled
+  system_state_t *full = load_machine("../test_suite/test_cases/loop01");
+  full->block_cache = create_block_cache(true, false);
+  full->block_cache->fast_forward = false;
+  full->block_cache->jit->used = JIT_BUFFER_SIZE - 16;
+  run_to_stop(full, JIT_ENGINE);
+  assert(full->block_cache->jit->used < JIT_BUFFER_SIZE - 16);
+  assert(full->block_cache->lookup[0x4 >> 2]->native);
+  assert_same_state(stepped, full);
+  free_machine(full);
+#endif
+  free_machine(stepped);
+}
+
+void test_fast_forward(void) {
+  system_state_t *stepped = load_machine("../test_suite/test_cases/loop01");
+  system_state_t *blocks = load_machine("../test_suite/test_cases/loop01");
+  blocks->block_cache = create_block_cache(false, false);
+
+  run_to_stop(stepped, STEP_ENGINE);
+  run_to_stop(blocks, BLOCK_ENGINE);
+  // The first of the 0x3EFF01 iterations is in the block at 0, and the loop
+  // at 0x4 skips all but the last of the rest
+  assert(blocks->block_cache->lookup[0x4 >> 2]->loop.valid);
+  assert(blocks->skipped_instructions == (uint64_t) 0x3EFEFF * 3);
+
+  assert_same_state(stepped, blocks);
+  free_machine(stepped);
+  free_machine(blocks);
+}
+
+void test_superinstructions(void) {
+  system_state_t *stepped = load_machine("../test_suite/test_cases/loop01");
+  system_state_t *fused = load_machine("../test_suite/test_cases/loop01");
+  fused->block_cache = create_block_cache(false, false);
+  // Run every iteration, so that the loop body becomes hot
+  fused->block_cache->fast_forward = false;
+
+  run_to_stop(stepped, STEP_ENGINE);
+  run_to_stop(fused, BLOCK_ENGINE);
+  // The sub, cmp and bne of the loop at 0x4 are fused, and run from the
+  // FUSE_THRESHOLDth of its 0x3EFF00 runs
+  block_cache_t *cache = fused->block_cache;
+  assert(cache->lookup[0x4 >> 2]->ops[0].fused == ALU_TEST_BRANCH_SUPER);
+  assert(cache->fused_sites[ALU_TEST_BRANCH_SUPER] == 1);
+  assert(cache->fused_runs[ALU_TEST_BRANCH_SUPER]
+         == 0x3EFF00 - (FUSE_THRESHOLD - 1));
+
+  assert_same_state(stepped, fused);
+  free_machine(stepped);
+  free_machine(fused);
+}
+
+void test_indirect_branch(void) {
+  // A jump table at 0x200 of 3 cases, run 200 times by ldr r15,[r3]
+  word_t program[] = {
+    0xe3a00c02, 0xe3a01034, 0xe5801000, 0xe3a0103c, 0xe5801004, 0xe3a01044,
+    0xe5801008, 0xe3a0103c, 0xe580100c, 0xe3a05000, 0xe2052003, 0xe0803102,
+    0xe593f000, 0xe2866001, 0xea000002, 0xe2877001, 0xea000000, 0xe2888001,
+    0xe2855001, 0xe35500c8, 0x1afffff4, 0x00000000,
+  };
+  size_t length = sizeof(program) / sizeof(word_t);
+  system_state_t *stepped = load_words(program, length);
+  system_state_t *blocks = load_words(program, length);
+  blocks->block_cache = create_block_cache(false, false);
+
+  run_to_stop(stepped, STEP_ENGINE);
+  run_to_stop(blocks, BLOCK_ENGINE);
+  // The instruction fetched after each ldr r15 is not run
+  assert(stepped->registers[6] == 50);
+  assert(stepped->registers[7] == 100);
+  assert(stepped->registers[8] == 50);
+  // Only the first jump to each case is looked up from the loop
+  assert(blocks->block_cache->indirect_misses == 4);
+  assert(blocks->block_cache->indirect_hits == 196);
+
+  assert_same_state(stepped, blocks);
+  free_machine(stepped);
+  free_machine(blocks);
+}
+
+void test_block_data_transfer(void) {
+  // push {r0-r3}, which is stmdb r13!, {r0-r3}
+  system_state_t *fetch = create_system_state();
+  fetch->fetched_instruction = 0xE92D000F;
+  fetch->decoded_instruction = BLANK_INSTRUCTION;
+  decode_instruction(fetch);
+  instruction_t *push = &fetch->decoded_instruction;
+  assert(push->type == BDT);
+  assert(push->rn == 13);
+  assert(push->immediate_value == 0xF);
+  assert(push->flag_0 && push->flag_1 && !push->flag_2 && !push->flag_3);
+  free_system_state(fetch);
+
+  // Every addressing mode, with and without write back, and stm of pc
+  word_t program[] = {
+    0xe3a00001, 0xe3a01002, 0xe3a02003, 0xe3a03004, 0xe3a0da01, 0xe92d000f,
+    0xe88d000a, 0xe3a04c02, 0xe9a4000d, 0xe91400e0, 0xe8340300, 0xe8bd0c00,
+    0xe8bd1000, 0xe8a40003, 0xe9a40004, 0xe9140020, 0xe3a00c03, 0xe3a01000,
+    0xe880c003, 0x00000000,
+  };
+  size_t length = sizeof(program) / sizeof(word_t);
+  system_state_t *stepped = load_words(program, length);
+  system_state_t *blocks = load_words(program, length);
+  blocks->block_cache = create_block_cache(false, false);
+
+  run_to_stop(stepped, STEP_ENGINE);
+  run_to_stop(blocks, BLOCK_ENGINE);
+  word_t expected[] = {
+    0x300, 0, 3, 4, 0x210, 4, 1, 3, 3, 4, 2, 4, 3, 0xFFC,
+  };
+  for (size_t i = 0; i < sizeof(expected) / sizeof(word_t); i++) {
+    assert(stepped->registers[i] == expected[i]);
+  }
+  assert(get_word(stepped, 0xFF0) == 2);
+  assert(get_word(stepped, 0xFFC) == 4);
+  assert(get_word(stepped, 0x210) == 3);
+  // pc is stored as the address of the stm plus 8
+  assert(get_word(stepped, 0x30C) == 0x50);
+
+  assert_same_state(stepped, blocks);
+  free_machine(stepped);
+  free_machine(blocks);
+}
+
+/** The last word written to the test device. */
+static word_t test_device_word;
+
+static bool read_test_device(system_state_t *machine, uint32_t mem_address,
+                             word_t *word) {
+  *word = test_device_word + (mem_address & 0xFF);
+  return true;
+}
+
+static bool write_test_device(system_state_t *machine, uint32_t mem_address,
+                              word_t word) {
+  test_device_word = word;
+  return true;
+}
+
+void test_devices(void) {
+  static const device_t test_device = {
+    .name = "test",
+    .start = 0x30000000,
+    .size = 0x2000,
+    .read = read_test_device,
+    .write = write_test_device,
+  };
+  register_device(&test_device);
+
+  system_state_t *machine = create_system_state();
+  machine->quiet = true;
+  set_word(machine, 0x30001000, 0x100);
+  assert(test_device_word == 0x100);
+  assert(get_word(machine, 0x30001004) == 0x104);
+  // Sub-word accesses go to the device as words
+  set_byte(machine, 0x30000000, 0x42);
+  assert(test_device_word == 0x42);
+  assert(get_byte(machine, 0x30000001) == 0x43);
+  // GPIO is still the default device
+  assert(get_word(machine, GPIO_ACCESS_START + 8) == GPIO_ACCESS_START + 8);
+  free_system_state(machine);
+}
+
+void test_byte_transfer(void) {
+  // ldrsh r5, [r0, #2]
+  system_state_t *fetch = create_system_state();
+  fetch->fetched_instruction = 0xE1D050F2;
+  fetch->decoded_instruction = BLANK_INSTRUCTION;
+  decode_instruction(fetch);
+  instruction_t *ldrsh = &fetch->decoded_instruction;
+  assert(ldrsh->type == SDT);
+  assert(ldrsh->transfer == SIGNED_HALF_TRANSFER);
+  assert(ldrsh->rn == 0 && ldrsh->rd == 5);
+  assert(ldrsh->immediate_value == 2);
+  assert(!ldrsh->flag_0 && ldrsh->flag_1 && ldrsh->flag_2 && ldrsh->flag_3);
+  free_system_state(fetch);
+
+  // Every size of load from 0x80FF7F81, then strb, strh, an unaligned ldrh,
+  // ldrb with a register offset and a post indexed ldrh
+  word_t program[] = {
+    0xe3a00c01, 0xe59f1038, 0xe5801000, 0xe5d02000, 0xe1d030d0, 0xe1d040b2,
+    0xe1d050f2, 0xe1d060d1, 0xe3a070ab, 0xe5c07005, 0xe59f8018, 0xe1c080b6,
+    0xe1d090b1, 0xe3a0a003, 0xe7d0b00a, 0xe0d0c0b4, 0x00000000, 0x80ff7f81,
+    0x00001234,
+  };
+  size_t length = sizeof(program) / sizeof(word_t);
+  system_state_t *stepped = load_words(program, length);
+  system_state_t *blocks = load_words(program, length);
+  blocks->block_cache = create_block_cache(false, false);
+
+  run_to_stop(stepped, STEP_ENGINE);
+  run_to_stop(blocks, BLOCK_ENGINE);
+  word_t expected[] = {
+    0x104, 0x80FF7F81, 0x81, 0xFFFFFF81, 0x80FF, 0xFFFF80FF, 0x7F, 0xAB,
+    0x1234, 0xFF7F, 3, 0x80, 0x7F81,
+  };
+  for (size_t i = 0; i < sizeof(expected) / sizeof(word_t); i++) {
+    assert(stepped->registers[i] == expected[i]);
+  }
+  assert(get_word(stepped, 0x104) == 0x1234AB00);
+  assert(get_byte(stepped, 0x105) == 0xAB);
+  assert(get_halfword(stepped, 0x105) == 0x34AB);
+
+  assert_same_state(stepped, blocks);
+
+  // A byte written into translated code invalidates it
+  set_byte(blocks, 0x20, 0x05);
+  assert(blocks->code_modified);
+  free_machine(stepped);
+  free_machine(blocks);
+}
+
+void test_return_stack(void) {
+  // 50 times, bl inc from 8 places, where inc: add r5,r5,#1; mov r15,r14
+  word_t program[] = {
+    0xe3a0d902, 0xe3a04032, 0xe3a05000, 0xeb00000a, 0xeb000009, 0xeb000008,
+    0xeb000007, 0xeb000006, 0xeb000005, 0xeb000004, 0xeb000003, 0xe2444001,
+    0xe3540000, 0x1afffff4, 0x00000000, 0xe2855001, 0xe1a0f00e,
+  };
+  size_t length = sizeof(program) / sizeof(word_t);
+  system_state_t *stepped = load_words(program, length);
+  system_state_t *blocks = load_words(program, length);
+  blocks->block_cache = create_block_cache(false, false);
+
+  run_to_stop(stepped, STEP_ENGINE);
+  run_to_stop(blocks, BLOCK_ENGINE);
+  assert(stepped->registers[5] == 400);
+  // The last call returns to the instruction after it
+  assert(stepped->registers[LR] == 0x2c);
+  // More callers than INDIRECT_WAYS, but every return is predicted
+  assert(blocks->block_cache->return_hits == 400);
+  assert(blocks->block_cache->return_misses == 0);
+  assert(blocks->block_cache->indirect_misses == 0);
+
+  assert_same_state(stepped, blocks);
+  free_machine(stepped);
+  free_machine(blocks);
+}
+
+void test_watchdog(void) {
+  // mov r1,#0; loop: add r1,r1,#1; b loop
+  word_t program[] = {0xe3a01000, 0xe2811001, 0xeafffffd};
+  size_t length = sizeof(program) / sizeof(word_t);
+  system_state_t *machines[] = {
+    load_words(program, length), load_words(program, length),
+    load_words(program, length),
+  };
+  machines[BLOCK_ENGINE]->block_cache = create_block_cache(false, false);
+
+  for (engine_t engine = STEP_ENGINE; engine <= BLOCK_ENGINE; engine++) {
+    system_state_t *machine = machines[engine];
+    watchdog_t watchdog;
+    start_watchdog(machine, &watchdog, 1000, 0);
+    run_to_stop(machine, engine);
+    // Stopped within a block of the limit
+    assert(watchdog.reached == INSTRUCTION_LIMIT);
+    assert(machine->instructions >= 1000 && machine->instructions <= 1002);
+    assert(machine->registers[1] == machine->instructions / 2);
+    free_machine(machine);
+  }
+
+  // Every engine counts the same instructions in a whole program
+  system_state_t *stepped = load_machine("../test_suite/test_cases/factorial");
+  system_state_t *threaded = load_machine("../test_suite/test_cases/factorial");
+  system_state_t *blocks = load_machine("../test_suite/test_cases/factorial");
+  blocks->block_cache = create_block_cache(false, false);
+  run_to_stop(stepped, STEP_ENGINE);
+  run_to_stop(threaded, THREADED_ENGINE);
+  run_to_stop(blocks, BLOCK_ENGINE);
+  assert(stepped->instructions > 0);
+  assert(threaded->instructions == stepped->instructions);
+  assert(blocks->instructions == stepped->instructions);
+  free_machine(stepped);
+  free_machine(threaded);
+  free_machine(blocks);
+}
+
+void test_cfg(void) {
+  system_state_t *machine = load_machine("../test_suite/test_cases/loop02");
+  cfg_t *cfg = build_cfg(machine);
+
+  // Leaders at the start, both loop heads and after each conditional branch
+  assert(cfg->num_blocks == 5);
+  assert(cfg->blocks[0].start == 0x0 && cfg->blocks[0].end == FALLTHROUGH_END);
+  assert(cfg->blocks[1].start == 0x4 && cfg->blocks[1].next_address == 0xC);
+  assert(cfg->blocks[2].end == BRANCH_END && cfg->blocks[2].target == 0xC);
+  assert(cfg->blocks[3].end == BRANCH_END && cfg->blocks[3].target == 0x4);
+  // The stop instruction is left to the pipeline
+  assert(cfg->blocks[4].start == 0x20 && cfg->blocks[4].end == PIPELINE_END);
+  assert(!cfg->reachable[0x20 >> 2]);
+
+  free_cfg(cfg);
+  free_machine(machine);
+}
+
+void test_writer(void) {
+  int saved_stdout;
+  FILE *output = start_capture(&saved_stdout);
+
+  // Enough output to wrap around the buffer, including a long message
+  start_writer();
+  size_t lines = 2 * WRITER_BUFFER_BYTES / 16;
+  for (size_t i = 0; i < lines; i++) {
+    writer_printf("Line %010zu\n", i);
+  }
+  char long_line[2 * WRITER_LINE_BYTES];
+  memset(long_line, 'x', sizeof(long_line) - 1);
+  long_line[sizeof(long_line) - 1] = '\0';
+  writer_printf("%s\n", long_line);
+  end_capture(output, saved_stdout);
+
+  // Everything is written, in order
+  char line[sizeof(long_line) + 1];
+  for (size_t i = 0; i < lines; i++) {
+    char expected[17];
+    snprintf(expected, sizeof(expected), "Line %010zu\n", i);
+    assert(fgets(line, sizeof(line), output) && !strcmp(line, expected));
+  }
+  assert(fgets(line, sizeof(line), output)
+         && strlen(line) == sizeof(long_line));
+  assert(!fgets(line, sizeof(line), output));
+  fclose(output);
 }
 
 int main(void) {
@@ -407,6 +1268,30 @@ int main(void) {
   run_test(test_decode_mul);
   run_test(test_decode_sdt);
   run_test(test_decode_bra);
+  run_test(test_decode_cache);
+  run_test(test_system_state);
+  run_test(test_lazy_flags);
+  run_test(test_conditions);
+  run_test(test_dpi_variants);
+  run_test(test_sparse_memory);
+  run_test(test_memory_scan);
+  run_test(test_trace);
+  run_test(test_binary_output);
+  run_test(test_self_modifying);
+  run_test(test_threaded);
+  run_test(test_blocks);
+  run_test(test_jit);
+  run_test(test_fast_forward);
+  run_test(test_superinstructions);
+  run_test(test_indirect_branch);
+  run_test(test_block_data_transfer);
+  run_test(test_byte_transfer);
+  run_test(test_devices);
+  run_test(test_return_stack);
+  run_test(test_watchdog);
+  run_test(test_cfg);
+  // Last, as the rest of the output would go through the writer thread
+  run_test(test_writer);
   printf("\nNo errors\n");
   return 0;
 }
@@ -0,0 +1,8 @@
+mov r0,#3
+bl double
+mov r1,sp
+add r2,r0,lr
+andeq r0,r0,r0
+double:
+add r0,r0,r0
+mov pc, lr